@@ -0,0 +1,324 @@
+// PluginCorpus.cpp --- PluginFramework raw frame corpus
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "PluginCorpus.h"
+#include <chrono>
+#include <cstring>
+#include <vector>
+#ifdef _WIN32
+    #include <tchar.h>
+    #include <io.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+static ULONGLONG DoAlignUp(ULONGLONG cb, ULONGLONG cbAlign)
+{
+    return (cb + cbAlign - 1) / cbAlign * cbAlign;
+}
+
+// The FILETIME of now (100ns units since 1601).
+static LONGLONG DoGetWallTime(void)
+{
+    using namespace std::chrono;
+    const LONGLONG llUnixEpoch = 116444736000000000LL;
+    return llUnixEpoch + duration_cast<duration<LONGLONG, std::ratio<1, 10000000> > >(
+        system_clock::now().time_since_epoch()).count();
+}
+
+static BOOL DoIsHeaderValid(const PLUGIN_CORPUS_HEADER& header)
+{
+    if (memcmp(header.szMagic, PLUGIN_CORPUS_MAGIC, sizeof(header.szMagic)) != 0 ||
+        header.dwVersion != PLUGIN_CORPUS_VERSION ||
+        header.cbHeader < sizeof(PLUGIN_CORPUS_HEADER) ||
+        header.nWidth <= 0 || header.nHeight <= 0)
+    {
+        return FALSE;
+    }
+
+    const ULONGLONG cbRow = ULONGLONG(header.nWidth) * CV_ELEM_SIZE(header.nType);
+    return header.cbStride >= cbRow &&
+           header.cbFrame >= ULONGLONG(header.cbStride) * header.nHeight;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+// Cuts the file to cb bytes and moves to the end.
+static BOOL DoTruncate(FILE *fp, ULONGLONG cb)
+{
+    fflush(fp);
+#ifdef _WIN32
+    return _chsize_s(_fileno(fp), LONGLONG(cb)) == 0 &&
+           _fseeki64(fp, LONGLONG(cb), SEEK_SET) == 0;
+#else
+    return ftruncate(fileno(fp), off_t(cb)) == 0 &&
+           fseeko(fp, off_t(cb), SEEK_SET) == 0;
+#endif
+}
+
+PluginCorpusWriter::PluginCorpusWriter() : m_fp(NULL), m_bFailed(FALSE)
+{
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+PluginCorpusWriter::~PluginCorpusWriter()
+{
+    Close();
+}
+
+BOOL PluginCorpusWriter::Open(LPCTSTR pszPath, INT nWidth, INT nHeight,
+                              INT nType, LONGLONG llInterval,
+                              LONGLONG llWallStart)
+{
+    Close();
+    if (nWidth <= 0 || nHeight <= 0)
+        return FALSE;
+
+#ifdef _WIN32
+    m_fp = _tfopen(pszPath, TEXT("wb"));
+#else
+    m_fp = fopen(pszPath, "wb");
+#endif
+    if (!m_fp)
+        return FALSE;
+
+    m_bFailed = FALSE;
+    memset(&m_header, 0, sizeof(m_header));
+    memcpy(m_header.szMagic, PLUGIN_CORPUS_MAGIC, sizeof(m_header.szMagic));
+    m_header.dwVersion = PLUGIN_CORPUS_VERSION;
+    m_header.cbHeader = PLUGIN_CORPUS_HEADER_SIZE;
+    m_header.nWidth = nWidth;
+    m_header.nHeight = nHeight;
+    m_header.nType = nType;
+    m_header.cbStride = DWORD(DoAlignUp(ULONGLONG(nWidth) * CV_ELEM_SIZE(nType),
+                                        PLUGIN_CORPUS_ROW_ALIGN));
+    m_header.cbFrame = DoAlignUp(ULONGLONG(m_header.cbStride) * nHeight,
+                                 PLUGIN_CORPUS_FRAME_ALIGN);
+    m_header.llInterval = llInterval;
+    m_header.llWallStart = llWallStart ? llWallStart : DoGetWallTime();
+
+    // the count is written by Close
+    std::vector<char> header(PLUGIN_CORPUS_HEADER_SIZE);
+    memcpy(&header[0], &m_header, sizeof(m_header));
+    if (fwrite(&header[0], header.size(), 1, m_fp) != 1)
+    {
+        fclose(m_fp);
+        m_fp = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL PluginCorpusWriter::Write(const cv::Mat& mat)
+{
+    if (!m_fp || m_bFailed || mat.cols != m_header.nWidth ||
+        mat.rows != m_header.nHeight || mat.type() != m_header.nType)
+    {
+        return FALSE;
+    }
+
+    if (!DoWriteFrame(mat))
+    {
+        m_bFailed = TRUE;
+        DoTruncate(m_fp, m_header.cbHeader + m_header.ullFrames * m_header.cbFrame);
+        return FALSE;
+    }
+
+    ++m_header.ullFrames;
+    return TRUE;
+}
+
+BOOL PluginCorpusWriter::DoWriteFrame(const cv::Mat& mat)
+{
+    const size_t cbRow = mat.cols * mat.elemSize();
+    static const char s_abZeros[PLUGIN_CORPUS_FRAME_ALIGN] = { 0 };
+    for (int y = 0; y < mat.rows; ++y)
+    {
+        if (fwrite(mat.ptr(y), cbRow, 1, m_fp) != 1)
+            return FALSE;
+        if (m_header.cbStride > cbRow &&
+            fwrite(s_abZeros, m_header.cbStride - cbRow, 1, m_fp) != 1)
+        {
+            return FALSE;
+        }
+    }
+
+    const size_t cbPad = size_t(m_header.cbFrame - ULONGLONG(m_header.cbStride) * mat.rows);
+    return !cbPad || fwrite(s_abZeros, cbPad, 1, m_fp) == 1;
+}
+
+BOOL PluginCorpusWriter::Close()
+{
+    if (!m_fp)
+        return FALSE;
+
+    BOOL bOK = fseek(m_fp, 0, SEEK_SET) == 0 &&
+               fwrite(&m_header, sizeof(m_header), 1, m_fp) == 1;
+    bOK = (fclose(m_fp) == 0) && bOK && !m_bFailed;
+    m_fp = NULL;
+    return bOK;
+}
+
+ULONGLONG PluginCorpusWriter::GetCount() const
+{
+    return m_header.ullFrames;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+PluginCorpusReader::PluginCorpusReader()
+    : m_ullFrames(0)
+    , m_pbBase(NULL)
+    , m_cbFile(0)
+#ifdef _WIN32
+    , m_hFile(INVALID_HANDLE_VALUE)
+    , m_hMapping(NULL)
+#else
+    , m_fd(-1)
+#endif
+{
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+PluginCorpusReader::~PluginCorpusReader()
+{
+    Close();
+}
+
+BOOL PluginCorpusReader::Open(LPCTSTR pszPath)
+{
+    Close();
+
+#ifdef _WIN32
+    m_hFile = CreateFile(pszPath, GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    LARGE_INTEGER li;
+    if (!GetFileSizeEx(m_hFile, &li))
+    {
+        Close();
+        return FALSE;
+    }
+    m_cbFile = ULONGLONG(li.QuadPart);
+
+    // copy-on-write, for the plugins that write pictures
+    m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if (m_hMapping)
+        m_pbBase = (uchar *)MapViewOfFile(m_hMapping, FILE_MAP_COPY, 0, 0, 0);
+#else
+    m_fd = open(pszPath, O_RDONLY);
+    if (m_fd < 0)
+        return FALSE;
+
+    struct stat st;
+    if (fstat(m_fd, &st) != 0)
+    {
+        Close();
+        return FALSE;
+    }
+    m_cbFile = ULONGLONG(st.st_size);
+
+    // copy-on-write, for the plugins that write pictures
+    if (m_cbFile)
+    {
+        void *pv = mmap(NULL, size_t(m_cbFile), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE, m_fd, 0);
+        if (pv != MAP_FAILED)
+        {
+            m_pbBase = (uchar *)pv;
+            madvise(pv, size_t(m_cbFile), MADV_SEQUENTIAL);
+        }
+    }
+#endif
+    if (!m_pbBase || m_cbFile < sizeof(PLUGIN_CORPUS_HEADER))
+    {
+        Close();
+        return FALSE;
+    }
+
+    memcpy(&m_header, m_pbBase, sizeof(m_header));
+    if (!DoIsHeaderValid(m_header) || m_cbFile < m_header.cbHeader)
+    {
+        Close();
+        return FALSE;
+    }
+
+    // a corpus whose writer was not closed has all of its complete frames
+    ULONGLONG ullFrames = (m_cbFile - m_header.cbHeader) / m_header.cbFrame;
+    if (m_header.ullFrames && m_header.ullFrames < ullFrames)
+        ullFrames = m_header.ullFrames;
+    m_ullFrames = ullFrames;
+    return TRUE;
+}
+
+void PluginCorpusReader::Close()
+{
+#ifdef _WIN32
+    if (m_pbBase)
+        UnmapViewOfFile(m_pbBase);
+    if (m_hMapping)
+        CloseHandle(m_hMapping);
+    if (m_hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(m_hFile);
+    m_hMapping = NULL;
+    m_hFile = INVALID_HANDLE_VALUE;
+#else
+    if (m_pbBase)
+        munmap(m_pbBase, size_t(m_cbFile));
+    if (m_fd >= 0)
+        close(m_fd);
+    m_fd = -1;
+#endif
+    m_pbBase = NULL;
+    m_cbFile = 0;
+    m_ullFrames = 0;
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+const PLUGIN_CORPUS_HEADER& PluginCorpusReader::GetHeader() const
+{
+    return m_header;
+}
+
+ULONGLONG PluginCorpusReader::GetCount() const
+{
+    return m_ullFrames;
+}
+
+cv::Mat PluginCorpusReader::GetFrame(ULONGLONG iFrame) const
+{
+    if (iFrame >= m_ullFrames)
+        return cv::Mat();
+
+    uchar *pb = m_pbBase + m_header.cbHeader + iFrame * m_header.cbFrame;
+    return cv::Mat(m_header.nHeight, m_header.nWidth, m_header.nType, pb,
+                   m_header.cbStride);
+}
+
+void PluginCorpusReader::GetInfo(ULONGLONG iFrame, PLUGIN_FRAME_INFO& info) const
+{
+    memset(&info, 0, sizeof(info));
+    info.cbSize = sizeof(info);
+    info.ullFrameIndex = iFrame;
+    info.llCaptureTime = LONGLONG(iFrame) * m_header.llInterval;
+    info.llWallOffset = m_header.llWallStart;
+    info.nFormat = m_header.nType;
+    info.nDirtyRects = PLUGIN_DIRTY_ALL;
+}
+
+void PluginCorpusReader::Discard(ULONGLONG iFrame)
+{
+    if (iFrame >= m_ullFrames)
+        return;
+
+#ifndef _WIN32
+    // a view of FILE_MAP_COPY can't drop its private pages on Windows
+    uchar *pb = m_pbBase + m_header.cbHeader + iFrame * m_header.cbFrame;
+    madvise(pb, size_t(m_header.cbFrame), MADV_DONTNEED);
+#endif
+}
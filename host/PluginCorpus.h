@@ -0,0 +1,113 @@
+// PluginCorpus.h --- PluginFramework raw frame corpus
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#ifndef PLUGIN_CORPUS_H_
+#define PLUGIN_CORPUS_H_
+
+// NOTE: A corpus is a file of raw frames of the same size and type, to
+//       replay through a chain without decoding.  A header of
+//       PLUGIN_CORPUS_HEADER_SIZE bytes is followed by the frames.  Each
+//       frame starts on a page boundary and its rows are
+//       PLUGIN_CORPUS_ROW_ALIGN-byte aligned, so a frame is a cv::Mat view
+//       of the mapped file and the frames are read in the order of the
+//       file.
+//
+//       PluginCorpusReader maps the file copy-on-write: a plugin may write
+//       to a frame, and the written pages are private to the reader until
+//       Discard or Close.  The file is never modified.
+
+#include "../plugins/Plugin.h"
+#include <cstdio>
+
+#define PLUGIN_CORPUS_MAGIC "YAPFRAME"
+#define PLUGIN_CORPUS_VERSION 1
+#define PLUGIN_CORPUS_HEADER_SIZE 4096
+#define PLUGIN_CORPUS_FRAME_ALIGN 4096
+#define PLUGIN_CORPUS_ROW_ALIGN 64
+
+// The header at the start of the file, in little endian.
+struct PLUGIN_CORPUS_HEADER
+{
+    char szMagic[8];                // PLUGIN_CORPUS_MAGIC, not terminated
+    DWORD dwVersion;                // PLUGIN_CORPUS_VERSION
+    DWORD cbHeader;                 // the offset of the first frame
+    INT nWidth;
+    INT nHeight;
+    INT nType;                      // the cv::Mat type
+    DWORD cbStride;                 // the bytes per row
+    ULONGLONG cbFrame;              // the distance between the frames
+    ULONGLONG ullFrames;            // zero if the writer was not closed
+    LONGLONG llInterval;            // between the frames, in 100ns units
+    LONGLONG llWallStart;           // the FILETIME (UTC) of the first frame
+};
+
+class PluginCorpusWriter
+{
+public:
+    PluginCorpusWriter();
+    ~PluginCorpusWriter();
+
+    // llInterval is in 100ns units.  llWallStart is a FILETIME, or zero for
+    // now.
+    BOOL Open(LPCTSTR pszPath, INT nWidth, INT nHeight, INT nType,
+              LONGLONG llInterval, LONGLONG llWallStart = 0);
+    // The frame must have the size and the type of Open.  If writing fails,
+    // the partial frame is cut off the file and the writer fails every
+    // later Write, so that the file holds only the whole frames before it.
+    BOOL Write(const cv::Mat& mat);
+    // Writes the number of the whole frames to the header.  Returns FALSE if
+    // a Write failed.
+    BOOL Close();
+
+    ULONGLONG GetCount() const;
+
+protected:
+    FILE *m_fp;
+    BOOL m_bFailed;
+    PLUGIN_CORPUS_HEADER m_header;
+
+    BOOL DoWriteFrame(const cv::Mat& mat);
+
+private:
+    PluginCorpusWriter(const PluginCorpusWriter&);
+    PluginCorpusWriter& operator=(const PluginCorpusWriter&);
+};
+
+class PluginCorpusReader
+{
+public:
+    PluginCorpusReader();
+    ~PluginCorpusReader();
+
+    BOOL Open(LPCTSTR pszPath);
+    void Close();
+
+    const PLUGIN_CORPUS_HEADER& GetHeader() const;
+    ULONGLONG GetCount() const;
+    // Returns a view of the mapped frame, or an empty cv::Mat.  The view is
+    // valid until Discard(iFrame) or Close.
+    cv::Mat GetFrame(ULONGLONG iFrame) const;
+    // Fills in the info of the frame as it was recorded, for Submit.
+    void GetInfo(ULONGLONG iFrame, PLUGIN_FRAME_INFO& info) const;
+    // Drops the pages of a replayed frame and the changes to them, so that
+    // a long replay keeps no more than the page cache of the file.
+    void Discard(ULONGLONG iFrame);
+
+protected:
+    PLUGIN_CORPUS_HEADER m_header;
+    ULONGLONG m_ullFrames;
+    uchar *m_pbBase;
+    ULONGLONG m_cbFile;
+#ifdef _WIN32
+    HANDLE m_hFile;
+    HANDLE m_hMapping;
+#else
+    int m_fd;
+#endif
+
+private:
+    PluginCorpusReader(const PluginCorpusReader&);
+    PluginCorpusReader& operator=(const PluginCorpusReader&);
+};
+
+#endif  // ndef PLUGIN_CORPUS_H_
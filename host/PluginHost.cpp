@@ -0,0 +1,748 @@
+// PluginHost.cpp --- PluginFramework reference host
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "PluginHost.h"
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#ifndef _WIN32
+    #include <dlfcn.h>
+    #include <dirent.h>
+    #include <fnmatch.h>
+#endif
+
+typedef std::basic_string<TCHAR> host_string;
+
+static void DoCopyText(TCHAR *pszDest, size_t cchDest, LPCTSTR pszSrc)
+{
+    size_t ich;
+    for (ich = 0; ich + 1 < cchDest && pszSrc[ich]; ++ich)
+    {
+        pszDest[ich] = pszSrc[ich];
+    }
+    pszDest[ich] = 0;
+}
+
+// The monotonic time in 100ns units.
+static LONGLONG DoGetCaptureTime(void)
+{
+    using namespace std::chrono;
+    return duration_cast<duration<LONGLONG, std::ratio<1, 10000000> > >(
+        steady_clock::now().time_since_epoch()).count();
+}
+
+// The FILETIME of now (100ns units since 1601).
+static LONGLONG DoGetWallTime(void)
+{
+    using namespace std::chrono;
+    const LONGLONG llUnixEpoch = 116444736000000000LL;
+    return llUnixEpoch + duration_cast<duration<LONGLONG, std::ratio<1, 10000000> > >(
+        system_clock::now().time_since_epoch()).count();
+}
+
+// Adds the rectangles that a plugin modified to those of the frame.
+static void DoMergeDirty(PLUGIN_FRAME_INFO& info, const PLUGIN_FRAME_INFO& stage)
+{
+    if (info.nDirtyRects == PLUGIN_DIRTY_ALL)
+        return;
+
+    if (stage.nDirtyRects == PLUGIN_DIRTY_ALL ||
+        info.nDirtyRects + stage.nDirtyRects > PLUGIN_MAX_DIRTY_RECTS)
+    {
+        info.nDirtyRects = PLUGIN_DIRTY_ALL;
+        return;
+    }
+
+    for (UINT i = 0; i < stage.nDirtyRects; ++i)
+    {
+        info.rcDirty[info.nDirtyRects++] = stage.rcDirty[i];
+    }
+}
+
+PluginHost::PluginHost(DWORD dwStreamID, HINSTANCE hInstance, HWND hwnd)
+    : m_dwStreamID(dwStreamID)
+    , m_hInstance(hInstance)
+    , m_hwnd(hwnd)
+    , m_bRunning(FALSE)
+    , m_mode(PLUGIN_HOST_INLINE)
+    , m_sink(NULL)
+    , m_pContext(NULL)
+    , m_ullFrames(0)
+    , m_llWallOffset(0)
+    , m_fpDump(NULL)
+    , m_bDumpJson(FALSE)
+    , m_fpTrace(NULL)
+{
+    m_allocator.SetSpans(&m_spans);
+
+    // the plugins refuse a NULL framework_instance
+    if (!m_hInstance)
+    {
+#ifdef _WIN32
+        m_hInstance = GetModuleHandle(NULL);
+#else
+        m_hInstance = (HINSTANCE)dlopen(NULL, RTLD_LAZY);
+#endif
+    }
+}
+
+PluginHost::~PluginHost()
+{
+    UnloadAll();
+}
+
+LRESULT APIENTRY
+PluginHost::DoDriver(PLUGIN *pi, UINT uFunc, WPARAM wParam, LPARAM lParam)
+{
+    PluginHost *pHost = pi->framework_impl->pHost;
+
+    LRESULT result = 0;
+    if (PluginAllocator_Driver(pHost->m_allocator, uFunc, wParam, lParam, result))
+        return result;
+    if (PluginStats_Driver(pi->framework_impl->stats, uFunc, wParam, lParam, result))
+        return result;
+    if (PluginSpans_Driver(pHost->m_spans, uFunc, wParam, result))
+        return result;
+    return 0;
+}
+
+PLUGIN *PluginHost::DoLoad(HMODULE hModule, LPCTSTR pszPath, PLUGIN_LOAD Load,
+                           PLUGIN_UNLOAD Unload, PLUGIN_ACT Act)
+{
+    if (!Load || !Unload || !Act)
+        return NULL;
+
+    PLUGIN_FRAMEWORK_IMPL *impl = new PLUGIN_FRAMEWORK_IMPL;
+    impl->pHost = this;
+    impl->hModule = hModule;
+    impl->Load = Load;
+    impl->Unload = Unload;
+    impl->Act = Act;
+
+    PLUGIN *pi = new PLUGIN();
+    pi->framework_version = FRAMEWORK_VERSION;
+    DoCopyText(pi->framework_name, sizeof(pi->framework_name) / sizeof(TCHAR),
+               FRAMEWORK_NAME);
+    pi->framework_instance = m_hInstance;
+    pi->framework_window = m_hwnd;
+    DoCopyText(pi->plugin_pathname, MAX_PATH, pszPath ? pszPath : TEXT(""));
+    pi->framework_impl = impl;
+    pi->driver = DoDriver;
+
+    if (!Load(pi, (LPARAM)m_dwStreamID))
+    {
+        delete pi;
+        delete impl;
+        return NULL;
+    }
+
+    // the file names are ASCII
+    size_t ich;
+    for (ich = 0; ich + 1 < sizeof(impl->szName) && pi->plugin_filename[ich]; ++ich)
+    {
+        impl->szName[ich] = char(pi->plugin_filename[ich]);
+    }
+    impl->szName[ich] = 0;
+
+    m_plugins.push_back(pi);
+    return pi;
+}
+
+PLUGIN *PluginHost::LoadFile(LPCTSTR pszPath)
+{
+    if (m_bRunning)
+        return NULL;
+
+#ifdef _WIN32
+    HMODULE hModule = LoadLibrary(pszPath);
+    if (!hModule)
+        return NULL;
+
+    PLUGIN_LOAD Load = (PLUGIN_LOAD)GetProcAddress(hModule, "Plugin_Load");
+    PLUGIN_UNLOAD Unload = (PLUGIN_UNLOAD)GetProcAddress(hModule, "Plugin_Unload");
+    PLUGIN_ACT Act = (PLUGIN_ACT)GetProcAddress(hModule, "Plugin_Act");
+#else
+    void *hLib = dlopen(pszPath, RTLD_NOW | RTLD_LOCAL);
+    if (!hLib)
+        return NULL;
+
+    HMODULE hModule = (HMODULE)hLib;
+    PLUGIN_LOAD Load = (PLUGIN_LOAD)dlsym(hLib, "Plugin_Load");
+    PLUGIN_UNLOAD Unload = (PLUGIN_UNLOAD)dlsym(hLib, "Plugin_Unload");
+    PLUGIN_ACT Act = (PLUGIN_ACT)dlsym(hLib, "Plugin_Act");
+#endif
+
+    PLUGIN *pi = DoLoad(hModule, pszPath, Load, Unload, Act);
+    if (!pi)
+    {
+#ifdef _WIN32
+        FreeLibrary(hModule);
+#else
+        dlclose(hLib);
+#endif
+    }
+    return pi;
+}
+
+PLUGIN *PluginHost::LoadEntries(PLUGIN_LOAD Load, PLUGIN_UNLOAD Unload,
+                                PLUGIN_ACT Act)
+{
+    if (m_bRunning)
+        return NULL;
+
+    return DoLoad(NULL, NULL, Load, Unload, Act);
+}
+
+INT PluginHost::LoadDir(LPCTSTR pszDir)
+{
+    std::vector<host_string> names;
+
+#ifdef _WIN32
+    host_string strSpec = pszDir;
+    strSpec += TEXT("\\");
+    strSpec += FRAMEWORK_SPEC;
+
+    WIN32_FIND_DATA find;
+    HANDLE hFind = FindFirstFile(strSpec.c_str(), &find);
+    if (hFind != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            if (!(find.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+                names.push_back(find.cFileName);
+        } while (FindNextFile(hFind, &find));
+        FindClose(hFind);
+    }
+    const TCHAR chSep = TEXT('\\');
+#else
+    if (DIR *pDir = opendir(pszDir))
+    {
+        while (struct dirent *pEntry = readdir(pDir))
+        {
+            if (fnmatch(FRAMEWORK_SPEC, pEntry->d_name, 0) == 0)
+                names.push_back(pEntry->d_name);
+        }
+        closedir(pDir);
+    }
+    const TCHAR chSep = '/';
+#endif
+
+    std::sort(names.begin(), names.end());
+
+    INT nCount = 0;
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        host_string strPath = pszDir;
+        strPath += chSep;
+        strPath += names[i];
+        if (LoadFile(strPath.c_str()))
+            ++nCount;
+    }
+    return nCount;
+}
+
+void PluginHost::DoUnload(PLUGIN *pi)
+{
+    PLUGIN_FRAMEWORK_IMPL *impl = pi->framework_impl;
+    impl->Unload(pi, 0);
+
+    if (impl->hModule)
+    {
+#ifdef _WIN32
+        FreeLibrary(impl->hModule);
+#else
+        dlclose((void *)impl->hModule);
+#endif
+    }
+
+    delete impl;
+    delete pi;
+}
+
+void PluginHost::UnloadAll()
+{
+    Stop();
+    DoFreeReaders();
+
+    // in the reverse order of loading
+    while (m_plugins.size())
+    {
+        DoUnload(m_plugins.back());
+        m_plugins.pop_back();
+    }
+}
+
+size_t PluginHost::GetCount() const
+{
+    return m_plugins.size();
+}
+
+PLUGIN *PluginHost::GetPlugin(size_t i) const
+{
+    if (i >= m_plugins.size())
+        return NULL;
+    return m_plugins[i];
+}
+
+// Counts the pictures that an action gives.
+static void DoCountFrames(UINT uAction, WPARAM wParam, ULONGLONG& ullFrames,
+                          ULONGLONG& ullBytes)
+{
+    ullFrames = ullBytes = 0;
+    switch (uAction)
+    {
+    case PLUGIN_ACTION_PICREAD:
+    case PLUGIN_ACTION_PICWRITE:
+        if (const cv::Mat *pmat = (const cv::Mat *)wParam)
+        {
+            ullFrames = 1;
+            ullBytes = pmat->total() * pmat->elemSize();
+        }
+        break;
+    case PLUGIN_ACTION_PICWRITE_BATCH:
+        if (const PLUGIN_BATCH *pBatch = (const PLUGIN_BATCH *)wParam)
+        {
+            for (UINT i = 0; i < pBatch->nCount; ++i)
+            {
+                if (const cv::Mat *pmat = pBatch->ppmat[i])
+                {
+                    ++ullFrames;
+                    ullBytes += pmat->total() * pmat->elemSize();
+                }
+            }
+        }
+        break;
+    }
+}
+
+// The categories of the spans of Plugin_Act.
+static const char *const s_apszActions[] =
+{
+    "ACTION",
+    "STARTREC",
+    "PAUSE",
+    "ENDREC",
+    "PICREAD",
+    "PICWRITE",
+    "SHOWDIALOG",
+    "REFRESH",
+    "PICWRITE_BATCH",
+};
+
+LRESULT PluginHost::Act(PLUGIN *pi, UINT uAction, WPARAM wParam, LPARAM lParam)
+{
+    PLUGIN_FRAMEWORK_IMPL *impl = pi->framework_impl;
+
+    ULONGLONG ullFrames, ullBytes;
+    DoCountFrames(uAction, wParam, ullFrames, ullBytes);
+
+    LONGLONG llBegin = PluginSpanRecorder::Now();
+    LRESULT result = impl->Act(pi, uAction, wParam, lParam);
+    LONGLONG llEnd = PluginSpanRecorder::Now();
+
+    impl->stats.RecordAct(uAction, llEnd - llBegin, ullFrames, ullBytes);
+
+    if (m_spans.IsEnabled())
+    {
+        LONGLONG llFrame = -1;
+        if ((uAction == PLUGIN_ACTION_PICREAD ||
+             uAction == PLUGIN_ACTION_PICWRITE) && lParam)
+        {
+            llFrame = LONGLONG(((const PLUGIN_FRAME_INFO *)lParam)->ullFrameIndex);
+        }
+
+        const UINT cActions = sizeof(s_apszActions) / sizeof(s_apszActions[0]);
+        m_spans.Record(impl->szName, s_apszActions[uAction < cActions ? uAction : 0],
+                       llBegin, llEnd, llFrame);
+    }
+    return result;
+}
+
+PluginStats& PluginHost::GetStats(PLUGIN *pi)
+{
+    return pi->framework_impl->stats;
+}
+
+void PluginHost::SetDumpFile(FILE *fp, BOOL bJson)
+{
+    m_fpDump = fp;
+    m_bDumpJson = bJson;
+}
+
+void PluginHost::SetTraceFile(FILE *fp)
+{
+    m_fpTrace = fp;
+}
+
+void PluginHost::DumpStats(FILE *fp, BOOL bJson)
+{
+    if (bJson)
+    {
+        DoDumpStatsJson(fp);
+        return;
+    }
+
+    for (size_t i = 0; i < m_plugins.size(); ++i)
+    {
+        PLUGIN *pi = m_plugins[i];
+        pi->framework_impl->stats.Dump(fp, pi->framework_impl->szName);
+        if (ULONGLONG ullDropped = GetDropped(pi))
+            fprintf(fp, "  dropped: %llu frames\n", ullDropped);
+    }
+
+    PLUGIN_ALLOC_STATS stats;
+    m_allocator.GetStats(stats);
+    fprintf(fp, "allocator: %llu buffers, %llu from the pool, peak %.1f MB\n",
+            stats.ullAllocs, stats.ullHits, stats.cbPeakResident / 1e6);
+    fflush(fp);
+}
+
+void PluginHost::DoDumpStatsJson(FILE *fp)
+{
+    fprintf(fp, "{\"plugins\": [\n");
+    for (size_t i = 0; i < m_plugins.size(); ++i)
+    {
+        PLUGIN *pi = m_plugins[i];
+        if (i > 0)
+            fprintf(fp, ",\n");
+        pi->framework_impl->stats.DumpJson(fp, pi->framework_impl->szName);
+    }
+
+    fprintf(fp, "\n], \"dropped\": [");
+    for (size_t i = 0; i < m_plugins.size(); ++i)
+    {
+        fprintf(fp, "%s%llu", (i > 0) ? ", " : "", GetDropped(m_plugins[i]));
+    }
+
+    PLUGIN_ALLOC_STATS stats;
+    m_allocator.GetStats(stats);
+    fprintf(fp, "],\n\"allocator\": {\"allocs\": %llu, \"hits\": %llu, "
+                "\"peak_bytes\": %llu}}\n",
+            stats.ullAllocs, stats.ullHits, stats.cbPeakResident);
+    fflush(fp);
+}
+
+PluginAllocator& PluginHost::GetAllocator()
+{
+    return m_allocator;
+}
+
+BOOL PluginHost::IsRunning() const
+{
+    return m_bRunning;
+}
+
+ULONGLONG PluginHost::GetDropped(PLUGIN *pi) const
+{
+    for (size_t i = 0; i < m_readers.size(); ++i)
+    {
+        if (m_readers[i]->pi == pi)
+            return m_readers[i]->ullDropped.load();
+    }
+    return 0;
+}
+
+BOOL PluginHost::Start(PLUGIN_HOST_MODE mode, PLUGIN_HOST_SINK sink,
+                       void *pContext, UINT nRingSize)
+{
+    if (m_bRunning)
+        return FALSE;
+
+    m_mode = mode;
+    m_sink = sink;
+    m_pContext = pContext;
+    m_ullFrames = 0;
+    m_llWallOffset = DoGetWallTime() - DoGetCaptureTime();
+    DoFreeReaders();
+    if (m_fpTrace)
+        m_spans.Begin();
+
+    std::vector<PLUGIN_HOST_READER *> readers;  // before the next writer
+    for (size_t i = 0; i < m_plugins.size(); ++i)
+    {
+        PLUGIN *pi = m_plugins[i];
+        pi->framework_impl->stats.ResetActs();
+        Act(pi, PLUGIN_ACTION_STARTREC, 0, 0);
+
+        if (pi->dwFlags & PLUGIN_FLAG_PICWRITER)
+        {
+            PLUGIN_HOST_STAGE *stage = new PLUGIN_HOST_STAGE(pi, nRingSize);
+            stage->readers.swap(readers);
+            m_stages.push_back(stage);
+        }
+        else if (pi->dwFlags & PLUGIN_FLAG_PICREADER)
+        {
+            PLUGIN_HOST_READER *reader = new PLUGIN_HOST_READER(pi, nRingSize);
+            m_readers.push_back(reader);
+            readers.push_back(reader);
+        }
+    }
+    m_tailReaders.swap(readers);
+
+    // the readers are off the chain in either mode
+    for (size_t i = 0; i < m_readers.size(); ++i)
+    {
+        m_readers[i]->thread = std::thread(&PluginHost::DoReaderProc, this, i);
+    }
+
+    if (m_mode == PLUGIN_HOST_PIPELINED)
+    {
+        for (size_t i = 0; i < m_stages.size(); ++i)
+        {
+            m_stages[i]->thread = std::thread(&PluginHost::DoStageProc, this, i);
+        }
+    }
+
+    m_bRunning = TRUE;
+    return TRUE;
+}
+
+void PluginHost::Stop()
+{
+    if (!m_bRunning)
+        return;
+
+    if (m_mode == PLUGIN_HOST_PIPELINED && m_stages.size())
+    {
+        // the end marker goes after the last frame through every stage
+        PLUGIN_HOST_FRAME frame;
+        frame.bEnd = true;
+        m_stages[0]->ring.Push(frame);
+
+        for (size_t i = 0; i < m_stages.size(); ++i)
+        {
+            m_stages[i]->thread.join();
+        }
+    }
+
+    for (size_t i = 0; i < m_stages.size(); ++i)
+    {
+        delete m_stages[i];
+    }
+    m_stages.clear();
+
+    // the readers get the frames they have room for, and then stop
+    for (size_t i = 0; i < m_readers.size(); ++i)
+    {
+        PLUGIN_HOST_FRAME frame;
+        frame.bEnd = true;
+        m_readers[i]->ring.Push(frame);
+        m_readers[i]->thread.join();
+    }
+
+    for (size_t i = 0; i < m_plugins.size(); ++i)
+    {
+        Act(m_plugins[i], PLUGIN_ACTION_ENDREC, 0, 0);
+    }
+
+    if (m_fpDump)
+        DumpStats(m_fpDump, m_bDumpJson);
+
+    if (m_spans.IsEnabled())
+    {
+        m_spans.End();
+        m_spans.Export(m_fpTrace);
+    }
+
+    m_bRunning = FALSE;
+}
+
+BOOL PluginHost::Submit(const cv::Mat& mat, const PLUGIN_FRAME_INFO *pInfo)
+{
+    if (!m_bRunning || !mat.data)
+        return FALSE;
+
+    // it covers the wait of PLUGIN_HOST_PIPELINED mode for a full chain
+    PluginSpan span(&m_spans, "Submit", "host", LONGLONG(m_ullFrames));
+
+    // a reader may hold the frame after the sink gets it.  The reference
+    // count of mat keeps its buffer alive, so only a buffer without one is
+    // copied; the writers copy the frame in DoUnshare if a reader holds it.
+    PLUGIN_HOST_FRAME frame;
+    frame.bShare = DoHasReaders();
+    if (frame.bShare && !mat.u)
+    {
+        frame.mat.allocator = &m_allocator;
+        mat.copyTo(frame.mat);
+    }
+    else
+    {
+        frame.mat = mat;
+    }
+
+    PLUGIN_FRAME_INFO& info = frame.info;
+    memset(&info, 0, sizeof(info));
+    if (pInfo && pInfo->cbSize >= PLUGIN_FRAME_INFO_V1_SIZE)
+    {
+        memcpy(&info, pInfo, PLUGIN_FRAME_INFO_V1_SIZE);
+    }
+    else
+    {
+        info.dwStreamID = m_dwStreamID;
+        info.ullFrameIndex = m_ullFrames;
+        info.llCaptureTime = DoGetCaptureTime();
+        info.llWallOffset = m_llWallOffset;
+    }
+    info.cbSize = sizeof(info);
+    info.nFormat = mat.type();
+    info.nDirtyRects = 0;
+    ++m_ullFrames;
+
+    if (m_mode == PLUGIN_HOST_PIPELINED && m_stages.size())
+    {
+        m_stages[0]->ring.Push(frame);
+        return TRUE;
+    }
+
+    for (size_t i = 0; i < m_stages.size(); ++i)
+    {
+        DoRunStage(*m_stages[i], frame);
+    }
+    DoShare(m_tailReaders, frame);
+    DoDeliver(frame);
+    return TRUE;
+}
+
+BOOL PluginHost::DoHasReaders() const
+{
+    for (size_t i = 0; i < m_readers.size(); ++i)
+    {
+        if (m_readers[i]->pi->bEnabled)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// Gives the frame to the readers that have room for it.  It never waits.
+void PluginHost::DoShare(const std::vector<PLUGIN_HOST_READER *>& readers,
+                         PLUGIN_HOST_FRAME& frame)
+{
+    if (!frame.bShare || !frame.mat.data)
+        return;
+
+    for (size_t i = 0; i < readers.size(); ++i)
+    {
+        PLUGIN_HOST_READER *reader = readers[i];
+        if (!reader->pi->bEnabled)
+            continue;
+
+        if (!frame.pReaders)
+            frame.pReaders = std::make_shared<std::atomic<int> >(0);
+
+        PLUGIN_HOST_FRAME share;
+        share.mat = frame.mat;
+        share.info = frame.info;
+        share.pReaders = frame.pReaders;
+        ++*frame.pReaders;
+        if (!reader->ring.TryPush(share))
+        {
+            --*frame.pReaders;
+            ++reader->ullDropped;
+        }
+    }
+}
+
+// Copy-on-write: gives the frame a buffer of its own if a reader still
+// holds the buffer.
+void PluginHost::DoUnshare(PLUGIN_HOST_FRAME& frame)
+{
+    if (frame.pReaders && frame.pReaders->load(std::memory_order_acquire) > 0)
+    {
+        cv::Mat mat;
+        mat.allocator = &m_allocator;
+        frame.mat.copyTo(mat);
+        frame.mat = mat;
+    }
+    frame.pReaders.reset();
+}
+
+void PluginHost::DoReaderProc(size_t iReader)
+{
+    PLUGIN_HOST_READER& reader = *m_readers[iReader];
+
+    PLUGIN_HOST_FRAME frame;
+    for (;;)
+    {
+        reader.ring.Pop(frame);
+        if (frame.bEnd)
+            break;
+
+        Act(reader.pi, PLUGIN_ACTION_PICREAD, (WPARAM)&frame.mat,
+            (LPARAM)&frame.info);
+
+        frame.pReaders->fetch_sub(1, std::memory_order_release);
+        frame = PLUGIN_HOST_FRAME();
+    }
+}
+
+// The readers are kept after Stop for GetDropped.
+void PluginHost::DoFreeReaders()
+{
+    for (size_t i = 0; i < m_readers.size(); ++i)
+    {
+        delete m_readers[i];
+    }
+    m_readers.clear();
+    m_tailReaders.clear();
+}
+
+void PluginHost::DoRunStage(PLUGIN_HOST_STAGE& stage, PLUGIN_HOST_FRAME& frame)
+{
+    DoShare(stage.readers, frame);
+
+    PLUGIN *pi = stage.pi;
+    if (!pi->bEnabled || !frame.mat.data)
+        return;
+
+    if (pi->dwFlags & PLUGIN_FLAG_PICREADER)
+    {
+        Act(pi, PLUGIN_ACTION_PICREAD, (WPARAM)&frame.mat, (LPARAM)&frame.info);
+    }
+
+    if (pi->dwFlags & PLUGIN_FLAG_PICWRITER)
+    {
+        DoUnshare(frame);
+
+        PLUGIN_FRAME_INFO info = frame.info;
+        info.nDirtyRects = PLUGIN_DIRTY_ALL;
+        Act(pi, PLUGIN_ACTION_PICWRITE, (WPARAM)&frame.mat, (LPARAM)&info);
+
+        DoMergeDirty(frame.info, info);
+        frame.info.nFormat = frame.mat.type();
+    }
+}
+
+void PluginHost::DoDeliver(PLUGIN_HOST_FRAME& frame)
+{
+    if (m_sink)
+        m_sink(frame.mat, frame.info, m_pContext);
+}
+
+void PluginHost::DoStageProc(size_t iStage)
+{
+    PLUGIN_HOST_STAGE& stage = *m_stages[iStage];
+    const bool bLast = (iStage + 1 == m_stages.size());
+
+    PLUGIN_HOST_FRAME frame;
+    for (;;)
+    {
+        stage.ring.Pop(frame);
+
+        const bool bEnd = frame.bEnd;
+        if (!bEnd)
+            DoRunStage(stage, frame);
+
+        if (!bLast)
+            m_stages[iStage + 1]->ring.Push(frame);
+        else if (!bEnd)
+        {
+            DoShare(m_tailReaders, frame);
+            DoDeliver(frame);
+            frame.mat.release();
+        }
+
+        if (bEnd)
+            break;
+    }
+}
@@ -0,0 +1,197 @@
+// PluginHost.h --- PluginFramework reference host
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#ifndef PLUGIN_HOST_H_
+#define PLUGIN_HOST_H_
+
+// NOTE: A PluginHost loads a chain of plugins for a stream and runs the
+//       frames through it.  In PLUGIN_HOST_INLINE mode the whole chain runs
+//       in Submit.  In PLUGIN_HOST_PIPELINED mode each plugin that reads or
+//       writes pictures runs on its own thread, with a PluginRing before it,
+//       so that the second plugin works on frame N-1 while the first works
+//       on frame N.  Either way the sink gets the frames in order.
+//
+//       A plugin that only reads pictures is not in the chain.  It runs on
+//       its own reader thread, and shares the frame with the chain at its
+//       place in the order of loading.  A writer after it copies the frame
+//       only if the reader still holds it.  A reader that falls behind
+//       skips frames instead of slowing the chain down.
+
+#include "../plugins/Plugin.h"
+#include "../plugins/PluginAllocator.h"
+#include "../plugins/PluginStats.h"
+#include "../plugins/PluginSpans.h"
+#include "PluginRing.h"
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+
+class PluginHost;
+
+struct PLUGIN_FRAMEWORK_IMPL
+{
+    PluginHost *pHost;
+    HMODULE hModule;                // NULL if linked in
+    PLUGIN_LOAD Load;
+    PLUGIN_UNLOAD Unload;
+    PLUGIN_ACT Act;
+    PluginStats stats;              // the timing of Act and the counters
+    char szName[64];                // plugin_filename for the spans
+};
+
+enum PLUGIN_HOST_MODE
+{
+    PLUGIN_HOST_INLINE,             // the lowest latency
+    PLUGIN_HOST_PIPELINED           // the highest throughput
+};
+
+// Gets a processed frame.  In PLUGIN_HOST_PIPELINED mode it is called on
+// the thread of the last plugin.  The readers may share mat.
+typedef void (*PLUGIN_HOST_SINK)(const cv::Mat& mat,
+                                 const PLUGIN_FRAME_INFO& info, void *pContext);
+
+struct PLUGIN_HOST_FRAME
+{
+    cv::Mat mat;
+    PLUGIN_FRAME_INFO info;
+    bool bEnd;                      // the end of the stream
+    bool bShare;                    // the readers may get mat, by Submit
+    std::shared_ptr<std::atomic<int> > pReaders;    // the readers holding mat
+
+    PLUGIN_HOST_FRAME() : bEnd(false), bShare(false)
+    {
+    }
+};
+
+struct PLUGIN_HOST_READER
+{
+    PLUGIN *pi;
+    PluginRing<PLUGIN_HOST_FRAME> ring;     // the frames to read
+    std::thread thread;
+    std::atomic<ULONGLONG> ullDropped;      // the frames skipped
+
+    PLUGIN_HOST_READER(PLUGIN *pi_, size_t nRingSize)
+        : pi(pi_), ring(nRingSize), ullDropped(0)
+    {
+    }
+};
+
+struct PLUGIN_HOST_STAGE
+{
+    PLUGIN *pi;
+    PluginRing<PLUGIN_HOST_FRAME> ring;     // the frames before the plugin
+    std::thread thread;
+    std::vector<PLUGIN_HOST_READER *> readers;  // read before the plugin writes
+
+    PLUGIN_HOST_STAGE(PLUGIN *pi_, size_t nRingSize) : pi(pi_), ring(nRingSize)
+    {
+    }
+};
+
+class PluginHost
+{
+public:
+    // dwStreamID is also the instance number for Plugin_Load.
+    PluginHost(DWORD dwStreamID = 0, HINSTANCE hInstance = NULL,
+               HWND hwnd = NULL);
+    ~PluginHost();
+
+    // Loads a plugin file.  Returns NULL if failed.
+    PLUGIN *LoadFile(LPCTSTR pszPath);
+    // Loads a plugin that is linked in.  Returns NULL if failed.
+    PLUGIN *LoadEntries(PLUGIN_LOAD Load, PLUGIN_UNLOAD Unload, PLUGIN_ACT Act);
+    // Loads the FRAMEWORK_SPEC files in the folder, in the order of the names.
+    // Returns the number of the plugins loaded.
+    INT LoadDir(LPCTSTR pszDir);
+    void UnloadAll();
+
+    size_t GetCount() const;
+    PLUGIN *GetPlugin(size_t i) const;
+    LRESULT Act(PLUGIN *pi, UINT uAction, WPARAM wParam, LPARAM lParam);
+
+    // Starts recording.  The chain is the plugins that write the pictures,
+    // in the order of loading; a disabled plugin is skipped.
+    BOOL Start(PLUGIN_HOST_MODE mode, PLUGIN_HOST_SINK sink, void *pContext,
+               UINT nRingSize = 4);
+    // Gives a frame to the chain.  pInfo may be NULL.  In
+    // PLUGIN_HOST_PIPELINED mode it waits while the chain is full.
+    //
+    // The buffer of mat is shared, not copied, and the writers of the chain
+    //   work in it.  Don't write to it until the sink has returned for the
+    //   frame.
+    //   - If an enabled reader is loaded, a reader may hold the buffer after
+    //     the sink returns.  The host keeps a reference to it (mat.u), so
+    //     release it instead of writing to it, and take a new buffer for the
+    //     next frame, e.g. from GetAllocator.  A buffer without a reference
+    //     count (mat.u == NULL) is copied into a buffer of GetAllocator
+    //     then, and is free when Submit returns.
+    //   - Otherwise the host keeps no reference after the sink returns.
+    //   Whether the readers get the frame is decided once, in Submit.
+    BOOL Submit(const cv::Mat& mat, const PLUGIN_FRAME_INFO *pInfo = NULL);
+    // Waits for the submitted frames, and then ends recording.
+    void Stop();
+    BOOL IsRunning() const;
+    // The number of the frames that a reader skipped in this recording.
+    ULONGLONG GetDropped(PLUGIN *pi) const;
+
+    // The frame allocator for the plugins.  Allocate the submitted frames
+    // from it, too.
+    PluginAllocator& GetAllocator();
+
+    // The timing is restarted by Start.
+    PluginStats& GetStats(PLUGIN *pi);
+    // bJson writes a JSON object with a line for each action and counter,
+    // so that the dumps of two builds can be diffed.  The dropped frames are
+    // in the order of the plugins.
+    void DumpStats(FILE *fp, BOOL bJson = FALSE);
+    // Stop dumps the statistics to fp after PLUGIN_ACTION_ENDREC.  NULL for
+    // no dump.
+    void SetDumpFile(FILE *fp, BOOL bJson = FALSE);
+    // Start records the spans, and Stop writes them to fp as Chrome trace
+    // events after PLUGIN_ACTION_ENDREC.  NULL for no spans.
+    void SetTraceFile(FILE *fp);
+
+protected:
+    DWORD m_dwStreamID;
+    HINSTANCE m_hInstance;
+    HWND m_hwnd;
+    std::vector<PLUGIN *> m_plugins;
+    PluginSpanRecorder m_spans;
+    PluginAllocator m_allocator;
+
+    BOOL m_bRunning;
+    PLUGIN_HOST_MODE m_mode;
+    PLUGIN_HOST_SINK m_sink;
+    void *m_pContext;
+    std::vector<PLUGIN_HOST_STAGE *> m_stages;
+    std::vector<PLUGIN_HOST_READER *> m_readers;
+    std::vector<PLUGIN_HOST_READER *> m_tailReaders;   // after the last writer
+    ULONGLONG m_ullFrames;
+    LONGLONG m_llWallOffset;
+    FILE *m_fpDump;
+    BOOL m_bDumpJson;
+    FILE *m_fpTrace;
+
+    PLUGIN *DoLoad(HMODULE hModule, LPCTSTR pszPath, PLUGIN_LOAD Load,
+                   PLUGIN_UNLOAD Unload, PLUGIN_ACT Act);
+    void DoUnload(PLUGIN *pi);
+    void DoRunStage(PLUGIN_HOST_STAGE& stage, PLUGIN_HOST_FRAME& frame);
+    void DoStageProc(size_t iStage);
+    void DoDeliver(PLUGIN_HOST_FRAME& frame);
+    BOOL DoHasReaders() const;
+    void DoShare(const std::vector<PLUGIN_HOST_READER *>& readers,
+                 PLUGIN_HOST_FRAME& frame);
+    void DoUnshare(PLUGIN_HOST_FRAME& frame);
+    void DoReaderProc(size_t iReader);
+    void DoFreeReaders();
+    void DoDumpStatsJson(FILE *fp);
+    static LRESULT APIENTRY DoDriver(PLUGIN *pi, UINT uFunc, WPARAM wParam,
+                                     LPARAM lParam);
+
+private:
+    PluginHost(const PluginHost&);
+    PluginHost& operator=(const PluginHost&);
+};
+
+#endif  // ndef PLUGIN_HOST_H_
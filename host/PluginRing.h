@@ -0,0 +1,131 @@
+// PluginRing.h --- PluginFramework bounded single-producer ring
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#ifndef PLUGIN_RING_H_
+#define PLUGIN_RING_H_
+
+// NOTE: A ring between two threads, one that pushes and one that pops.
+//       Push blocks while the ring is full, which slows the producer down to
+//       the pace of the consumer (back-pressure).  Pop blocks while the ring
+//       is empty.  Either side spins a little before it sleeps, and the
+//       other side takes the lock only if somebody sleeps.
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#ifndef PLUGIN_RING_SPIN
+    #define PLUGIN_RING_SPIN 64     // how many times to yield before sleeping
+#endif
+
+template <typename T_ITEM>
+class PluginRing
+{
+public:
+    // The capacity is rounded up to a power of two.
+    explicit PluginRing(size_t nCapacity)
+        : m_head(0)
+        , m_tail(0)
+        , m_nWaiting(0)
+    {
+        size_t n = 1;
+        while (n < nCapacity)
+            n <<= 1;
+        m_items.resize(n);
+        m_mask = n - 1;
+    }
+
+    size_t GetCapacity() const
+    {
+        return m_items.size();
+    }
+
+    // Moves item into the ring, leaving item empty.
+    void Push(T_ITEM& item)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        DoWait([&]() {
+            return head - m_tail.load() < m_items.size();
+        });
+
+        std::swap(m_items[head & m_mask], item);
+        m_head.store(head + 1);
+        DoWake();
+    }
+
+    // Moves item into the ring unless the ring is full.  Returns false and
+    // leaves item as it is if the ring is full.
+    bool TryPush(T_ITEM& item)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load() >= m_items.size())
+            return false;
+
+        std::swap(m_items[head & m_mask], item);
+        m_head.store(head + 1);
+        DoWake();
+        return true;
+    }
+
+    // Moves the oldest item out of the ring into item.
+    void Pop(T_ITEM& item)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        DoWait([&]() {
+            return m_head.load() != tail;
+        });
+
+        // leave nothing in the slot, e.g. a reference to a frame buffer
+        T_ITEM& slot = m_items[tail & m_mask];
+        std::swap(slot, item);
+        slot = T_ITEM();
+        m_tail.store(tail + 1);
+        DoWake();
+    }
+
+protected:
+    std::vector<T_ITEM> m_items;
+    size_t m_mask;
+    std::atomic<size_t> m_head;         // written by the producer
+    std::atomic<size_t> m_tail;         // written by the consumer
+    std::atomic<int> m_nWaiting;        // the sleepers
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+
+    // The sleeper counts itself in m_nWaiting before it checks again, and
+    // the waker checks m_nWaiting after it publishes, so a wake-up is never
+    // lost.
+    template <typename T_READY>
+    void DoWait(T_READY ready)
+    {
+        for (int i = 0; i < PLUGIN_RING_SPIN; ++i)
+        {
+            if (ready())
+                return;
+            std::this_thread::yield();
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        ++m_nWaiting;
+        m_cond.wait(lock, ready);
+        --m_nWaiting;
+    }
+
+    void DoWake()
+    {
+        if (m_nWaiting.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cond.notify_all();
+        }
+    }
+
+private:
+    PluginRing(const PluginRing&);
+    PluginRing& operator=(const PluginRing&);
+};
+
+#endif  // ndef PLUGIN_RING_H_
@@ -0,0 +1,420 @@
+// yapbench.cpp --- PluginFramework benchmark of the plugins on corpus frames
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "PluginHost.h"
+#include "PluginCorpus.h"
+#ifdef _WIN32
+    #include "../plugins/mregkey.hpp"
+    #include <strsafe.h>
+#endif
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// NOTE: yapbench replays the frames of each corpus (see yapcorpus) through a
+//       PluginHost with one plugin, once for each preset of its settings.
+//       The plugins are linked in (PLUGIN_STATIC).  The settings go to the
+//       stream YAPBENCH_STREAM, so that those of a real stream are kept.
+//
+//       Each run submits the warm-up frames, stops, and then submits the
+//       measured frames from the start of the corpus again, so that the
+//       timing of the host starts with a warm plugin.  A line gives the
+//       frames per second and the nanoseconds per frame of the whole
+//       replay, the p99 of PLUGIN_ACTION_PICWRITE, and the buffers of the
+//       allocator per frame; the statistics of the host follow.
+//
+//       As a capture device would, each frame is copied from the mapped
+//       corpus into a buffer of a small pool, BENCH_RING_FRAMES buffers
+//       whose pages are faulted in before the replay.  Otherwise the
+//       plugins would write to the pages of the file, and each frame would
+//       pay for their faults and copies on write.  The copies are timed
+//       on their own and left out of the time of the replay.
+
+#define YAPBENCH_STREAM 9100
+#define BENCH_RING_FRAMES 8
+
+PLUGIN_DECLARE_STATIC(Clock)
+PLUGIN_DECLARE_STATIC(Rotation)
+
+enum BENCH_PLUGIN
+{
+    BENCH_CLOCK,
+    BENCH_ROTATION,
+    BENCH_PLUGIN_COUNT
+};
+
+struct BENCH_ENTRIES
+{
+    const char *pszName;
+    LPCTSTR pszApp;                 // the key of the settings
+    PLUGIN_LOAD Load;
+    PLUGIN_UNLOAD Unload;
+    PLUGIN_ACT Act;
+};
+
+static const BENCH_ENTRIES s_entries[BENCH_PLUGIN_COUNT] =
+{
+    { "Clock", TEXT("Clock_yap"), Clock_Plugin_Load, Clock_Plugin_Unload,
+      Clock_Plugin_Act },
+    { "Rotation", TEXT("Rotation_yap"), Rotation_Plugin_Load,
+      Rotation_Plugin_Unload, Rotation_Plugin_Act },
+};
+
+// A setting is a DWORD, or a string if pszValue is not NULL.
+struct BENCH_SETTING
+{
+    LPCTSTR pszName;
+    DWORD dwValue;
+    LPCTSTR pszValue;
+};
+
+#define BENCH_MAX_SETTINGS 8
+
+struct BENCH_PRESET
+{
+    BENCH_PLUGIN nPlugin;
+    const char *pszName;
+    BENCH_SETTING settings[BENCH_MAX_SETTINGS];     // up to a NULL name
+};
+
+// The settings of every run of the plugin, before those of the preset.
+static const BENCH_SETTING s_clockBase[] =
+{
+    { TEXT("Scale"), 100, NULL },
+    { TEXT("Thickness"), 2, NULL },
+    { TEXT("Align"), 2, NULL },             // right
+    { TEXT("VAlign"), 2, NULL },            // bottom
+    { TEXT("Margin"), 8, NULL },
+    { TEXT("Isa"), 0, NULL },               // PLUGIN_ISA_AUTO
+    { NULL, 0, NULL },
+};
+
+static const BENCH_SETTING s_rotationBase[] =
+{
+    { TEXT("Angle"), 150, NULL },
+    { TEXT("Zoom"), 120, NULL },
+    { TEXT("Keystone"), 10, NULL },
+    { TEXT("Isa"), 0, NULL },               // PLUGIN_ISA_AUTO
+    { NULL, 0, NULL },
+};
+
+// The captions of the dialog of Clock.yap and the modes of Rotation.yap.
+static const BENCH_PRESET s_presets[] =
+{
+    { BENCH_CLOCK, "&h:&m", { { TEXT("Caption"), 0, TEXT("&h:&m") } } },
+    { BENCH_CLOCK, "&h:&m:&s", { { TEXT("Caption"), 0, TEXT("&h:&m:&s") } } },
+    { BENCH_CLOCK, "&h:&m:&s.&f", { { TEXT("Caption"), 0, TEXT("&h:&m:&s.&f") } } },
+    { BENCH_CLOCK, "&y.&M.&d &h:&m:&s",
+      { { TEXT("Caption"), 0, TEXT("&y.&M.&d &h:&m:&s") } } },
+    { BENCH_CLOCK, "&y.&M.&d &h:&m:&s.&f",
+      { { TEXT("Caption"), 0, TEXT("&y.&M.&d &h:&m:&s.&f") } } },
+    { BENCH_CLOCK, "&y.&M.&d", { { TEXT("Caption"), 0, TEXT("&y.&M.&d") } } },
+    { BENCH_CLOCK, "Sample Text", { { TEXT("Caption"), 0, TEXT("Sample Text") } } },
+    { BENCH_ROTATION, "90", { { TEXT("Rotation"), 1, NULL } } },
+    { BENCH_ROTATION, "180", { { TEXT("Rotation"), 2, NULL } } },
+    { BENCH_ROTATION, "270", { { TEXT("Rotation"), 3, NULL } } },
+    { BENCH_ROTATION, "flip-h", { { TEXT("Rotation"), 4, NULL } } },
+    { BENCH_ROTATION, "flip-v", { { TEXT("Rotation"), 5, NULL } } },
+    { BENCH_ROTATION, "custom", { { TEXT("Rotation"), 6, NULL } } },
+};
+
+struct BENCH_OPTIONS
+{
+    std::vector<const char *> corpora;
+    const char *pszPlugin;          // NULL for all
+    const char *pszPreset;          // NULL for all
+    PLUGIN_HOST_MODE mode;
+    int nWarmUp;
+    int nFrames;                    // zero for the whole corpus
+    int nThreads;                   // of Rotation.yap; zero for the CPUs
+    bool bJson;
+};
+
+static void DoUsage(void)
+{
+    printf("Usage: yapbench CORPUS... [OPTIONS]\n"
+           "Replays the frames of each CORPUS (see yapcorpus) through each\n"
+           "plugin with each preset of its settings, and prints the timing.\n"
+           "\n"
+           "OPTIONS:\n"
+           "  -plugin Clock|Rotation  only this plugin\n"
+           "  -preset NAME            only this preset, e.g. \"&h:&m:&s\" or 90\n"
+           "  -mode inline|pipelined  the mode of the host (default: pipelined)\n"
+           "  -warmup N               the frames before timing (default: 30)\n"
+           "  -frames N               the frames timed (default: the corpus)\n"
+           "  -threads N              the workers of Rotation.yap\n"
+           "                          (default: 0, one per CPU)\n"
+           "  -json                   the statistics of the host as JSON\n");
+}
+
+static bool DoParseArgs(int argc, char **argv, BENCH_OPTIONS& options)
+{
+    options.pszPlugin = NULL;
+    options.pszPreset = NULL;
+    options.mode = PLUGIN_HOST_PIPELINED;
+    options.nWarmUp = 30;
+    options.nFrames = 0;
+    options.nThreads = 0;
+    options.bJson = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (arg[0] != '-')
+        {
+            options.corpora.push_back(arg);
+            continue;
+        }
+
+        if (strcmp(arg, "-json") == 0)
+        {
+            options.bJson = true;
+            continue;
+        }
+        if (!value)
+            return false;
+        ++i;
+
+        if (strcmp(arg, "-plugin") == 0)
+        {
+            options.pszPlugin = value;
+        }
+        else if (strcmp(arg, "-preset") == 0)
+        {
+            options.pszPreset = value;
+        }
+        else if (strcmp(arg, "-mode") == 0)
+        {
+            if (strcmp(value, "inline") == 0)
+                options.mode = PLUGIN_HOST_INLINE;
+            else if (strcmp(value, "pipelined") == 0)
+                options.mode = PLUGIN_HOST_PIPELINED;
+            else
+                return false;
+        }
+        else if (strcmp(arg, "-warmup") == 0)
+        {
+            options.nWarmUp = atoi(value);
+        }
+        else if (strcmp(arg, "-frames") == 0)
+        {
+            options.nFrames = atoi(value);
+        }
+        else if (strcmp(arg, "-threads") == 0)
+        {
+            options.nThreads = atoi(value);
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return options.corpora.size() && options.nWarmUp >= 0 &&
+           options.nFrames >= 0 && options.nThreads >= 0;
+}
+
+static void DoSetSettings(LPCTSTR pszApp, const BENCH_SETTING *pSettings)
+{
+    TCHAR szKey[64];
+    StringCchPrintf(szKey, ARRAYSIZE(szKey), TEXT("%s\\Instance%u"), pszApp,
+                    (UINT)YAPBENCH_STREAM);
+
+    MRegKey hkeyCompany(HKEY_CURRENT_USER,
+                        TEXT("Software\\Katayama Hirofumi MZ"), TRUE);
+    MRegKey hkeyApp(hkeyCompany, szKey, TRUE);
+    for (; pSettings->pszName; ++pSettings)
+    {
+        if (pSettings->pszValue)
+            hkeyApp.SetSz(pSettings->pszName, pSettings->pszValue);
+        else
+            hkeyApp.SetDword(pSettings->pszName, pSettings->dwValue);
+    }
+}
+
+// "8UC3" etc.
+static void DoGetTypeName(int type, char *psz, size_t cb)
+{
+    static const char *const s_apszDepths[] =
+    {
+        "8U", "8S", "16U", "16S", "32S", "32F", "64F", "16F"
+    };
+    StringCbPrintfA(psz, cb, "%sC%d", s_apszDepths[CV_MAT_DEPTH(type)],
+                     CV_MAT_CN(type));
+}
+
+// The sink drops the pages of the frame, so that the next replay reads
+// the frame of the file again.
+// The buffers that the frames are copied into before Submit.
+struct BENCH_RING
+{
+    PluginAllocator allocator;
+    LONGLONG llCopyNanos;           // of the copies of the last replay
+};
+
+// Faults the pages of the buffers in and leaves them in the pool.
+static void DoFillRing(BENCH_RING& ring, const PLUGIN_CORPUS_HEADER& header)
+{
+    cv::Mat amat[BENCH_RING_FRAMES];
+    for (INT i = 0; i < BENCH_RING_FRAMES; ++i)
+    {
+        amat[i].allocator = &ring.allocator;
+        amat[i].create(header.nHeight, header.nWidth, header.nType);
+        amat[i].setTo(cv::Scalar::all(0));
+    }
+}
+
+// Submits the frames 0 to nFrames - 1 of the corpus in a recording.
+static void DoReplay(PluginHost& host, const BENCH_OPTIONS& options,
+                     PluginCorpusReader& reader, BENCH_RING& ring,
+                     ULONGLONG ullFrames)
+{
+    ring.llCopyNanos = 0;
+    host.Start(options.mode, NULL, NULL);
+    for (ULONGLONG iFrame = 0; iFrame < ullFrames; ++iFrame)
+    {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        cv::Mat mat;
+        mat.allocator = &ring.allocator;
+        reader.GetFrame(iFrame).copyTo(mat);
+        reader.Discard(iFrame);
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        ring.llCopyNanos +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+
+        PLUGIN_FRAME_INFO info;
+        reader.GetInfo(iFrame, info);
+        host.Submit(mat, &info);
+    }
+    host.Stop();
+}
+
+static bool DoBench(const BENCH_OPTIONS& options, PluginCorpusReader& reader,
+                    const char *pszCorpus, const BENCH_PRESET& preset)
+{
+    const BENCH_ENTRIES& entries = s_entries[preset.nPlugin];
+    if (preset.nPlugin == BENCH_CLOCK)
+    {
+        DoSetSettings(entries.pszApp, s_clockBase);
+    }
+    else
+    {
+        const BENCH_SETTING threads[] =
+        {
+            { TEXT("Threads"), DWORD(options.nThreads), NULL },
+            { NULL, 0, NULL },
+        };
+        DoSetSettings(entries.pszApp, s_rotationBase);
+        DoSetSettings(entries.pszApp, threads);
+    }
+    DoSetSettings(entries.pszApp, preset.settings);
+
+    // the plugins may hold a buffer of the ring until they are unloaded
+    BENCH_RING ring;
+    DoFillRing(ring, reader.GetHeader());
+
+    PluginHost host(YAPBENCH_STREAM);
+    PLUGIN *pi = host.LoadEntries(entries.Load, entries.Unload, entries.Act);
+    if (!pi)
+    {
+        fprintf(stderr, "yapbench: %s not loaded\n", entries.pszName);
+        return false;
+    }
+    pi->bEnabled = TRUE;
+
+    ULONGLONG ullFrames = reader.GetCount();
+    if (options.nFrames > 0 && ULONGLONG(options.nFrames) < ullFrames)
+        ullFrames = options.nFrames;
+    ULONGLONG ullWarmUp = ULONGLONG(options.nWarmUp);
+    if (ullWarmUp > reader.GetCount())
+        ullWarmUp = reader.GetCount();
+
+    DoReplay(host, options, reader, ring, ullWarmUp);
+
+    PLUGIN_ALLOC_STATS statsBefore, statsAfter;
+    host.GetAllocator().GetStats(statsBefore);
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    DoReplay(host, options, reader, ring, ullFrames);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    host.GetAllocator().GetStats(statsAfter);
+
+    const double eNanos =
+        (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() -
+        ring.llCopyNanos;
+    PLUGIN_ACT_STATS act;
+    act.cbSize = sizeof(act);
+    act.uAction = PLUGIN_ACTION_PICWRITE;
+    if (!host.GetStats(pi).GetActStats(act))
+        act.ullP99Nanos = 0;
+
+    const PLUGIN_CORPUS_HEADER& header = reader.GetHeader();
+    char szType[16];
+    DoGetTypeName(header.nType, szType, sizeof(szType));
+    printf("%s \"%s\" %dx%d %s %s: %.1f fps, %.0f ns/frame, p99 %llu ns, "
+           "copy %.0f ns/frame, %.2f allocs/frame (%.2f new)\n",
+           entries.pszName, preset.pszName, header.nWidth, header.nHeight,
+           szType, pszCorpus, ullFrames * 1e9 / eNanos, eNanos / ullFrames,
+           act.ullP99Nanos, double(ring.llCopyNanos) / ullFrames,
+           double(statsAfter.ullAllocs - statsBefore.ullAllocs) / ullFrames,
+           double((statsAfter.ullAllocs - statsAfter.ullHits) -
+                  (statsBefore.ullAllocs - statsBefore.ullHits)) / ullFrames);
+    host.DumpStats(stdout, options.bJson);
+
+    host.UnloadAll();
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    BENCH_OPTIONS options;
+    if (!DoParseArgs(argc, argv, options))
+    {
+        DoUsage();
+        return 1;
+    }
+
+    int nRuns = 0;
+    for (size_t iCorpus = 0; iCorpus < options.corpora.size(); ++iCorpus)
+    {
+        const char *pszCorpus = options.corpora[iCorpus];
+        TCHAR szPath[MAX_PATH];
+#if defined(_WIN32) && defined(UNICODE)
+        MultiByteToWideChar(CP_ACP, 0, pszCorpus, -1, szPath, MAX_PATH);
+#else
+        StringCchCopy(szPath, MAX_PATH, pszCorpus);
+#endif
+
+        PluginCorpusReader reader;
+        if (!reader.Open(szPath) || reader.GetCount() == 0)
+        {
+            fprintf(stderr, "yapbench: cannot read %s\n", pszCorpus);
+            return 2;
+        }
+
+        for (size_t i = 0; i < ARRAYSIZE(s_presets); ++i)
+        {
+            const BENCH_PRESET& preset = s_presets[i];
+            if (options.pszPlugin &&
+                strcmp(options.pszPlugin, s_entries[preset.nPlugin].pszName) != 0)
+            {
+                continue;
+            }
+            if (options.pszPreset && strcmp(options.pszPreset, preset.pszName) != 0)
+                continue;
+
+            if (!DoBench(options, reader, pszCorpus, preset))
+                return 3;
+            ++nRuns;
+        }
+    }
+
+    if (nRuns == 0)
+    {
+        fprintf(stderr, "yapbench: no plugin or preset of the name\n");
+        return 1;
+    }
+    return 0;
+}
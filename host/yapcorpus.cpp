@@ -0,0 +1,284 @@
+// yapcorpus.cpp --- PluginFramework raw frame corpus recorder
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "PluginCorpus.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#ifdef _WIN32
+    #include <strsafe.h>
+#endif
+
+enum PATTERN
+{
+    PATTERN_NONE,
+    PATTERN_BARS,                   // the color bars, scrolling
+    PATTERN_RAMP,                   // a gradient, scrolling
+    PATTERN_NOISE                   // the same noise for the same frame
+};
+
+struct CORPUS_OPTIONS
+{
+    const char *pszOutput;
+    int nCamera;                    // -1 if none
+    const char *pszVideo;
+    PATTERN pattern;
+    int nFrames;
+    int nWidth;                     // zero for the size of the source
+    int nHeight;
+    bool bBGRA;
+    double eFPS;                    // zero for the rate of the source
+};
+
+static void DoUsage(void)
+{
+    printf("Usage: yapcorpus OUTPUT SOURCE [OPTIONS]\n"
+           "Records the frames of SOURCE to OUTPUT as a raw frame corpus.\n"
+           "\n"
+           "SOURCE:\n"
+           "  -camera INDEX           a camera of cv::VideoCapture\n"
+           "  -video FILE             a video file of cv::VideoCapture\n"
+           "  -pattern bars|ramp|noise  a synthetic pattern\n"
+           "\n"
+           "OPTIONS:\n"
+           "  -frames N               the number of the frames (default: 300)\n"
+           "  -size WxH               e.g. 1280x720, 1920x1080 or 3840x2160\n"
+           "                          (default: the source, or 1920x1080)\n"
+           "  -bgra                   records CV_8UC4 instead of CV_8UC3\n"
+           "  -fps FPS                the frame rate (default: the source, or 30)\n");
+}
+
+static bool DoParseArgs(int argc, char **argv, CORPUS_OPTIONS& options)
+{
+    options.pszOutput = NULL;
+    options.nCamera = -1;
+    options.pszVideo = NULL;
+    options.pattern = PATTERN_NONE;
+    options.nFrames = 300;
+    options.nWidth = options.nHeight = 0;
+    options.bBGRA = false;
+    options.eFPS = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (arg[0] != '-')
+        {
+            if (options.pszOutput)
+                return false;
+            options.pszOutput = arg;
+            continue;
+        }
+
+        if (strcmp(arg, "-bgra") == 0)
+        {
+            options.bBGRA = true;
+            continue;
+        }
+        if (!value)
+            return false;
+        ++i;
+
+        if (strcmp(arg, "-camera") == 0)
+        {
+            options.nCamera = atoi(value);
+        }
+        else if (strcmp(arg, "-video") == 0)
+        {
+            options.pszVideo = value;
+        }
+        else if (strcmp(arg, "-pattern") == 0)
+        {
+            if (strcmp(value, "bars") == 0)
+                options.pattern = PATTERN_BARS;
+            else if (strcmp(value, "ramp") == 0)
+                options.pattern = PATTERN_RAMP;
+            else if (strcmp(value, "noise") == 0)
+                options.pattern = PATTERN_NOISE;
+            else
+                return false;
+        }
+        else if (strcmp(arg, "-frames") == 0)
+        {
+            options.nFrames = atoi(value);
+        }
+        else if (strcmp(arg, "-size") == 0)
+        {
+            if (sscanf(value, "%dx%d", &options.nWidth, &options.nHeight) != 2 ||
+                options.nWidth <= 0 || options.nHeight <= 0)
+            {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "-fps") == 0)
+        {
+            options.eFPS = atof(value);
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    const int nSources = (options.nCamera >= 0) + (options.pszVideo != NULL) +
+                         (options.pattern != PATTERN_NONE);
+    return options.pszOutput && nSources == 1 && options.nFrames > 0 &&
+           options.eFPS >= 0;
+}
+
+static void DoDrawPattern(PATTERN pattern, int iFrame, cv::Mat& mat)
+{
+    switch (pattern)
+    {
+    case PATTERN_NONE:
+        break;
+    case PATTERN_BARS:
+        {
+            static const cv::Scalar s_colors[] =
+            {
+                cv::Scalar(255, 255, 255), cv::Scalar(0, 255, 255),
+                cv::Scalar(255, 255, 0), cv::Scalar(0, 255, 0),
+                cv::Scalar(255, 0, 255), cv::Scalar(0, 0, 255),
+                cv::Scalar(255, 0, 0), cv::Scalar(0, 0, 0),
+            };
+            const int nBars = int(sizeof(s_colors) / sizeof(s_colors[0]));
+            const int cxBar = (mat.cols + nBars - 1) / nBars;
+            const int xShift = (iFrame * 4) % mat.cols;
+            for (int i = 0; i < nBars; ++i)
+            {
+                for (int x = i * cxBar; x < (i + 1) * cxBar && x < mat.cols; ++x)
+                {
+                    int xDest = (x + xShift) % mat.cols;
+                    mat.col(xDest).setTo(s_colors[i]);
+                }
+            }
+        }
+        break;
+    case PATTERN_RAMP:
+        for (int y = 0; y < mat.rows; ++y)
+        {
+            uchar *pb = mat.ptr(y);
+            for (int x = 0; x < mat.cols; ++x)
+            {
+                for (int c = 0; c < mat.channels(); ++c)
+                {
+                    *pb++ = uchar((x + y * (c + 1) + iFrame * 2) & 0xFF);
+                }
+            }
+        }
+        break;
+    case PATTERN_NOISE:
+        {
+            cv::RNG rng(0x1234 + iFrame);
+            rng.fill(mat, cv::RNG::UNIFORM, 0, 256);
+        }
+        break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    CORPUS_OPTIONS options;
+    if (!DoParseArgs(argc, argv, options))
+    {
+        DoUsage();
+        return 1;
+    }
+
+    cv::VideoCapture capture;
+    if (options.nCamera >= 0)
+        capture.open(options.nCamera);
+    else if (options.pszVideo)
+        capture.open(options.pszVideo);
+    if (options.pattern == PATTERN_NONE && !capture.isOpened())
+    {
+        fprintf(stderr, "yapcorpus: cannot open the source\n");
+        return 2;
+    }
+
+    cv::Mat matSource;
+    int nWidth = options.nWidth, nHeight = options.nHeight;
+    double eFPS = options.eFPS;
+    if (options.pattern == PATTERN_NONE)
+    {
+        if (!capture.read(matSource) || matSource.empty())
+        {
+            fprintf(stderr, "yapcorpus: no frame\n");
+            return 2;
+        }
+        if (!nWidth)
+        {
+            nWidth = matSource.cols;
+            nHeight = matSource.rows;
+        }
+        if (eFPS <= 0)
+            eFPS = capture.get(cv::CAP_PROP_FPS);
+    }
+    if (!nWidth)
+    {
+        nWidth = 1920;
+        nHeight = 1080;
+    }
+    if (eFPS <= 0)
+        eFPS = 30;
+
+    TCHAR szOutput[MAX_PATH];
+#if defined(_WIN32) && defined(UNICODE)
+    MultiByteToWideChar(CP_ACP, 0, options.pszOutput, -1, szOutput, MAX_PATH);
+#else
+    StringCchCopy(szOutput, MAX_PATH, options.pszOutput);
+#endif
+
+    const int nType = options.bBGRA ? CV_8UC4 : CV_8UC3;
+    PluginCorpusWriter writer;
+    if (!writer.Open(szOutput, nWidth, nHeight, nType,
+                     LONGLONG(10000000 / eFPS)))
+    {
+        fprintf(stderr, "yapcorpus: cannot write %s\n", options.pszOutput);
+        return 3;
+    }
+
+    cv::Mat matFrame(nHeight, nWidth, nType), matSized;
+    for (int iFrame = 0; iFrame < options.nFrames; ++iFrame)
+    {
+        if (options.pattern != PATTERN_NONE)
+        {
+            DoDrawPattern(options.pattern, iFrame, matFrame);
+        }
+        else
+        {
+            if (iFrame > 0 && (!capture.read(matSource) || matSource.empty()))
+                break;
+
+            const cv::Mat *pmat = &matSource;
+            if (matSource.cols != nWidth || matSource.rows != nHeight)
+            {
+                cv::resize(matSource, matSized, cv::Size(nWidth, nHeight));
+                pmat = &matSized;
+            }
+            if (options.bBGRA)
+                cv::cvtColor(*pmat, matFrame, cv::COLOR_BGR2BGRA);
+            else
+                pmat->copyTo(matFrame);
+        }
+
+        if (!writer.Write(matFrame))
+        {
+            fprintf(stderr, "yapcorpus: cannot write %s\n", options.pszOutput);
+            return 3;
+        }
+    }
+
+    if (!writer.Close())
+    {
+        fprintf(stderr, "yapcorpus: cannot write %s\n", options.pszOutput);
+        return 3;
+    }
+
+    printf("%s: %llu frames of %dx%d %s at %.3f fps\n", options.pszOutput,
+           writer.GetCount(), nWidth, nHeight,
+           options.bBGRA ? "BGRA" : "BGR", eFPS);
+    return 0;
+}
@@ -0,0 +1,57 @@
+// Clock_avx2.cpp --- PluginFramework Plugin #1 kernels for AVX2
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "Clock_kernels.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+static inline __m256i DoDiv255AVX2(__m256i x)
+{
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+static inline __m256i DoComposite16AVX2(__m256i d, __m256i o, __m256i f)
+{
+    const __m256i k255 = _mm256_set1_epi16(255);
+    __m256i t = DoDiv255AVX2(_mm256_mullo_epi16(d, _mm256_sub_epi16(k255, o)));
+    t = _mm256_add_epi16(_mm256_mullo_epi16(t, _mm256_sub_epi16(k255, f)),
+                         _mm256_mullo_epi16(f, k255));
+    return DoDiv255AVX2(t);
+}
+
+static int DoCompositeRowAVX2(unsigned char *pb, const unsigned char *po,
+                              const unsigned char *pf, int cb)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 32 <= cb; i += 32)
+    {
+        __m256i o = _mm256_loadu_si256((const __m256i *)(po + i));
+        __m256i f = _mm256_loadu_si256((const __m256i *)(pf + i));
+        if (_mm256_testz_si256(_mm256_or_si256(o, f), _mm256_or_si256(o, f)))
+            continue;
+
+        // unpack and pack work per 128-bit lane, so the byte order is kept
+        __m256i d = _mm256_loadu_si256((const __m256i *)(pb + i));
+        __m256i lo = DoComposite16AVX2(_mm256_unpacklo_epi8(d, zero),
+                                       _mm256_unpacklo_epi8(o, zero),
+                                       _mm256_unpacklo_epi8(f, zero));
+        __m256i hi = DoComposite16AVX2(_mm256_unpackhi_epi8(d, zero),
+                                       _mm256_unpackhi_epi8(o, zero),
+                                       _mm256_unpackhi_epi8(f, zero));
+        _mm256_storeu_si256((__m256i *)(pb + i), _mm256_packus_epi16(lo, hi));
+    }
+    return i;
+}
+
+COMPOSITE_ROW Clock_GetCompositeRowAVX2(void)
+{
+    return DoCompositeRowAVX2;
+}
+#else
+COMPOSITE_ROW Clock_GetCompositeRowAVX2(void)
+{
+    return 0;
+}
+#endif
@@ -0,0 +1,58 @@
+// Clock_avx512.cpp --- PluginFramework Plugin #1 kernels for AVX-512
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "Clock_kernels.h"
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+#include <immintrin.h>
+
+static inline __m512i DoDiv255AVX512(__m512i x)
+{
+    x = _mm512_add_epi16(x, _mm512_set1_epi16(128));
+    return _mm512_srli_epi16(_mm512_add_epi16(x, _mm512_srli_epi16(x, 8)), 8);
+}
+
+static inline __m512i DoComposite16AVX512(__m512i d, __m512i o, __m512i f)
+{
+    const __m512i k255 = _mm512_set1_epi16(255);
+    __m512i t = DoDiv255AVX512(_mm512_mullo_epi16(d, _mm512_sub_epi16(k255, o)));
+    t = _mm512_add_epi16(_mm512_mullo_epi16(t, _mm512_sub_epi16(k255, f)),
+                         _mm512_mullo_epi16(f, k255));
+    return DoDiv255AVX512(t);
+}
+
+static int DoCompositeRowAVX512(unsigned char *pb, const unsigned char *po,
+                                const unsigned char *pf, int cb)
+{
+    const __m512i zero = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 64 <= cb; i += 64)
+    {
+        __m512i o = _mm512_loadu_si512(po + i);
+        __m512i f = _mm512_loadu_si512(pf + i);
+        __m512i of = _mm512_or_si512(o, f);
+        if (_mm512_test_epi8_mask(of, of) == 0)
+            continue;
+
+        // unpack and pack work per 128-bit lane, so the byte order is kept
+        __m512i d = _mm512_loadu_si512(pb + i);
+        __m512i lo = DoComposite16AVX512(_mm512_unpacklo_epi8(d, zero),
+                                         _mm512_unpacklo_epi8(o, zero),
+                                         _mm512_unpacklo_epi8(f, zero));
+        __m512i hi = DoComposite16AVX512(_mm512_unpackhi_epi8(d, zero),
+                                         _mm512_unpackhi_epi8(o, zero),
+                                         _mm512_unpackhi_epi8(f, zero));
+        _mm512_storeu_si512(pb + i, _mm512_packus_epi16(lo, hi));
+    }
+    return i;
+}
+
+COMPOSITE_ROW Clock_GetCompositeRowAVX512(void)
+{
+    return DoCompositeRowAVX512;
+}
+#else
+COMPOSITE_ROW Clock_GetCompositeRowAVX512(void)
+{
+    return 0;
+}
+#endif
@@ -0,0 +1,84 @@
+// Clock_caption.h --- PluginFramework Plugin #1 captions
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#ifndef CLOCK_CAPTION_H_
+#define CLOCK_CAPTION_H_
+
+// NOTE: These are the functions of Clock_yap.cpp that draw the caption, so
+//       that the benchmarks (tests/yapmicro.cpp) can call them one by one.
+//       Include Plugin.h first.
+
+#include <string>
+
+enum ALIGN
+{
+    ALIGN_LEFT,
+    ALIGN_CENTER,
+    ALIGN_RIGHT
+};
+enum VALIGN
+{
+    VALIGN_TOP,
+    VALIGN_MIDDLE,
+    VALIGN_BOTTOM
+};
+
+#define CAPTION_MAX_TOKENS 256
+#define CAPTION_MAX_TEXT 1024
+
+enum CAPTION_OP
+{
+    CAPTION_OP_LITERAL,
+    CAPTION_OP_YEAR,
+    CAPTION_OP_MONTH,
+    CAPTION_OP_DAY,
+    CAPTION_OP_HOUR,
+    CAPTION_OP_MINUTE,
+    CAPTION_OP_SECOND,
+    CAPTION_OP_MILLISECONDS
+};
+
+struct CAPTION_TOKEN
+{
+    WORD op;        // CAPTION_OP
+    WORD cch;       // length of the literal span
+    DWORD ich;      // offset of the literal span in szLiterals
+};
+
+struct CAPTION_PROGRAM
+{
+    INT nTokens;
+    CAPTION_TOKEN tokens[CAPTION_MAX_TOKENS];
+    char szLiterals[CAPTION_MAX_TOKENS * 2];
+};
+
+// The settings as the frame path sees them, with the caption compiled.
+// The dialog publishes a new snapshot whenever it changes one of them.
+struct CLOCK_SETTINGS
+{
+    double eScale;
+    INT nAlign;
+    INT nVAlign;
+    INT nMargin;
+    INT nThickness;
+    CAPTION_PROGRAM program;
+};
+
+// Formats the caption by parsing fmt.  The frame path renders the
+// compiled program instead.
+std::string DoGetCaption(const char *fmt, const SYSTEMTIME& st);
+
+void DoCompileCaption(CAPTION_PROGRAM& prog, const char *fmt);
+
+// Renders the caption into pszText and returns its length.
+// The text is truncated to cchText - 1 characters.
+size_t DoRenderCaption(const CAPTION_PROGRAM& prog, const SYSTEMTIME& st,
+                       char *pszText, size_t cchText);
+
+// Draws the text by cv::putText, as the fallback of the glyph atlas does
+// for each pass.
+extern "C"
+void DoDrawText(const CLOCK_SETTINGS& settings, cv::Mat& mat, const char *text,
+                double scale, int thickness, cv::Scalar& color);
+
+#endif  // ndef CLOCK_CAPTION_H_
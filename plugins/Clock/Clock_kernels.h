@@ -0,0 +1,23 @@
+// Clock_kernels.h --- PluginFramework Plugin #1 kernels of each CPU level
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#ifndef CLOCK_KERNELS_H_
+#define CLOCK_KERNELS_H_
+
+// NOTE: Clock_sse2.cpp, Clock_avx2.cpp and Clock_avx512.cpp are built with
+//       the flags of their PLUGIN_ISA (see PluginCpu.h), so they see plain
+//       bytes, not cv::Mat.
+
+// Composites the outline and the fill coverage over cb bytes of a row:
+//     dst = div255(div255(dst * (255 - o)) * (255 - f) + 255 * f)
+// Returns the bytes done, a multiple of the vector width; the caller
+// composites the rest.
+typedef int (*COMPOSITE_ROW)(unsigned char *pb, const unsigned char *po,
+                             const unsigned char *pf, int cb);
+
+// NULL if the file of the level was built without its flags.
+COMPOSITE_ROW Clock_GetCompositeRowSSE2(void);
+COMPOSITE_ROW Clock_GetCompositeRowAVX2(void);
+COMPOSITE_ROW Clock_GetCompositeRowAVX512(void);
+
+#endif  // ndef CLOCK_KERNELS_H_
@@ -0,0 +1,56 @@
+// Clock_sse2.cpp --- PluginFramework Plugin #1 kernels for SSE2
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "Clock_kernels.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+static inline __m128i DoDiv255SSE2(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static inline __m128i DoComposite16SSE2(__m128i d, __m128i o, __m128i f)
+{
+    const __m128i k255 = _mm_set1_epi16(255);
+    __m128i t = DoDiv255SSE2(_mm_mullo_epi16(d, _mm_sub_epi16(k255, o)));
+    t = _mm_add_epi16(_mm_mullo_epi16(t, _mm_sub_epi16(k255, f)),
+                      _mm_mullo_epi16(f, k255));
+    return DoDiv255SSE2(t);
+}
+
+static int DoCompositeRowSSE2(unsigned char *pb, const unsigned char *po,
+                              const unsigned char *pf, int cb)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= cb; i += 16)
+    {
+        __m128i o = _mm_loadu_si128((const __m128i *)(po + i));
+        __m128i f = _mm_loadu_si128((const __m128i *)(pf + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(o, f), zero)) == 0xFFFF)
+            continue;
+
+        __m128i d = _mm_loadu_si128((const __m128i *)(pb + i));
+        __m128i lo = DoComposite16SSE2(_mm_unpacklo_epi8(d, zero),
+                                       _mm_unpacklo_epi8(o, zero),
+                                       _mm_unpacklo_epi8(f, zero));
+        __m128i hi = DoComposite16SSE2(_mm_unpackhi_epi8(d, zero),
+                                       _mm_unpackhi_epi8(o, zero),
+                                       _mm_unpackhi_epi8(f, zero));
+        _mm_storeu_si128((__m128i *)(pb + i), _mm_packus_epi16(lo, hi));
+    }
+    return i;
+}
+
+COMPOSITE_ROW Clock_GetCompositeRowSSE2(void)
+{
+    return DoCompositeRowSSE2;
+}
+#else
+COMPOSITE_ROW Clock_GetCompositeRowSSE2(void)
+{
+    return 0;
+}
+#endif
@@ -1,40 +1,38 @@
 // Clock_yap.cpp --- PluginFramework Plugin #1
 // Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
 // This file is public domain software.
+#ifdef PLUGIN_STATIC
+    // the entry points when linked into the host
+    #define Plugin_Load Clock_Plugin_Load
+    #define Plugin_Unload Clock_Plugin_Unload
+    #define Plugin_Act Clock_Plugin_Act
+#endif
 #include "../Plugin.h"
-#include "../mregkey.hpp"
-#include <windowsx.h>
-#include <commctrl.h>
+#ifdef _WIN32
+    #include "../mregkey.hpp"
+#endif
+#include "../PluginTrace.h"
+#include "../PluginSnapshot.h"
+#include "../PluginStats.h"
+#include "../PluginSpans.h"
+#include "../PluginCpu.h"
+#ifndef PLUGIN_HEADLESS
+    #include <windowsx.h>
+    #include <commctrl.h>
+#endif
 #include <string>
+#include <new>
 #include <cassert>
-#include <strsafe.h>
+#ifdef _WIN32
+    #include <strsafe.h>
+#endif
 #include "resource.h"
-
-enum ALIGN
-{
-    ALIGN_LEFT,
-    ALIGN_CENTER,
-    ALIGN_RIGHT
-};
-enum VALIGN
-{
-    VALIGN_TOP,
-    VALIGN_MIDDLE,
-    VALIGN_BOTTOM
-};
+#include "Clock_kernels.h"
+#include "Clock_caption.h"
 
 static HINSTANCE s_hinstDLL;
-static PLUGIN *s_pi;
-static std::string s_strCaption;
-static double s_eScale;
-static INT s_nAlign;
-static INT s_nVAlign;
-static INT s_nMargin;
-static INT s_nThickness;
-static INT s_nWindowX;
-static INT s_nWindowY;
-static BOOL s_bDialogInit = FALSE;
 
+#ifndef PLUGIN_HEADLESS
 LPTSTR LoadStringDx(INT nID)
 {
     static UINT s_index = 0;
@@ -48,7 +46,9 @@ LPTSTR LoadStringDx(INT nID)
         assert(0);
     return pszBuff;
 }
+#endif  // ndef PLUGIN_HEADLESS
 
+#ifdef _WIN32
 LPSTR ansi_from_wide(LPCWSTR pszWide)
 {
     static char s_buf[256];
@@ -62,6 +62,18 @@ LPWSTR wide_from_ansi(LPCSTR pszAnsi)
     MultiByteToWideChar(CP_ACP, 0, pszAnsi, -1, s_buf, ARRAYSIZE(s_buf));
     return s_buf;
 }
+#else
+// TCHAR is char without Windows.
+inline LPCSTR ansi_from_wide(LPCSTR pszAnsi)
+{
+    return pszAnsi;
+}
+
+inline LPCSTR wide_from_ansi(LPCSTR pszAnsi)
+{
+    return pszAnsi;
+}
+#endif  // ndef _WIN32
 
 std::string DoGetCaption(const char *fmt, const SYSTEMTIME& st)
 {
@@ -120,23 +132,739 @@ std::string DoGetCaption(const char *fmt, const SYSTEMTIME& st)
     return ret;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// Compiled caption
+//
+// The caption format is compiled into a program of literal spans and
+// fixed-width numeric fields whenever it changes, so that rendering a frame
+// does neither parsing, heap allocation nor printf.
+
+static const char s_szDigits2[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static void DoAddLiteral(CAPTION_PROGRAM& prog, DWORD& ich, const char *pch,
+                         DWORD cch)
+{
+    if (ich + cch > sizeof(prog.szLiterals))
+        return;
+
+    CAPTION_TOKEN *last = prog.nTokens ? &prog.tokens[prog.nTokens - 1] : NULL;
+    if (last && last->op == CAPTION_OP_LITERAL && last->ich + last->cch == ich)
+    {
+        last->cch += WORD(cch);
+    }
+    else
+    {
+        if (prog.nTokens >= CAPTION_MAX_TOKENS)
+            return;
+        CAPTION_TOKEN& token = prog.tokens[prog.nTokens++];
+        token.op = CAPTION_OP_LITERAL;
+        token.cch = WORD(cch);
+        token.ich = ich;
+    }
+
+    memcpy(&prog.szLiterals[ich], pch, cch);
+    ich += cch;
+}
+
+static void DoAddField(CAPTION_PROGRAM& prog, CAPTION_OP op)
+{
+    if (prog.nTokens >= CAPTION_MAX_TOKENS)
+        return;
+
+    CAPTION_TOKEN& token = prog.tokens[prog.nTokens++];
+    token.op = WORD(op);
+    token.cch = 0;
+    token.ich = 0;
+}
+
+void DoCompileCaption(CAPTION_PROGRAM& prog, const char *fmt)
+{
+    DWORD ich = 0;
+    prog.nTokens = 0;
+    for (const char *pch = fmt; *pch; ++pch)
+    {
+        if (*pch != '&')
+        {
+            DoAddLiteral(prog, ich, pch, 1);
+            continue;
+        }
+
+        ++pch;
+        switch (*pch)
+        {
+        case '&':
+            DoAddLiteral(prog, ich, pch, 1);
+            break;
+        case 'y':
+            DoAddField(prog, CAPTION_OP_YEAR);
+            break;
+        case 'M':
+            DoAddField(prog, CAPTION_OP_MONTH);
+            break;
+        case 'd':
+            DoAddField(prog, CAPTION_OP_DAY);
+            break;
+        case 'h':
+            DoAddField(prog, CAPTION_OP_HOUR);
+            break;
+        case 'm':
+            DoAddField(prog, CAPTION_OP_MINUTE);
+            break;
+        case 's':
+            DoAddField(prog, CAPTION_OP_SECOND);
+            break;
+        case 'f':
+            DoAddField(prog, CAPTION_OP_MILLISECONDS);
+            break;
+        case 0:
+            DoAddLiteral(prog, ich, "&", 1);
+            return;
+        default:
+            DoAddLiteral(prog, ich, pch - 1, 2);
+            break;
+        }
+    }
+}
+
+static inline char *DoPutDigits2(char *pch, UINT value)
+{
+    const char *digits = &s_szDigits2[(value % 100) * 2];
+    pch[0] = digits[0];
+    pch[1] = digits[1];
+    return pch + 2;
+}
+
+size_t DoRenderCaption(const CAPTION_PROGRAM& prog, const SYSTEMTIME& st,
+                       char *pszText, size_t cchText)
+{
+    if (cchText == 0)
+        return 0;
+
+    char *pch = pszText;
+    char *pchEnd = pszText + cchText - 1;
+    for (INT i = 0; i < prog.nTokens; ++i)
+    {
+        const CAPTION_TOKEN& token = prog.tokens[i];
+        if (token.op == CAPTION_OP_LITERAL)
+        {
+            if (size_t(pchEnd - pch) < token.cch)
+                break;
+            memcpy(pch, &prog.szLiterals[token.ich], token.cch);
+            pch += token.cch;
+            continue;
+        }
+
+        // the widest field is a five-digit year
+        if (pchEnd - pch < 5)
+            break;
+
+        switch (token.op)
+        {
+        case CAPTION_OP_YEAR:
+            if (st.wYear >= 10000)
+                *pch++ = char('0' + st.wYear / 10000);
+            pch = DoPutDigits2(pch, st.wYear / 100);
+            pch = DoPutDigits2(pch, st.wYear);
+            break;
+        case CAPTION_OP_MONTH:
+            pch = DoPutDigits2(pch, st.wMonth);
+            break;
+        case CAPTION_OP_DAY:
+            pch = DoPutDigits2(pch, st.wDay);
+            break;
+        case CAPTION_OP_HOUR:
+            pch = DoPutDigits2(pch, st.wHour);
+            break;
+        case CAPTION_OP_MINUTE:
+            pch = DoPutDigits2(pch, st.wMinute);
+            break;
+        case CAPTION_OP_SECOND:
+            pch = DoPutDigits2(pch, st.wSecond);
+            break;
+        case CAPTION_OP_MILLISECONDS:
+            *pch++ = char('0' + st.wMilliseconds / 100 % 10);
+            pch = DoPutDigits2(pch, st.wMilliseconds);
+            break;
+        }
+    }
+
+    *pch = 0;
+    return pch - pszText;
+}
+
 extern "C" {
 
+static cv::Point DoGetTextOrigin(const CLOCK_SETTINGS& settings,
+                                 const cv::Size& screen_size,
+                                 const cv::Size& text_size, int baseline,
+                                 int thickness)
+{
+    cv::Point pt;
+
+    switch (settings.nAlign)
+    {
+    case ALIGN_LEFT:
+        pt.x = 0;
+        pt.x += settings.nMargin * screen_size.height / 100;
+        break;
+    case ALIGN_CENTER:
+        pt.x = (screen_size.width - text_size.width + thickness) / 2;
+        break;
+    case ALIGN_RIGHT:
+        pt.x = screen_size.width - text_size.width;
+        pt.x -= settings.nMargin * screen_size.height / 100;
+        pt.x += thickness;
+        break;
+    default:
+        assert(0);
+    }
+
+    switch (settings.nVAlign)
+    {
+    case VALIGN_TOP:
+        pt.y = 0;
+        pt.y += settings.nMargin * screen_size.height / 100 - thickness / 2;
+        break;
+    case VALIGN_MIDDLE:
+        pt.y = (screen_size.height - text_size.height) / 2;
+        break;
+    case VALIGN_BOTTOM:
+        pt.y = screen_size.height - text_size.height + thickness / 2;
+        pt.y -= settings.nMargin * screen_size.height / 100;
+        pt.y -= baseline;
+        break;
+    default:
+        assert(0);
+    }
+    pt.y += text_size.height - 1;
+
+    return pt;
+}
+
+void DoDrawText(const CLOCK_SETTINGS& settings, cv::Mat& mat, const char *text,
+                double scale, int thickness, cv::Scalar& color)
+{
+    int font = cv::FONT_HERSHEY_SIMPLEX;
+    cv::Size screen_size(mat.cols, mat.rows);
+
+    scale *= screen_size.height * 0.01;
+
+    int baseline;
+    cv::Size text_size = cv::getTextSize(text, font, scale, thickness, &baseline);
+
+    cv::Point pt = DoGetTextOrigin(settings, screen_size, text_size, baseline, thickness);
+
+    cv::putText(mat, text, pt, font, scale,
+                color, thickness, cv::LINE_AA, false);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Glyph atlas
+//
+// The glyphs that the caption can show, its literals and the digits of its
+// fields, are rasterized once with the same cv::putText calls as DoDrawText,
+// one glyph per cell, into two coverage masks: one for the black outline
+// pass and one for the white fill pass.  A caption is then drawn by placing
+// the cells at their Hershey advances and blending.
+
+#define GLYPH_FIRST 0x20
+#define GLYPH_LAST  0x7E
+#define GLYPH_COUNT (GLYPH_LAST - GLYPH_FIRST + 1)
+
+enum PASS
+{
+    PASS_OUTLINE,
+    PASS_FILL,
+    PASS_COUNT
+};
+
+struct GLYPH_ATLAS
+{
+    double eScale;                  // eScale of the atlas
+    INT nThickness;                 // nThickness of the atlas
+    INT nHeight;                    // frame height of the atlas
+    double scale;                   // font scale given to cv::putText
+    INT nPad;                       // blank margin around a glyph
+    INT cxCell;                     // width of a glyph cell
+    INT cyCell;                     // height of a glyph cell
+    INT yBaseline;                  // baseline row in a glyph cell
+    INT nBaseline;                  // baseline of cv::getTextSize
+    INT thickness[PASS_COUNT];      // thickness of each pass
+    INT cyText[PASS_COUNT];         // text height of each pass
+    INT nUnits[GLYPH_COUNT];        // Hershey advance of each glyph
+    INT iCell[GLYPH_COUNT];         // the cell of each glyph, or -1
+    char szGlyphs[GLYPH_COUNT + 1]; // the glyphs of the cells, in order
+    cv::Mat coverage[PASS_COUNT];   // CV_8UC1 glyph cells of each pass
+};
+
+// The last rendered caption, kept as coverage masks of its text box
+struct TEXT_PATCH
+{
+    bool bValid;
+    char szText[CAPTION_MAX_TEXT];
+    cv::Size size;                  // frame size
+    INT cn;                         // frame channels
+    INT nAlign;
+    INT nVAlign;
+    INT nMargin;
+    double eScale;
+    INT nThickness;
+    cv::Rect rc;                    // text box in the frame
+    cv::Mat mask[PASS_COUNT];       // coverage of the text box per channel
+};
+
+#ifdef PLUGIN_PHASES
+// The phases of drawing a caption, timed by the counters of the host
+enum PHASE
+{
+    PHASE_FORMAT,                   // DoRenderCaption
+    PHASE_LAYOUT,                   // DoBuildPatch, when the text changes
+    PHASE_BLEND,                    // DoCompositeText, on every frame
+    PHASE_FALLBACK,                 // DoDrawText, if the atlas can't draw it
+    PHASE_COUNT
+};
+
+static const char *const s_apszPhaseCounters[PHASE_COUNT] =
+{
+    "ns_format",
+    "ns_layout",
+    "ns_blend",
+    "ns_fallback",
+};
+#endif
+
+// The glyph atlas and the text patch of an instance
+struct TEXT_CACHE
+{
+    GLYPH_ATLAS atlas;
+    TEXT_PATCH patch;
+    cv::Mat matGather;              // scratch of DoBuildPatch
+    UINT nPatchHits;
+    UINT nPatchMisses;
+    PluginCounter *pllHits;     // the counters of the host, or NULL
+    PluginCounter *pllMisses;
+#ifdef PLUGIN_PHASES
+    PluginCounter *apllNanos[PHASE_COUNT];  // the time of each phase
+#endif
+    PLUGIN *piSpans;                // of PluginSpans_GetTarget, per action
+    COMPOSITE_ROW fnCompositeRow;   // of DoSelectCompositeRow, or NULL
+};
+
+// The glyphs that the program can show, in the order of GLYPH_FIRST.
+static void DoGetCaptionGlyphs(const CAPTION_PROGRAM& prog,
+                               char szGlyphs[GLYPH_COUNT + 1])
+{
+    bool abUsed[GLYPH_COUNT] = { false };
+    for (INT i = 0; i < prog.nTokens; ++i)
+    {
+        const CAPTION_TOKEN& token = prog.tokens[i];
+        if (token.op != CAPTION_OP_LITERAL)
+        {
+            for (UINT ch = '0'; ch <= '9'; ++ch)
+            {
+                abUsed[ch - GLYPH_FIRST] = true;
+            }
+            continue;
+        }
+
+        for (UINT ich = token.ich; ich < token.ich + token.cch; ++ich)
+        {
+            UINT ch = (uchar)prog.szLiterals[ich];
+            if (GLYPH_FIRST <= ch && ch <= GLYPH_LAST)
+                abUsed[ch - GLYPH_FIRST] = true;
+        }
+    }
+
+    char *pch = szGlyphs;
+    for (int i = 0; i < GLYPH_COUNT; ++i)
+    {
+        if (abUsed[i])
+            *pch++ = char(GLYPH_FIRST + i);
+    }
+    *pch = 0;
+}
+
+static void DoBuildAtlas(GLYPH_ATLAS& atlas, double eScale, INT nThickness,
+                         INT nHeight, const char *pszGlyphs)
+{
+    const int font = cv::FONT_HERSHEY_SIMPLEX;
+
+    atlas.eScale = eScale;
+    atlas.nThickness = nThickness;
+    atlas.nHeight = nHeight;
+    atlas.scale = eScale * nHeight * 0.01;
+    atlas.thickness[PASS_OUTLINE] = nThickness * 3;
+    atlas.thickness[PASS_FILL] = nThickness;
+    StringCbCopyA(atlas.szGlyphs, sizeof(atlas.szGlyphs), pszGlyphs);
+
+    // at scale 1.0 and zero thickness, the width is the exact Hershey advance
+    char sz[2] = { 0, 0 };
+    int baseline, nMaxUnits = 0, nCells = 0;
+    for (int i = 0; i < GLYPH_COUNT; ++i)
+    {
+        sz[0] = char(GLYPH_FIRST + i);
+        atlas.nUnits[i] = cv::getTextSize(sz, font, 1.0, 0, &baseline).width;
+        atlas.iCell[i] = strchr(pszGlyphs, sz[0]) ? nCells++ : -1;
+        if (atlas.iCell[i] >= 0 && nMaxUnits < atlas.nUnits[i])
+            nMaxUnits = atlas.nUnits[i];
+    }
+
+    for (int pass = 0; pass < PASS_COUNT; ++pass)
+    {
+        cv::Size text_size = cv::getTextSize("0", font, atlas.scale,
+                                             atlas.thickness[pass], &baseline);
+        atlas.cyText[pass] = text_size.height;
+    }
+    atlas.nBaseline = baseline;
+
+    atlas.nPad = atlas.thickness[PASS_OUTLINE] + 2;
+    atlas.cxCell = cvCeil(nMaxUnits * atlas.scale) + 2 * atlas.nPad;
+    atlas.yBaseline = atlas.nPad + atlas.cyText[PASS_OUTLINE];
+    atlas.cyCell = atlas.yBaseline + atlas.nBaseline + atlas.nPad;
+
+    cv::Point org(atlas.nPad, atlas.yBaseline);
+    for (int pass = 0; pass < PASS_COUNT; ++pass)
+    {
+        cv::Mat& coverage = atlas.coverage[pass];
+        coverage.create(atlas.cyCell, atlas.cxCell * (nCells ? nCells : 1), CV_8UC1);
+        coverage.setTo(0);
+
+        for (int i = 0; i < nCells; ++i)
+        {
+            sz[0] = pszGlyphs[i];
+            cv::Mat cell = coverage(cv::Rect(i * atlas.cxCell, 0,
+                                             atlas.cxCell, atlas.cyCell));
+            cv::putText(cell, sz, org, font, atlas.scale, cv::Scalar(255),
+                        atlas.thickness[pass], cv::LINE_AA, false);
+        }
+    }
+}
+
+static inline int DoDiv255(int value)
+{
+    value += 128;
+    return (value + (value >> 8)) >> 8;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Text compositing
+//
+// The black outline and the white fill are composited in a single pass:
+//     dst = div255(div255(dst * (255 - o)) * (255 - f) + 255 * f)
+// This is bit-exact with blending the outline coverage o and then the fill
+// coverage f.  The coverage masks have the layout of the frame row, so the
+// kernels work on plain bytes whatever the channel count is.
+
+static void DoCompositeRowC(uchar *pb, const uchar *po, const uchar *pf, int cb)
+{
+    for (int i = 0; i < cb; ++i)
+    {
+        const int o = po[i], f = pf[i];
+        const int t = DoDiv255(pb[i] * (255 - o));
+        pb[i] = uchar(DoDiv255(t * (255 - f) + 255 * f));
+    }
+}
+
+// The kernel of the best level up to isa.  isa becomes the level of the
+// kernel, or PLUGIN_ISA_GENERIC for DoCompositeRowC alone.
+static COMPOSITE_ROW DoSelectCompositeRow(PLUGIN_ISA& isa)
+{
+    COMPOSITE_ROW fnRow = NULL;
+    for (; isa > PLUGIN_ISA_GENERIC; isa = PLUGIN_ISA(isa - 1))
+    {
+        switch (isa)
+        {
+        case PLUGIN_ISA_AVX512:
+            fnRow = Clock_GetCompositeRowAVX512();
+            break;
+        case PLUGIN_ISA_AVX2:
+            fnRow = Clock_GetCompositeRowAVX2();
+            break;
+        case PLUGIN_ISA_SSE2:
+            fnRow = Clock_GetCompositeRowSSE2();
+            break;
+        default:
+            break;
+        }
+        if (fnRow)
+            break;
+    }
+    return fnRow;
+}
+
+// fnRow is the kernel of DoSelectCompositeRow, or NULL.
+static void DoCompositeText(COMPOSITE_ROW fnRow, cv::Mat& roi,
+                            const cv::Mat& outline, const cv::Mat& fill)
+{
+    const int cb = roi.cols * roi.channels();
+    for (int y = 0; y < roi.rows; ++y)
+    {
+        uchar *pb = roi.ptr<uchar>(y);
+        const uchar *po = outline.ptr<uchar>(y);
+        const uchar *pf = fill.ptr<uchar>(y);
+        const int i = fnRow ? fnRow(pb, po, pf, cb) : 0;
+        DoCompositeRowC(pb + i, po + i, pf + i, cb - i);
+    }
+}
+
+// Replicates the coverage to the color channels of a cn-channel frame.
+// The alpha channel of a BGRA frame is left untouched.
+static void DoExpandMask(const cv::Mat& gray, cv::Mat& mask, int cn)
+{
+    mask.create(gray.rows, gray.cols, CV_8UC(cn));
+    for (int y = 0; y < gray.rows; ++y)
+    {
+        const uchar *ps = gray.ptr<uchar>(y);
+        uchar *pd = mask.ptr<uchar>(y);
+        for (int x = 0; x < gray.cols; ++x, pd += cn)
+        {
+            pd[0] = pd[1] = pd[2] = ps[x];
+            if (cn == 4)
+                pd[3] = 0;
+        }
+    }
+}
+
+static bool DoIsPatchValid(const TEXT_PATCH& patch,
+                           const CLOCK_SETTINGS& settings,
+                           const cv::Mat& mat, const char *text)
+{
+    return patch.bValid &&
+           patch.size == cv::Size(mat.cols, mat.rows) &&
+           patch.cn == mat.channels() &&
+           patch.nAlign == settings.nAlign &&
+           patch.nVAlign == settings.nVAlign &&
+           patch.nMargin == settings.nMargin &&
+           patch.eScale == settings.eScale &&
+           patch.nThickness == settings.nThickness &&
+           strcmp(patch.szText, text) == 0;
+}
+
+// Lays out the caption and gathers its glyph cells from the atlas.
+// Returns false if the text is not supported by the atlas.
+static bool DoBuildPatch(TEXT_CACHE& cache, const CLOCK_SETTINGS& settings,
+                         const cv::Mat& mat, const char *text)
+{
+    TEXT_PATCH& patch = cache.patch;
+    patch.bValid = false;
+
+    char szGlyphs[GLYPH_COUNT + 1];
+    DoGetCaptionGlyphs(settings.program, szGlyphs);
+
+    GLYPH_ATLAS& atlas = cache.atlas;
+    if (atlas.coverage[PASS_FILL].empty() || atlas.eScale != settings.eScale ||
+        atlas.nThickness != settings.nThickness || atlas.nHeight != mat.rows ||
+        strcmp(atlas.szGlyphs, szGlyphs) != 0)
+    {
+        PluginSpan span(cache.piSpans, "rasterize", "Clock.yap");
+        DoBuildAtlas(atlas, settings.eScale, settings.nThickness, mat.rows,
+                     szGlyphs);
+    }
+
+    int nUnits = 0, cch = 0;
+    for (const char *pch = text; *pch; ++pch, ++cch)
+    {
+        UINT ch = (uchar)*pch;
+        if (ch < GLYPH_FIRST || GLYPH_LAST < ch || atlas.iCell[ch - GLYPH_FIRST] < 0)
+            return false;
+        nUnits += atlas.nUnits[ch - GLYPH_FIRST];
+    }
+    if (cch >= CAPTION_MAX_TEXT)
+        return false;
+
+    StringCbCopyA(patch.szText, sizeof(patch.szText), text);
+    patch.size = cv::Size(mat.cols, mat.rows);
+    patch.cn = mat.channels();
+    patch.nAlign = settings.nAlign;
+    patch.nVAlign = settings.nVAlign;
+    patch.nMargin = settings.nMargin;
+    patch.eScale = settings.eScale;
+    patch.nThickness = settings.nThickness;
+    patch.rc = cv::Rect();
+    patch.bValid = true;
+    if (cch == 0)
+        return true;
+
+    // lay out each pass as DoDrawText does
+    cv::Point pt[PASS_COUNT];
+    cv::Rect rcBox;
+    for (int pass = 0; pass < PASS_COUNT; ++pass)
+    {
+        cv::Size text_size(cvRound(nUnits * atlas.scale + atlas.thickness[pass]),
+                           atlas.cyText[pass]);
+        pt[pass] = DoGetTextOrigin(settings, patch.size, text_size,
+                                   atlas.nBaseline, atlas.thickness[pass]);
+
+        cv::Rect rc(pt[pass].x - atlas.nPad, pt[pass].y - atlas.yBaseline,
+                    cvRound(nUnits * atlas.scale) + atlas.cxCell, atlas.cyCell);
+        rcBox = (pass == 0) ? rc : (rcBox | rc);
+    }
+    rcBox &= cv::Rect(0, 0, mat.cols, mat.rows);
+    if (rcBox.area() == 0)
+        return true;
+    patch.rc = rcBox;
+
+    // gather the glyph cells into the coverage masks of the text box
+    for (int pass = 0; pass < PASS_COUNT; ++pass)
+    {
+        cv::Mat& mask = cache.matGather;
+        mask.create(rcBox.height, rcBox.width, CV_8UC1);
+        mask.setTo(0);
+
+        int nPrefix = 0;
+        for (const char *pch = text; *pch; ++pch)
+        {
+            INT iGlyph = (uchar)*pch - GLYPH_FIRST;
+            cv::Rect rcCell(pt[pass].x + cvRound(nPrefix * atlas.scale) - atlas.nPad,
+                            pt[pass].y - atlas.yBaseline,
+                            atlas.cxCell, atlas.cyCell);
+            nPrefix += atlas.nUnits[iGlyph];
+
+            cv::Rect rcDest = rcCell & rcBox;
+            if (rcDest.area() == 0)
+                continue;
+
+            cv::Rect rcSrc(rcDest.x - rcCell.x + atlas.iCell[iGlyph] * atlas.cxCell,
+                           rcDest.y - rcCell.y, rcDest.width, rcDest.height);
+            cv::Mat dest = mask(rcDest - rcBox.tl());
+            cv::max(dest, atlas.coverage[pass](rcSrc), dest);
+        }
+
+        DoExpandMask(mask, patch.mask[pass], patch.cn);
+    }
+
+    return true;
+}
+
+// Draws the caption from the glyph atlas and stores its text box to rc.
+// Returns false if the frame or the text is not supported by the atlas.
+static bool DoDrawTextAtlas(TEXT_CACHE& cache, const CLOCK_SETTINGS& settings,
+                            cv::Mat& mat, const char *text, cv::Rect& rc)
+{
+    if (mat.depth() != CV_8U || (mat.channels() != 3 && mat.channels() != 4))
+        return false;
+
+    TEXT_PATCH& patch = cache.patch;
+    if (DoIsPatchValid(patch, settings, mat, text))
+    {
+        ++cache.nPatchHits;
+        PluginStats_Add(cache.pllHits, 1);
+    }
+    else
+    {
+        ++cache.nPatchMisses;
+        PluginStats_Add(cache.pllMisses, 1);
+
+        PluginSpan span(cache.piSpans, "layout", "Clock.yap");
+        PLUGIN_PHASE_TIMER(cache.apllNanos[PHASE_LAYOUT]);
+        if (!DoBuildPatch(cache, settings, mat, text))
+            return false;
+    }
+
+    rc = patch.rc;
+    if (patch.rc.area() == 0)
+        return true;
+
+    PluginSpan span(cache.piSpans, "blend", "Clock.yap");
+    PLUGIN_PHASE_TIMER(cache.apllNanos[PHASE_BLEND]);
+    cv::Mat roi = mat(patch.rc);
+    DoCompositeText(cache.fnCompositeRow, roi, patch.mask[PASS_OUTLINE],
+                    patch.mask[PASS_FILL]);
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Instances
+//
+// The host loads the plugin once per stream, each time with its own PLUGIN.
+// All the state of a stream lives in the instance at p_user_data, so that
+// the streams can call Plugin_Act in parallel.
+
+struct CLOCK_INSTANCE
+{
+    PLUGIN *pi;
+    DWORD dwInstance;               // lParam of Plugin_Load
+
+    // owned by the dialog
+    std::string strCaption;
+    double eScale;
+    INT nAlign;
+    INT nVAlign;
+    INT nMargin;
+    INT nThickness;
+    INT nIsa;                       // a PLUGIN_ISA, applied at Plugin_Load
+    INT nWindowX;
+    INT nWindowY;
+    BOOL bDialogInit;
+
+    // read by the frame path
+    PluginSnapshot<CLOCK_SETTINGS> settings;
+
+    // owned by the frame path
+    TEXT_CACHE cache;
+    PLUGIN_ISA isa;                 // the level of cache.fnCompositeRow
+};
+
+static CLOCK_INSTANCE *DoGetInstance(PLUGIN *pi)
+{
+    return (CLOCK_INSTANCE *)pi->p_user_data;
+}
+
+#ifndef PLUGIN_HEADLESS
+static CLOCK_INSTANCE *DoGetDialogInstance(HWND hwnd)
+{
+    return (CLOCK_INSTANCE *)GetWindowLongPtr(hwnd, DWLP_USER);
+}
+#endif
+
+// The first instance keeps the settings in the key of the plugin, and the
+// others in its subkeys.
+static void DoGetAppKeyName(const CLOCK_INSTANCE *pInst, LPTSTR pszKey,
+                            size_t cchKey)
+{
+    if (pInst->dwInstance == 0)
+        StringCchCopy(pszKey, cchKey, TEXT("Clock_yap"));
+    else
+        StringCchPrintf(pszKey, cchKey, TEXT("Clock_yap\\Instance%lu"),
+                        (unsigned long)pInst->dwInstance);
+}
+
+static void DoPublishSettings(CLOCK_INSTANCE *pInst)
+{
+    CLOCK_SETTINGS settings;
+    settings.eScale = pInst->eScale;
+    settings.nAlign = pInst->nAlign;
+    settings.nVAlign = pInst->nVAlign;
+    settings.nMargin = pInst->nMargin;
+    settings.nThickness = pInst->nThickness;
+    DoCompileCaption(settings.program, pInst->strCaption.c_str());
+    pInst->settings.Publish(settings);
+}
+
 static LRESULT DoResetSettings(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
 {
-    s_nMargin = 3;
-    s_nAlign = ALIGN_LEFT;
-    s_nVAlign = VALIGN_TOP;
-    s_eScale = 0.2;
-    s_strCaption = "&h:&m:&s.&f";
-    s_nWindowX = CW_USEDEFAULT;
-    s_nWindowY = CW_USEDEFAULT;
-    s_nThickness = 2;
+    CLOCK_INSTANCE *pInst = DoGetInstance(pi);
+    pInst->nMargin = 3;
+    pInst->nAlign = ALIGN_LEFT;
+    pInst->nVAlign = VALIGN_TOP;
+    pInst->eScale = 0.2;
+    pInst->strCaption = "&h:&m:&s.&f";
+    pInst->nWindowX = CW_USEDEFAULT;
+    pInst->nWindowY = CW_USEDEFAULT;
+    pInst->nThickness = 2;
+    pInst->nIsa = PLUGIN_ISA_AUTO;
+    DoPublishSettings(pInst);
     return 0;
 }
 
 static LRESULT DoLoadSettings(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
 {
+    CLOCK_INSTANCE *pInst = DoGetInstance(pi);
     DoResetSettings(pi, wParam, lParam);
 
     MRegKey hkeyCompany(HKEY_CURRENT_USER,
@@ -145,57 +873,65 @@ static LRESULT DoLoadSettings(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
     if (!hkeyCompany)
         return FALSE;
 
-    MRegKey hkeyApp(hkeyCompany, TEXT("Clock_yap"), FALSE);
+    TCHAR szKey[64];
+    DoGetAppKeyName(pInst, szKey, ARRAYSIZE(szKey));
+    MRegKey hkeyApp(hkeyCompany, szKey, FALSE);
     if (!hkeyApp)
         return FALSE;
 
-    hkeyApp.QueryDword(TEXT("Margin"), (DWORD&)s_nMargin);
-    hkeyApp.QueryDword(TEXT("Align"), (DWORD&)s_nAlign);
-    hkeyApp.QueryDword(TEXT("VAlign"), (DWORD&)s_nVAlign);
-    hkeyApp.QueryDword(TEXT("WindowX"), (DWORD&)s_nWindowX);
-    hkeyApp.QueryDword(TEXT("WindowY"), (DWORD&)s_nWindowY);
-    hkeyApp.QueryDword(TEXT("Thickness"), (DWORD&)s_nThickness);
+    hkeyApp.QueryDword(TEXT("Margin"), (DWORD&)pInst->nMargin);
+    hkeyApp.QueryDword(TEXT("Align"), (DWORD&)pInst->nAlign);
+    hkeyApp.QueryDword(TEXT("VAlign"), (DWORD&)pInst->nVAlign);
+    hkeyApp.QueryDword(TEXT("WindowX"), (DWORD&)pInst->nWindowX);
+    hkeyApp.QueryDword(TEXT("WindowY"), (DWORD&)pInst->nWindowY);
+    hkeyApp.QueryDword(TEXT("Thickness"), (DWORD&)pInst->nThickness);
+    hkeyApp.QueryDword(TEXT("Isa"), (DWORD&)pInst->nIsa);
 
     DWORD dwValue;
     TCHAR szText[64];
 
     if (!hkeyApp.QueryDword(TEXT("Scale"), (DWORD&)dwValue))
     {
-        s_eScale = dwValue / 100.0;
+        pInst->eScale = dwValue / 100.0;
     }
 
     if (!hkeyApp.QuerySz(TEXT("Caption"), szText, ARRAYSIZE(szText)))
     {
-        s_strCaption = ansi_from_wide(szText);
+        pInst->strCaption = ansi_from_wide(szText);
     }
 
+    DoPublishSettings(pInst);
     return TRUE;
 }
 
 static LRESULT DoSaveSettings(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
 {
+    CLOCK_INSTANCE *pInst = DoGetInstance(pi);
     MRegKey hkeyCompany(HKEY_CURRENT_USER,
                         TEXT("Software\\Katayama Hirofumi MZ"),
                         TRUE);
     if (!hkeyCompany)
         return FALSE;
 
-    MRegKey hkeyApp(hkeyCompany, TEXT("Clock_yap"), TRUE);
+    TCHAR szKey[64];
+    DoGetAppKeyName(pInst, szKey, ARRAYSIZE(szKey));
+    MRegKey hkeyApp(hkeyCompany, szKey, TRUE);
     if (!hkeyApp)
         return FALSE;
 
-    hkeyApp.SetDword(TEXT("Margin"), s_nMargin);
-    hkeyApp.SetDword(TEXT("Align"), s_nAlign);
-    hkeyApp.SetDword(TEXT("VAlign"), s_nVAlign);
-    hkeyApp.SetDword(TEXT("WindowX"), s_nWindowX);
-    hkeyApp.SetDword(TEXT("WindowY"), s_nWindowY);
-    hkeyApp.SetDword(TEXT("Thickness"), s_nThickness);
+    hkeyApp.SetDword(TEXT("Margin"), pInst->nMargin);
+    hkeyApp.SetDword(TEXT("Align"), pInst->nAlign);
+    hkeyApp.SetDword(TEXT("VAlign"), pInst->nVAlign);
+    hkeyApp.SetDword(TEXT("WindowX"), pInst->nWindowX);
+    hkeyApp.SetDword(TEXT("WindowY"), pInst->nWindowY);
+    hkeyApp.SetDword(TEXT("Thickness"), pInst->nThickness);
+    hkeyApp.SetDword(TEXT("Isa"), pInst->nIsa);
 
-    DWORD dwValue = DWORD(s_eScale * 100);
+    DWORD dwValue = DWORD(pInst->eScale * 100);
     hkeyApp.SetDword(TEXT("Scale"), (DWORD&)dwValue);
 
     TCHAR szText[64];
-    hkeyApp.SetSz(TEXT("Caption"), wide_from_ansi(s_strCaption.c_str()));
+    hkeyApp.SetSz(TEXT("Caption"), wide_from_ansi(pInst->strCaption.c_str()));
 
     return TRUE;
 }
@@ -228,19 +964,46 @@ Plugin_Load(PLUGIN *pi, LPARAM lParam)
     }
 
     pi->plugin_version = 1;
+#ifndef PLUGIN_HEADLESS
     StringCbCopy(pi->plugin_product_name, sizeof(pi->plugin_product_name), LoadStringDx(IDS_TITLE));
+#else
+    StringCbCopy(pi->plugin_product_name, sizeof(pi->plugin_product_name), TEXT("Clock"));
+#endif
     StringCbCopy(pi->plugin_filename, sizeof(pi->plugin_filename), TEXT("Clock.yap"));
     StringCbCopy(pi->plugin_company, sizeof(pi->plugin_company), TEXT("Katayama Hirofumi MZ"));
     StringCbCopy(pi->plugin_copyright, sizeof(pi->plugin_copyright), TEXT("Copyright (C) 2019 Katayama Hirofumi MZ"));
+
+    CLOCK_INSTANCE *pInst = new(std::nothrow) CLOCK_INSTANCE();
+    if (!pInst)
+        return FALSE;
+    pInst->pi = pi;
+    pInst->dwInstance = (DWORD)lParam;
+    pInst->cache.pllHits = PluginStats_Counter(pi, "patch_hits");
+    pInst->cache.pllMisses = PluginStats_Counter(pi, "patch_misses");
+#ifdef PLUGIN_PHASES
+    for (INT i = 0; i < PHASE_COUNT; ++i)
+    {
+        pInst->cache.apllNanos[i] = PluginStats_Counter(pi, s_apszPhaseCounters[i]);
+    }
+#endif
+    pInst->cache.piSpans = NULL;
+
     pi->plugin_instance = s_hinstDLL;
     pi->plugin_window = NULL;
-    pi->p_user_data = NULL;
+    pi->p_user_data = pInst;
     pi->l_user_data = 0;
-    pi->dwFlags = PLUGIN_FLAG_PICWRITER;
+    pi->dwFlags = PLUGIN_FLAG_PICWRITER | PLUGIN_FLAG_BATCH;
     pi->bEnabled = FALSE;
     DoLoadSettings(pi, 0, 0);
 
-    s_pi = pi;
+    pInst->isa = PluginCpu_Select(pInst->nIsa);
+    pInst->cache.fnCompositeRow = DoSelectCompositeRow(pInst->isa);
+    PluginCounter *pllIsa = PluginStats_Counter(pi, "isa");
+    PluginStats_Set(pllIsa, pInst->isa);
+
+    PLUGIN_TRACE_INIT();
+    PLUGIN_TRACEA("Clock.yap #%lu: %s kernels", (unsigned long)pInst->dwInstance,
+                  PluginCpu_GetName(pInst->isa));
 
     return TRUE;
 }
@@ -251,71 +1014,89 @@ Plugin_Load(PLUGIN *pi, LPARAM lParam)
 BOOL APIENTRY
 Plugin_Unload(PLUGIN *pi, LPARAM lParam)
 {
+    CLOCK_INSTANCE *pInst = DoGetInstance(pi);
+    if (!pInst)
+        return FALSE;
+
+    if (IsWindow(pi->plugin_window))
+        DestroyWindow(pi->plugin_window);
+
     DoSaveSettings(pi, 0, 0);
-    s_pi = NULL;
+
+    pi->p_user_data = NULL;
+    delete pInst;
+
+    PLUGIN_TRACE_EXIT();
     return TRUE;
 }
 
-void DoDrawText(cv::Mat& mat, const char *text, double scale, int thickness,
-                cv::Scalar& color)
+inline LRESULT Plugin_PicRead(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
 {
-    int font = cv::FONT_HERSHEY_SIMPLEX;
-    cv::Size screen_size(mat.cols, mat.rows);
-
-    scale *= screen_size.height * 0.01;
-
-    int baseline;
-    cv::Size text_size = cv::getTextSize(text, font, scale, thickness, &baseline);
+    const cv::Mat *pmat = (const cv::Mat *)wParam;
+    return 0;
+}
 
-    cv::Point pt;
+// The black outline and then the white fill, by cv::putText.  It is the
+// fallback of the glyph atlas.
+static void DoDrawCaption(const CLOCK_SETTINGS& settings, cv::Mat& mat,
+                          const char *pszText)
+{
+    cv::Scalar black(0, 0, 0);
+    cv::Scalar white(255, 255, 255);
 
-    switch (s_nAlign)
-    {
-    case ALIGN_LEFT:
-        pt.x = 0;
-        pt.x += s_nMargin * screen_size.height / 100;
-        break;
-    case ALIGN_CENTER:
-        pt.x = (screen_size.width - text_size.width + thickness) / 2;
-        break;
-    case ALIGN_RIGHT:
-        pt.x = screen_size.width - text_size.width;
-        pt.x -= s_nMargin * screen_size.height / 100;
-        pt.x += thickness;
-        break;
-    default:
-        assert(0);
-    }
+    DoDrawText(settings, mat, pszText, settings.eScale,
+               settings.nThickness * 3, black);
+    DoDrawText(settings, mat, pszText, settings.eScale,
+               settings.nThickness, white);
+}
 
-    switch (s_nVAlign)
+// Returns the modified rectangle.
+static cv::Rect DoWriteCaption(TEXT_CACHE& cache, const CLOCK_SETTINGS& settings,
+                               cv::Mat& mat, const char *pszText)
+{
+    cv::Rect rc;
+    if (!DoDrawTextAtlas(cache, settings, mat, pszText, rc))
     {
-    case VALIGN_TOP:
-        pt.y = 0;
-        pt.y += s_nMargin * screen_size.height / 100 - thickness / 2;
-        break;
-    case VALIGN_MIDDLE:
-        pt.y = (screen_size.height - text_size.height) / 2;
-        break;
-    case VALIGN_BOTTOM:
-        pt.y = screen_size.height - text_size.height + thickness / 2;
-        pt.y -= s_nMargin * screen_size.height / 100;
-        pt.y -= baseline;
-        break;
-    default:
-        assert(0);
+        PLUGIN_PHASE_TIMER(cache.apllNanos[PHASE_FALLBACK]);
+        DoDrawCaption(settings, mat, pszText);
+        rc = cv::Rect(0, 0, mat.cols, mat.rows);
     }
-    pt.y += text_size.height - 1;
+    return rc;
+}
 
-    cv::putText(mat, text, pt, font, scale,
-                color, thickness, cv::LINE_AA, false);
+static LRESULT Plugin_StartRec(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
+{
+    CLOCK_INSTANCE *pInst = DoGetInstance(pi);
+    pInst->cache.nPatchHits = pInst->cache.nPatchMisses = 0;
+    return 0;
 }
 
-inline LRESULT Plugin_PicRead(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
+static LRESULT Plugin_EndRec(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
 {
-    const cv::Mat *pmat = (const cv::Mat *)wParam;
+#ifdef PLUGIN_TRACE
+    CLOCK_INSTANCE *pInst = DoGetInstance(pi);
+    PLUGIN_TRACEA("Clock.yap: text patch hits %u, misses %u",
+                  pInst->cache.nPatchHits, pInst->cache.nPatchMisses);
+#endif
     return 0;
 }
 
+// Gets the local time when the frame was captured.
+static BOOL DoGetCaptureTime(const PLUGIN_FRAME_INFO *pInfo, SYSTEMTIME& st)
+{
+    if (!pInfo || pInfo->cbSize < PLUGIN_FRAME_INFO_V1_SIZE)
+        return FALSE;
+
+    ULARGE_INTEGER uli;
+    uli.QuadPart = ULONGLONG(pInfo->llCaptureTime + pInfo->llWallOffset);
+
+    FILETIME ft, ftLocal;
+    ft.dwLowDateTime = uli.LowPart;
+    ft.dwHighDateTime = uli.HighPart;
+    return FileTimeToLocalFileTime(&ft, &ftLocal) &&
+           FileTimeToSystemTime(&ftLocal, &st);
+}
+
 static LRESULT Plugin_PicWrite(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
 {
     cv::Mat *pmat = (cv::Mat *)wParam;
@@ -324,23 +1105,84 @@ static LRESULT Plugin_PicWrite(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
 
     cv::Mat& mat = *pmat;
 
+    // the host that passes no frame info gets the time of drawing
+    PLUGIN_FRAME_INFO *pInfo = (PLUGIN_FRAME_INFO *)lParam;
     SYSTEMTIME st;
-    GetLocalTime(&st);
+    if (!DoGetCaptureTime(pInfo, st))
+        GetLocalTime(&st);
 
-    std::string strText = DoGetCaption(s_strCaption.c_str(), st);
-    puts(strText.c_str());
+    CLOCK_INSTANCE *pInst = DoGetInstance(pi);
+    PluginSnapshot<CLOCK_SETTINGS>::Pin settings(pInst->settings);
+    pInst->cache.piSpans = PluginSpans_GetTarget(pi);
 
-    cv::Scalar black(0, 0, 0);
-    cv::Scalar white(255, 255, 255);
+    char szText[CAPTION_MAX_TEXT];
+    {
+        PluginSpan span(pInst->cache.piSpans, "format", "Clock.yap");
+        PLUGIN_PHASE_TIMER(pInst->cache.apllNanos[PHASE_FORMAT]);
+        DoRenderCaption(settings->program, st, szText, ARRAYSIZE(szText));
+    }
+    PLUGIN_TRACEA("Clock.yap: %s", szText);
 
-    DoDrawText(mat, strText.c_str(), s_eScale, s_nThickness * 3, black);
-    DoDrawText(mat, strText.c_str(), s_eScale, s_nThickness, white);
+    cv::Rect rc = DoWriteCaption(pInst->cache, *settings, mat, szText);
+
+    if (pInfo && pInfo->cbSize >= sizeof(PLUGIN_FRAME_INFO))
+    {
+        pInfo->nDirtyRects = 0;
+        if (rc.area() > 0)
+        {
+            RECT& rcDirty = pInfo->rcDirty[pInfo->nDirtyRects++];
+            SetRect(&rcDirty, rc.x, rc.y, rc.x + rc.width, rc.y + rc.height);
+        }
+    }
     return 0;
 }
 
+// The caption is rendered again only when the time changes, and the text
+// patch is rebuilt only when the caption changes.
+static LRESULT Plugin_PicWriteBatch(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
+{
+    const PLUGIN_BATCH *pBatch = (const PLUGIN_BATCH *)wParam;
+    if (!pBatch || pBatch->cbSize < sizeof(PLUGIN_BATCH) || !pBatch->ppmat)
+        return 0;
+
+    SYSTEMTIME stNow;
+    if (!pBatch->pst)
+        GetLocalTime(&stNow);
+
+    CLOCK_INSTANCE *pInst = DoGetInstance(pi);
+    PluginSnapshot<CLOCK_SETTINGS>::Pin settings(pInst->settings);
+    pInst->cache.piSpans = PluginSpans_GetTarget(pi);
+
+    char szText[CAPTION_MAX_TEXT];
+    const SYSTEMTIME *pstText = NULL;
+    for (UINT i = 0; i < pBatch->nCount; ++i)
+    {
+        cv::Mat *pmat = pBatch->ppmat[i];
+        if (!pmat || !pmat->data)
+            continue;
+
+        const SYSTEMTIME *pst = pBatch->pst ? &pBatch->pst[i] : &stNow;
+        if (!pstText || memcmp(pstText, pst, sizeof(SYSTEMTIME)) != 0)
+        {
+            PLUGIN_PHASE_TIMER(pInst->cache.apllNanos[PHASE_FORMAT]);
+            DoRenderCaption(settings->program, *pst, szText, ARRAYSIZE(szText));
+            pstText = pst;
+        }
+
+        DoWriteCaption(pInst->cache, *settings, *pmat, szText);
+    }
+
+    PLUGIN_TRACEA("Clock.yap: %u frames, last %s", pBatch->nCount,
+                  pstText ? szText : "");
+    return 0;
+}
+
+#ifndef PLUGIN_HEADLESS
 static BOOL OnInitDialog(HWND hwnd, HWND hwndFocus, LPARAM lParam)
 {
-    s_pi->plugin_window = hwnd;
+    CLOCK_INSTANCE *pInst = (CLOCK_INSTANCE *)lParam;
+    SetWindowLongPtr(hwnd, DWLP_USER, lParam);
+    pInst->pi->plugin_window = hwnd;
 
     HWND hCmb1 = GetDlgItem(hwnd, cmb1);
     ComboBox_AddString(hCmb1, TEXT("&h:&m"));
@@ -350,13 +1192,13 @@ static BOOL OnInitDialog(HWND hwnd, HWND hwndFocus, LPARAM lParam)
     ComboBox_AddString(hCmb1, TEXT("&y.&M.&d &h:&m:&s.&f"));
     ComboBox_AddString(hCmb1, TEXT("&y.&M.&d"));
     ComboBox_AddString(hCmb1, TEXT("Sample Text"));
-    SetDlgItemTextA(hwnd, cmb1, s_strCaption.c_str());
+    SetDlgItemTextA(hwnd, cmb1, pInst->strCaption.c_str());
 
     HWND hCmb2 = GetDlgItem(hwnd, cmb2);
     ComboBox_AddString(hCmb2, LoadStringDx(IDS_LEFT));
     ComboBox_AddString(hCmb2, LoadStringDx(IDS_CENTER));
     ComboBox_AddString(hCmb2, LoadStringDx(IDS_RIGHT));
-    switch (s_nAlign)
+    switch (pInst->nAlign)
     {
     case ALIGN_LEFT:
         ComboBox_SetCurSel(hCmb2, 0);
@@ -373,7 +1215,7 @@ static BOOL OnInitDialog(HWND hwnd, HWND hwndFocus, LPARAM lParam)
     ComboBox_AddString(hCmb3, LoadStringDx(IDS_TOP));
     ComboBox_AddString(hCmb3, LoadStringDx(IDS_MIDDLE));
     ComboBox_AddString(hCmb3, LoadStringDx(IDS_BOTTOM));
-    switch (s_nVAlign)
+    switch (pInst->nVAlign)
     {
     case VALIGN_TOP:
         ComboBox_SetCurSel(hCmb3, 0);
@@ -386,62 +1228,69 @@ static BOOL OnInitDialog(HWND hwnd, HWND hwndFocus, LPARAM lParam)
         break;
     }
 
-    DWORD dwValue = DWORD(s_eScale * 100);
+    DWORD dwValue = DWORD(pInst->eScale * 100);
     SendDlgItemMessage(hwnd, scr1, UDM_SETRANGE, 0, MAKELONG(100, 0));
     SendDlgItemMessage(hwnd, scr1, UDM_SETPOS, 0, MAKELONG(dwValue, 0));
 
     SendDlgItemMessage(hwnd, scr2, UDM_SETRANGE, 0, MAKELONG(300, 0));
-    SendDlgItemMessage(hwnd, scr2, UDM_SETPOS, 0, MAKELONG(s_nMargin, 0));
+    SendDlgItemMessage(hwnd, scr2, UDM_SETPOS, 0, MAKELONG(pInst->nMargin, 0));
 
     SendDlgItemMessage(hwnd, scr3, UDM_SETRANGE, 0, MAKELONG(30, 0));
-    SendDlgItemMessage(hwnd, scr3, UDM_SETPOS, 0, MAKELONG(s_nThickness, 0));
+    SendDlgItemMessage(hwnd, scr3, UDM_SETPOS, 0, MAKELONG(pInst->nThickness, 0));
 
-    s_bDialogInit = TRUE;
+    pInst->bDialogInit = TRUE;
     return TRUE;
 }
 
 static void OnEdt1(HWND hwnd)
 {
-    if (!s_bDialogInit)
+    CLOCK_INSTANCE *pInst = DoGetDialogInstance(hwnd);
+    if (!pInst || !pInst->bDialogInit)
         return;
 
     BOOL bTranslated = FALSE;
     INT nValue = GetDlgItemInt(hwnd, edt1, &bTranslated, TRUE);
     if (bTranslated)
     {
-        s_eScale = nValue / 100.0;
+        pInst->eScale = nValue / 100.0;
+        DoPublishSettings(pInst);
     }
 }
 
 static void OnEdt2(HWND hwnd)
 {
-    if (!s_bDialogInit)
+    CLOCK_INSTANCE *pInst = DoGetDialogInstance(hwnd);
+    if (!pInst || !pInst->bDialogInit)
         return;
 
     BOOL bTranslated = FALSE;
     INT nValue = GetDlgItemInt(hwnd, edt2, &bTranslated, TRUE);
     if (bTranslated)
     {
-        s_nMargin = nValue;
+        pInst->nMargin = nValue;
+        DoPublishSettings(pInst);
     }
 }
 
 static void OnEdt3(HWND hwnd)
 {
-    if (!s_bDialogInit)
+    CLOCK_INSTANCE *pInst = DoGetDialogInstance(hwnd);
+    if (!pInst || !pInst->bDialogInit)
         return;
 
     BOOL bTranslated = FALSE;
     INT nValue = GetDlgItemInt(hwnd, edt3, &bTranslated, TRUE);
     if (bTranslated)
     {
-        s_nThickness = nValue;
+        pInst->nThickness = nValue;
+        DoPublishSettings(pInst);
     }
 }
 
 static void OnCmb1(HWND hwnd)
 {
-    if (!s_bDialogInit)
+    CLOCK_INSTANCE *pInst = DoGetDialogInstance(hwnd);
+    if (!pInst || !pInst->bDialogInit)
         return;
 
     HWND hCmb1 = GetDlgItem(hwnd, cmb1);
@@ -457,55 +1306,62 @@ static void OnCmb1(HWND hwnd)
         ComboBox_GetLBText(hCmb1, iItem, szText);
     }
 
-    s_strCaption = ansi_from_wide(szText);
+    pInst->strCaption = ansi_from_wide(szText);
+    DoPublishSettings(pInst);
 }
 
 static void OnCmb2(HWND hwnd)
 {
-    if (!s_bDialogInit)
+    CLOCK_INSTANCE *pInst = DoGetDialogInstance(hwnd);
+    if (!pInst || !pInst->bDialogInit)
         return;
 
     HWND hCmb2 = GetDlgItem(hwnd, cmb2);
     switch (ComboBox_GetCurSel(hCmb2))
     {
     case 0:
-        s_nAlign = ALIGN_LEFT;
+        pInst->nAlign = ALIGN_LEFT;
         break;
     case 1:
-        s_nAlign = ALIGN_CENTER;
+        pInst->nAlign = ALIGN_CENTER;
         break;
     case 2:
-        s_nAlign = ALIGN_RIGHT;
+        pInst->nAlign = ALIGN_RIGHT;
         break;
     case CB_ERR:
     default:
         assert(0);
         break;
     }
+
+    DoPublishSettings(pInst);
 }
 
 static void OnCmb3(HWND hwnd)
 {
-    if (!s_bDialogInit)
+    CLOCK_INSTANCE *pInst = DoGetDialogInstance(hwnd);
+    if (!pInst || !pInst->bDialogInit)
         return;
 
     HWND hCmb3 = GetDlgItem(hwnd, cmb3);
     switch (ComboBox_GetCurSel(hCmb3))
     {
     case 0:
-        s_nVAlign = VALIGN_TOP;
+        pInst->nVAlign = VALIGN_TOP;
         break;
     case 1:
-        s_nVAlign = VALIGN_MIDDLE;
+        pInst->nVAlign = VALIGN_MIDDLE;
         break;
     case 2:
-        s_nVAlign = VALIGN_BOTTOM;
+        pInst->nVAlign = VALIGN_BOTTOM;
         break;
     case CB_ERR:
     default:
         assert(0);
         break;
     }
+
+    DoPublishSettings(pInst);
 }
 
 static void OnCommand(HWND hwnd, int id, HWND hwndCtl, UINT codeNotify)
@@ -565,19 +1421,28 @@ static void OnCommand(HWND hwnd, int id, HWND hwndCtl, UINT codeNotify)
 
 static void OnDestroy(HWND hwnd)
 {
-    s_pi->plugin_window = NULL;
-    s_bDialogInit = FALSE;
+    CLOCK_INSTANCE *pInst = DoGetDialogInstance(hwnd);
+    if (!pInst)
+        return;
+
+    pInst->pi->plugin_window = NULL;
+    pInst->bDialogInit = FALSE;
 }
 
 static void OnMove(HWND hwnd, int x, int y)
 {
+    // WM_MOVE comes before WM_INITDIALOG
+    CLOCK_INSTANCE *pInst = DoGetDialogInstance(hwnd);
+    if (!pInst)
+        return;
+
     if (IsMinimized(hwnd) || IsMaximized(hwnd))
         return;
 
     RECT rc;
     GetWindowRect(hwnd, &rc);
-    s_nWindowX = rc.left;
-    s_nWindowY = rc.top;
+    pInst->nWindowX = rc.left;
+    pInst->nWindowY = rc.top;
 }
 
 static INT_PTR CALLBACK
@@ -598,8 +1463,6 @@ static LRESULT Plugin_ShowDialog(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
     HWND hMainWnd = (HWND)wParam;
     BOOL bShowOrHide = (BOOL)lParam;
 
-    s_pi = pi;
-
     if (bShowOrHide)
     {
         if (IsWindow(pi->plugin_window))
@@ -612,7 +1475,8 @@ static LRESULT Plugin_ShowDialog(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
         }
         else
         {
-            CreateDialog(s_hinstDLL, MAKEINTRESOURCE(IDD_CONFIG), hMainWnd, DialogProc);
+            CreateDialogParam(s_hinstDLL, MAKEINTRESOURCE(IDD_CONFIG), hMainWnd,
+                              DialogProc, (LPARAM)DoGetInstance(pi));
             if (pi->plugin_window)
             {
                 ShowWindow(pi->plugin_window, SW_SHOWNORMAL);
@@ -629,11 +1493,15 @@ static LRESULT Plugin_ShowDialog(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
 
     return FALSE;
 }
+#else
+static LRESULT Plugin_ShowDialog(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
+{
+    return FALSE;
+}
+#endif  // ndef PLUGIN_HEADLESS
 
 static LRESULT Plugin_Refresh(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
 {
-    s_pi = pi;
-
     if (BOOL bResetSettings = (BOOL)wParam)
     {
         DoResetSettings(pi, 0, 0);
@@ -650,13 +1518,17 @@ Plugin_Act(PLUGIN *pi, UINT uAction, WPARAM wParam, LPARAM lParam)
     switch (uAction)
     {
     case PLUGIN_ACTION_STARTREC:
+        return Plugin_StartRec(pi, wParam, lParam);
     case PLUGIN_ACTION_PAUSE:
-    case PLUGIN_ACTION_ENDREC:
         break;
+    case PLUGIN_ACTION_ENDREC:
+        return Plugin_EndRec(pi, wParam, lParam);
     case PLUGIN_ACTION_PICREAD:
         return Plugin_PicRead(pi, wParam, lParam);
     case PLUGIN_ACTION_PICWRITE:
         return Plugin_PicWrite(pi, wParam, lParam);
+    case PLUGIN_ACTION_PICWRITE_BATCH:
+        return Plugin_PicWriteBatch(pi, wParam, lParam);
     case PLUGIN_ACTION_SHOWDIALOG:
         return Plugin_ShowDialog(pi, wParam, lParam);
     case PLUGIN_ACTION_REFRESH:
@@ -665,6 +1537,7 @@ Plugin_Act(PLUGIN *pi, UINT uAction, WPARAM wParam, LPARAM lParam)
     return 0;
 }
 
+#ifndef PLUGIN_HEADLESS
 BOOL WINAPI
 DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 {
@@ -679,5 +1552,6 @@ DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
     }
     return TRUE;
 }
+#endif
 
 } // extern "C"
@@ -5,10 +5,9 @@
 #define PLUGIN_H_
 // TODO: Rename this file
 
-#ifndef _INC_WINDOWS
-    #include <windows.h>
-#endif
+#include "PluginPort.h"
 #include <opencv2/opencv.hpp>
+#include <stddef.h>
 
 // TODO: Change me!
 #ifndef FRAMEWORK_NAME
@@ -25,6 +24,13 @@
     #define FRAMEWORK_VERSION 1
 #endif
 
+// A plugin that is built with PLUGIN_STATIC is a static library that the
+// host links in, and one that is built without Windows has no window
+// system.  Either way it is headless: it has no resources and no dialog.
+#if defined(PLUGIN_STATIC) || !defined(_WIN32)
+    #define PLUGIN_HEADLESS
+#endif
+
 struct PLUGIN;
 struct PLUGIN_FRAMEWORK_IMPL;
 
@@ -62,6 +68,7 @@ typedef struct PLUGIN
     // TODO: Add more members and version up...
 #define PLUGIN_FLAG_PICREADER 0x00000001
 #define PLUGIN_FLAG_PICWRITER 0x00000002
+#define PLUGIN_FLAG_BATCH 0x00000004     // supports PLUGIN_ACTION_PICWRITE_BATCH
     DWORD dwFlags;
     BOOL bEnabled;
 } PLUGIN;
@@ -73,6 +80,11 @@ extern "C" {
 // API Name: Plugin_Load
 // Purpose: The framework want to load the plugin component.
 // TODO: Load the plugin component.
+// Parameters:
+//    lParam: DWORD dwInstance; /* zero for the first instance */
+// NOTE: The framework may load a plugin several times, once per stream.
+//       Each instance has its own PLUGIN, and the instances may act in
+//       parallel.  Keep the state of an instance in p_user_data.
 BOOL APIENTRY Plugin_Load(PLUGIN *pi, LPARAM lParam);
 
 // API Name: Plugin_Unload
@@ -87,6 +99,22 @@ LRESULT APIENTRY Plugin_Act(PLUGIN *pi, UINT uAction, WPARAM wParam, LPARAM lPar
 
 // TODO: Add more APIs
 
+// A plugin that is built with PLUGIN_STATIC prefixes its entry points with
+// its name, so that the host can link several plugins.  The host declares
+// them with PLUGIN_DECLARE_STATIC(name), e.g.
+//     PLUGIN_DECLARE_STATIC(Clock)
+//     host.LoadEntries(Clock_Plugin_Load, Clock_Plugin_Unload, Clock_Plugin_Act);
+#ifdef __cplusplus
+    #define PLUGIN_EXTERN_C extern "C"
+#else
+    #define PLUGIN_EXTERN_C
+#endif
+#define PLUGIN_DECLARE_STATIC(name) \
+    PLUGIN_EXTERN_C BOOL APIENTRY name##_Plugin_Load(PLUGIN *pi, LPARAM lParam); \
+    PLUGIN_EXTERN_C BOOL APIENTRY name##_Plugin_Unload(PLUGIN *pi, LPARAM lParam); \
+    PLUGIN_EXTERN_C LRESULT APIENTRY name##_Plugin_Act(PLUGIN *pi, UINT uAction, \
+                                                       WPARAM wParam, LPARAM lParam);
+
 //////////////////////////////////////////////////////////////////////////////
 // Actions
 //
@@ -115,18 +143,47 @@ LRESULT APIENTRY Plugin_Act(PLUGIN *pi, UINT uAction, WPARAM wParam, LPARAM lPar
 //      Meaning: Read from a picture.
 //      Parameters:
 //         wParam: const cv::Mat* pmat;
-//         lParam: zero;
+//         lParam: const PLUGIN_FRAME_INFO* pInfo; /* or zero */
 //      Return value: zero;
+// NOTE: A plugin that has PLUGIN_FLAG_PICREADER but not PLUGIN_FLAG_PICWRITER
+//       may be called on a thread of its own, in parallel with the writers
+//       and the other readers, but with one frame at a time.  The frame is
+//       shared and must not be modified.  Copy the cv::Mat to hold the frame
+//       after returning.  If the plugin falls behind, the host may skip
+//       frames; see ullFrameIndex.
 #define PLUGIN_ACTION_PICREAD 4
 
 // Action: PLUGIN_ACTION_PICWRITE (5)
 //      Meaning: Write on a picture.
 //      Parameters:
 //         wParam: cv::Mat* pmat;
-//         lParam: zero;
+//         lParam: PLUGIN_FRAME_INFO* pInfo; /* or zero */
 //      Return value: zero;
 #define PLUGIN_ACTION_PICWRITE 5
 
+// The description of a frame.  The old hosts pass zero instead of it.
+// The host sets cbSize to the size of the version it knows; a plugin must
+// not read the members beyond cbSize.
+typedef struct PLUGIN_FRAME_INFO
+{
+    DWORD cbSize;                   // sizeof(PLUGIN_FRAME_INFO)
+    DWORD dwStreamID;               // which capture stream
+    ULONGLONG ullFrameIndex;        // counts up from zero in each stream
+    LONGLONG llCaptureTime;         // monotonic capture time, in 100ns units
+    LONGLONG llWallOffset;          // llCaptureTime + llWallOffset is a FILETIME (UTC)
+    INT nFormat;                    // the cv::Mat type of the frame
+
+    // Version 2:
+    // In PLUGIN_ACTION_PICWRITE, the host sets nDirtyRects to PLUGIN_DIRTY_ALL
+    // and the plugin may narrow it down to the rectangles it modified.
+#define PLUGIN_MAX_DIRTY_RECTS 4
+#define PLUGIN_DIRTY_ALL ((UINT)-1)
+    UINT nDirtyRects;               // 0 to PLUGIN_MAX_DIRTY_RECTS, or PLUGIN_DIRTY_ALL
+    RECT rcDirty[PLUGIN_MAX_DIRTY_RECTS];
+} PLUGIN_FRAME_INFO;
+
+#define PLUGIN_FRAME_INFO_V1_SIZE (offsetof(PLUGIN_FRAME_INFO, nFormat) + sizeof(INT))
+
 // Action: PLUGIN_ACTION_SHOWDIALOG (6)
 //      Meaning: Show/Hide a modeless dialog for plugin settings
 //      Parameters:
@@ -143,6 +200,121 @@ LRESULT APIENTRY Plugin_Act(PLUGIN *pi, UINT uAction, WPARAM wParam, LPARAM lPar
 //      Return value: zero;
 #define PLUGIN_ACTION_REFRESH 7
 
+// Action: PLUGIN_ACTION_PICWRITE_BATCH (8)
+//      Meaning: Write on pictures, in order.
+//               Only for the plugins that have PLUGIN_FLAG_BATCH.
+//      Parameters:
+//         wParam: const PLUGIN_BATCH* pBatch;
+//         lParam: zero;
+//      Return value: zero;
+#define PLUGIN_ACTION_PICWRITE_BATCH 8
+
+typedef struct PLUGIN_BATCH
+{
+    DWORD cbSize;                   // sizeof(PLUGIN_BATCH)
+    UINT nCount;                    // the number of frames
+    cv::Mat **ppmat;                // nCount frames
+    const SYSTEMTIME *pst;          // nCount local times, or NULL for now
+} PLUGIN_BATCH;
+
+//////////////////////////////////////////////////////////////////////////////
+// Driver functions
+//
+// A plugin calls the host by pi->driver(pi, uFunc, wParam, lParam), if
+// pi->driver is not NULL.  The host returns zero for an unknown function.
+
+// Driver: PLUGIN_DRIVER_GET_ALLOCATOR (1)
+//      Meaning: Get the frame allocator of the host (see PluginAllocator.h).
+//      Parameters: zero;
+//      Return value: cv::MatAllocator* pAllocator; /* or zero */
+#define PLUGIN_DRIVER_GET_ALLOCATOR 1
+
+// Driver: PLUGIN_DRIVER_GET_ALLOC_STATS (2)
+//      Meaning: Get the statistics of the frame allocator.
+//      Parameters:
+//         wParam: PLUGIN_ALLOC_STATS* pStats; /* cbSize must be set */
+//         lParam: zero;
+//      Return value: TRUE if successful;
+#define PLUGIN_DRIVER_GET_ALLOC_STATS 2
+
+typedef struct PLUGIN_ALLOC_STATS
+{
+    DWORD cbSize;                   // sizeof(PLUGIN_ALLOC_STATS)
+    ULONGLONG ullAllocs;            // buffers requested
+    ULONGLONG ullHits;              // buffers given from the pool
+    ULONGLONG cbResident;           // bytes taken from the system, in use or cached
+    ULONGLONG cbPeakResident;       // the maximum of cbResident
+    ULONGLONG cbCached;             // bytes kept for reuse
+} PLUGIN_ALLOC_STATS;
+
+// Driver: PLUGIN_DRIVER_GET_ACT_STATS (3)
+//      Meaning: Get the timing of Plugin_Act of the plugin for an action.
+//      Parameters:
+//         wParam: PLUGIN_ACT_STATS* pStats; /* cbSize and uAction must be set */
+//         lParam: zero;
+//      Return value: TRUE if successful;
+#define PLUGIN_DRIVER_GET_ACT_STATS 3
+
+typedef struct PLUGIN_ACT_STATS
+{
+    DWORD cbSize;                   // sizeof(PLUGIN_ACT_STATS)
+    UINT uAction;                   // PLUGIN_ACTION_...
+    ULONGLONG ullCalls;
+    ULONGLONG ullFrames;            // the pictures given
+    ULONGLONG ullBytes;             // the bytes of the pictures given
+    ULONGLONG ullTotalNanos;
+    ULONGLONG ullP50Nanos;          // the percentiles of a call
+    ULONGLONG ullP95Nanos;
+    ULONGLONG ullP99Nanos;
+    ULONGLONG ullMaxNanos;
+} PLUGIN_ACT_STATS;
+
+// Driver: PLUGIN_DRIVER_ADD_COUNTER (4)
+//      Meaning: Add a named counter of the plugin, or get it if it exists.
+//      Parameters:
+//         wParam: const char* pszName; /* up to 31 characters */
+//         lParam: zero;
+//      Return value: std::atomic<LONGLONG>* pCounter; /* or zero */
+// NOTE: The counter lives until the plugin is unloaded.  The plugin changes
+//       it directly by relaxed atomic operations; the host only reads it.
+//       See PluginStats.h.
+#define PLUGIN_DRIVER_ADD_COUNTER 4
+
+// Driver: PLUGIN_DRIVER_GET_COUNTER (5)
+//      Meaning: Get a counter of the plugin by the index.
+//      Parameters:
+//         wParam: UINT iCounter;
+//         lParam: PLUGIN_COUNTER* pCounter; /* cbSize must be set */
+//      Return value: TRUE if successful, FALSE if no more;
+#define PLUGIN_DRIVER_GET_COUNTER 5
+
+typedef struct PLUGIN_COUNTER
+{
+    DWORD cbSize;                   // sizeof(PLUGIN_COUNTER)
+    char szName[32];
+    LONGLONG llValue;
+} PLUGIN_COUNTER;
+
+// Driver: PLUGIN_DRIVER_RECORD_SPAN (6)
+//      Meaning: Record a span on the timeline of the host (see PluginSpans.h).
+//      Parameters:
+//         wParam: const PLUGIN_SPAN_RECORD* pSpan; /* or zero */
+//         lParam: zero;
+//      Return value: TRUE if the host records spans, FALSE otherwise;
+// NOTE: If pSpan is zero, it only answers whether the host records spans.
+//       The names must be string literals.
+#define PLUGIN_DRIVER_RECORD_SPAN 6
+
+typedef struct PLUGIN_SPAN_RECORD
+{
+    DWORD cbSize;                   // sizeof(PLUGIN_SPAN_RECORD)
+    const char *pszName;
+    const char *pszCat;
+    LONGLONG llBegin;               // nanoseconds of PluginSpans_Now
+    LONGLONG llEnd;
+    LONGLONG llFrame;               // the frame index, or -1
+} PLUGIN_SPAN_RECORD;
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,330 @@
+// PluginAllocator.h --- PluginFramework pooled frame allocator
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#ifndef PLUGIN_ALLOCATOR_H_
+#define PLUGIN_ALLOCATOR_H_
+
+// NOTE: The host owns a PluginAllocator and gives it to the plugins through
+//       PLUGIN_DRIVER_GET_ALLOCATOR.  A freed buffer is kept in a list of
+//       its size class and given to the next request of that class, and its
+//       cv::UMatData in a list of its own, so that a steady stream of frames
+//       allocates nothing, not even by operator new.  The buffers are
+//       aligned to PLUGIN_ALLOC_ALIGN bytes, and the rows can be padded to
+//       a multiple of it.
+//
+//       The host must destroy the allocator after unloading the plugins,
+//       since the plugins may hold buffers until Plugin_Unload.
+
+#include "Plugin.h"
+#include "PluginSpans.h"
+#include <mutex>
+#include <map>
+#include <new>
+#include <vector>
+#include <cstdlib>
+
+#ifndef PLUGIN_ALLOC_ALIGN
+    #define PLUGIN_ALLOC_ALIGN 64           // a cache line; a power of two
+#endif
+#ifndef PLUGIN_ALLOC_MAX_CACHED
+    #define PLUGIN_ALLOC_MAX_CACHED (256 * 1024 * 1024)
+#endif
+
+#if CV_VERSION_MAJOR >= 4
+    typedef cv::AccessFlag PLUGIN_ACCESS_FLAG;
+#else
+    typedef int PLUGIN_ACCESS_FLAG;
+#endif
+
+class PluginAllocator : public cv::MatAllocator
+{
+public:
+    PluginAllocator(bool bPadRows = false,
+                    size_t cbMaxCached = PLUGIN_ALLOC_MAX_CACHED)
+        : m_bPadRows(bPadRows)
+        , m_cbMaxCached(cbMaxCached)
+        , m_pSpans(NULL)
+    {
+        m_stats.cbResident = 0;
+        m_stats.cbCached = 0;
+        ResetStats();
+    }
+
+    ~PluginAllocator()
+    {
+        Trim();
+    }
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data0,
+                           size_t *step, PLUGIN_ACCESS_FLAG flags,
+                           cv::UMatUsageFlags usage) const
+    {
+        // the same as cv::StdMatAllocator, but the rows may be padded
+        size_t total = CV_ELEM_SIZE(type);
+        for (int i = dims - 1; i >= 0; --i)
+        {
+            if (step)
+            {
+                if (data0 && step[i] != CV_AUTOSTEP)
+                {
+                    CV_Assert(total <= step[i]);
+                    total = step[i];
+                }
+                else
+                {
+                    step[i] = total;
+                }
+            }
+            total *= sizes[i];
+            if (i == dims - 1 && dims >= 2 && m_bPadRows && !data0)
+                total = DoAlignUp(total, PLUGIN_ALLOC_ALIGN);
+        }
+
+        uchar *data = (uchar *)data0;
+        if (!data)
+        {
+            data = DoGet(total);
+            if (!data)
+                CV_Error(cv::Error::StsNoMem, "PluginAllocator: out of memory");
+        }
+
+        cv::UMatData *u = DoNewUMatData();
+        u->data = u->origdata = data;
+        u->size = total;
+        if (data0)
+            u->flags |= cv::UMatData::USER_ALLOCATED;
+        return u;
+    }
+
+    bool allocate(cv::UMatData *u, PLUGIN_ACCESS_FLAG flags,
+                  cv::UMatUsageFlags usage) const
+    {
+        return u != NULL;
+    }
+
+    void deallocate(cv::UMatData *u) const
+    {
+        if (!u)
+            return;
+
+        CV_Assert(u->urefcount == 0);
+        CV_Assert(u->refcount == 0);
+        if (!(u->flags & cv::UMatData::USER_ALLOCATED))
+        {
+            DoPut(u->origdata, u->size);
+            u->origdata = NULL;
+        }
+        DoDeleteUMatData(u);
+    }
+
+    // Frees all the cached buffers and cv::UMatData.
+    void Trim()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (size_t i = 0; i < m_freeUMatData.size(); ++i)
+        {
+            ::operator delete(m_freeUMatData[i]);
+        }
+        m_freeUMatData.clear();
+
+        std::map<size_t, std::vector<uchar *> >::iterator it;
+        for (it = m_free.begin(); it != m_free.end(); ++it)
+        {
+            std::vector<uchar *>& list = it->second;
+            for (size_t i = 0; i < list.size(); ++i)
+            {
+                DoFree(list[i]);
+            }
+            m_stats.cbResident -= it->first * list.size();
+        }
+        m_free.clear();
+        m_stats.cbCached = 0;
+    }
+
+    void GetStats(PLUGIN_ALLOC_STATS& stats) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        stats = m_stats;
+        stats.cbSize = sizeof(stats);
+    }
+
+    // Restarts the counters and the peak, but not the byte counts.
+    void ResetStats()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.cbSize = sizeof(m_stats);
+        m_stats.ullAllocs = 0;
+        m_stats.ullHits = 0;
+        m_stats.cbPeakResident = m_stats.cbResident;
+    }
+
+    // Records the allocations from the system as spans.
+    void SetSpans(PluginSpanRecorder *pSpans)
+    {
+        m_pSpans = pSpans;
+    }
+
+    // Returns the size class of cb.  There are eight classes per power of
+    // two, so that a buffer is at most 12.5% larger than needed.
+    static size_t GetClassSize(size_t cb)
+    {
+        if (cb <= PLUGIN_ALLOC_ALIGN * 8)
+            return DoAlignUp(cb ? cb : 1, PLUGIN_ALLOC_ALIGN);
+
+        size_t top = cb;
+        while (top & (top - 1))
+            top &= top - 1;
+        return DoAlignUp(cb, top / 8);
+    }
+
+protected:
+    const bool m_bPadRows;
+    const size_t m_cbMaxCached;
+    mutable std::mutex m_mutex;         // guards the members below
+    mutable std::map<size_t, std::vector<uchar *> > m_free;
+    mutable std::vector<void *> m_freeUMatData;     // destroyed, not freed
+    mutable PLUGIN_ALLOC_STATS m_stats;
+    PluginSpanRecorder *m_pSpans;
+
+    static size_t DoAlignUp(size_t cb, size_t align)
+    {
+        return (cb + align - 1) & ~(align - 1);
+    }
+
+    // The pointer that malloc returned is kept just before the buffer.
+    static uchar *DoAlloc(size_t cb)
+    {
+        void *p = malloc(cb + PLUGIN_ALLOC_ALIGN + sizeof(void *));
+        if (!p)
+            return NULL;
+
+        size_t addr = size_t(p) + sizeof(void *);
+        uchar *data = (uchar *)DoAlignUp(addr, PLUGIN_ALLOC_ALIGN);
+        ((void **)data)[-1] = p;
+        return data;
+    }
+
+    static void DoFree(uchar *data)
+    {
+        free(((void **)data)[-1]);
+    }
+
+    uchar *DoGet(size_t cb) const
+    {
+        size_t cbClass = GetClassSize(cb);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_stats.ullAllocs;
+
+            std::vector<uchar *>& list = m_free[cbClass];
+            if (list.size())
+            {
+                uchar *data = list.back();
+                list.pop_back();
+                m_stats.cbCached -= cbClass;
+                ++m_stats.ullHits;
+                return data;
+            }
+        }
+
+        uchar *data;
+        {
+            PluginSpan span(m_pSpans, "alloc", "allocator");
+            data = DoAlloc(cbClass);
+        }
+        if (!data)
+            return NULL;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.cbResident += cbClass;
+        if (m_stats.cbPeakResident < m_stats.cbResident)
+            m_stats.cbPeakResident = m_stats.cbResident;
+        return data;
+    }
+
+    // new cv::UMatData(this), in a freed one if there is
+    cv::UMatData *DoNewUMatData() const
+    {
+        void *p = NULL;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_freeUMatData.size())
+            {
+                p = m_freeUMatData.back();
+                m_freeUMatData.pop_back();
+            }
+        }
+        if (!p)
+            p = ::operator new(sizeof(cv::UMatData));
+        return new(p) cv::UMatData(this);
+    }
+
+    // delete u, but its memory is kept for DoNewUMatData
+    void DoDeleteUMatData(cv::UMatData *u) const
+    {
+        u->~UMatData();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_freeUMatData.push_back(u);
+    }
+
+    void DoPut(uchar *data, size_t cb) const
+    {
+        size_t cbClass = GetClassSize(cb);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stats.cbCached + cbClass <= m_cbMaxCached)
+            {
+                m_free[cbClass].push_back(data);
+                m_stats.cbCached += cbClass;
+                return;
+            }
+            m_stats.cbResident -= cbClass;
+        }
+
+        PluginSpan span(m_pSpans, "free", "allocator");
+        DoFree(data);
+    }
+
+private:
+    PluginAllocator(const PluginAllocator&);
+    PluginAllocator& operator=(const PluginAllocator&);
+};
+
+// For the host: call it in the driver of the plugins.  Returns FALSE if
+// uFunc is not a function of the allocator.
+inline BOOL PluginAllocator_Driver(PluginAllocator& allocator, UINT uFunc,
+                                   WPARAM wParam, LPARAM lParam,
+                                   LRESULT& result)
+{
+    switch (uFunc)
+    {
+    case PLUGIN_DRIVER_GET_ALLOCATOR:
+        result = (LRESULT)static_cast<cv::MatAllocator *>(&allocator);
+        return TRUE;
+    case PLUGIN_DRIVER_GET_ALLOC_STATS:
+        {
+            PLUGIN_ALLOC_STATS *pStats = (PLUGIN_ALLOC_STATS *)wParam;
+            result = FALSE;
+            if (pStats && pStats->cbSize >= sizeof(PLUGIN_ALLOC_STATS))
+            {
+                allocator.GetStats(*pStats);
+                result = TRUE;
+            }
+        }
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// For the plugins: returns the allocator of the host, or NULL for the
+// default allocator of OpenCV.
+inline cv::MatAllocator *PluginAllocator_Get(PLUGIN *pi)
+{
+    if (!pi || !pi->driver)
+        return NULL;
+    return (cv::MatAllocator *)pi->driver(pi, PLUGIN_DRIVER_GET_ALLOCATOR, 0, 0);
+}
+
+#endif  // ndef PLUGIN_ALLOCATOR_H_
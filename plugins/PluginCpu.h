@@ -0,0 +1,127 @@
+// PluginCpu.h --- PluginFramework CPU features for the kernels
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#ifndef PLUGIN_CPU_H_
+#define PLUGIN_CPU_H_
+
+// NOTE: The build flags stay at the oldest CPU that the plugins run on.  A
+//       plugin builds its hot kernels once per PLUGIN_ISA, each level in a
+//       file of its own with the flags of the level (PLUGIN_ISA_..._FLAGS of
+//       CMakeLists.txt), and picks the best level that the CPU has at
+//       Plugin_Load.  A file of a level is empty of kernels if it is built
+//       without the flags, e.g. on ARM.
+//
+//       A file of a level must not include OpenCV, this header, or any
+//       other header with inline functions that the other files use: the
+//       linker keeps one copy of an inline function, and that may be the
+//       copy built for a CPU that runs the other files.
+//
+//       The setting "Isa" of a plugin caps the level, e.g. to compare the
+//       levels in a benchmark.  The counter "isa" of the plugin is the level
+//       of the kernels in use.
+
+#include "Plugin.h"
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+    #define PLUGIN_CPU_X86
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+#endif
+
+enum PLUGIN_ISA
+{
+    PLUGIN_ISA_AUTO,                // for "Isa": the best that the CPU has
+    PLUGIN_ISA_GENERIC,             // plain C++
+    PLUGIN_ISA_SSE2,
+    PLUGIN_ISA_AVX2,
+    PLUGIN_ISA_AVX512,              // AVX-512 F and BW
+    PLUGIN_ISA_COUNT
+};
+
+#ifdef PLUGIN_CPU_X86
+// EAX, EBX, ECX and EDX of CPUID leaf and subleaf
+inline void PluginCpu_CpuId(UINT uLeaf, UINT uSubLeaf, UINT auRegs[4])
+{
+#ifdef _MSC_VER
+    int anRegs[4];
+    __cpuidex(anRegs, int(uLeaf), int(uSubLeaf));
+    for (int i = 0; i < 4; ++i)
+    {
+        auRegs[i] = UINT(anRegs[i]);
+    }
+#else
+    auRegs[0] = auRegs[1] = auRegs[2] = auRegs[3] = 0;
+    __cpuid_count(uLeaf, uSubLeaf, auRegs[0], auRegs[1], auRegs[2], auRegs[3]);
+#endif
+}
+
+// The register states that the OS saves, by XGETBV
+inline ULONGLONG PluginCpu_GetXcr0(void)
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    UINT uEax, uEdx;
+    __asm__ __volatile__("xgetbv" : "=a"(uEax), "=d"(uEdx) : "c"(0));
+    return (ULONGLONG(uEdx) << 32) | uEax;
+#endif
+}
+#endif  // def PLUGIN_CPU_X86
+
+// The best level that the CPU and the OS support.
+inline PLUGIN_ISA PluginCpu_Detect(void)
+{
+#ifdef PLUGIN_CPU_X86
+    UINT auRegs[4];
+    PluginCpu_CpuId(0, 0, auRegs);
+    const UINT uMaxLeaf = auRegs[0];
+
+    PluginCpu_CpuId(1, 0, auRegs);
+    if (!(auRegs[3] & (1 << 26)))                       // SSE2
+        return PLUGIN_ISA_GENERIC;
+
+    // the OS must save the YMM (and the ZMM) registers
+    const UINT uOSXSaveAVX = (1 << 27) | (1 << 28);     // OSXSAVE, AVX
+    if ((auRegs[2] & uOSXSaveAVX) != uOSXSaveAVX || uMaxLeaf < 7)
+        return PLUGIN_ISA_SSE2;
+    const ULONGLONG ullXcr0 = PluginCpu_GetXcr0();
+    if ((ullXcr0 & 0x06) != 0x06)                       // XMM, YMM
+        return PLUGIN_ISA_SSE2;
+
+    PluginCpu_CpuId(7, 0, auRegs);
+    if (!(auRegs[1] & (1 << 5)))                        // AVX2
+        return PLUGIN_ISA_SSE2;
+
+    const UINT uAVX512 = (1 << 16) | (1U << 30);        // AVX512F, AVX512BW
+    if ((auRegs[1] & uAVX512) != uAVX512 || (ullXcr0 & 0xE6) != 0xE6)
+        return PLUGIN_ISA_AVX2;
+    return PLUGIN_ISA_AVX512;
+#else
+    return PLUGIN_ISA_GENERIC;
+#endif
+}
+
+// The level for the setting "Isa".  A level that the CPU doesn't have is
+// never chosen.
+inline PLUGIN_ISA PluginCpu_Select(INT nIsa)
+{
+    static const PLUGIN_ISA s_isaDetected = PluginCpu_Detect();
+    if (nIsa <= PLUGIN_ISA_AUTO || nIsa >= s_isaDetected)
+        return s_isaDetected;
+    return PLUGIN_ISA(nIsa);
+}
+
+inline const char *PluginCpu_GetName(PLUGIN_ISA isa)
+{
+    static const char *const s_apszNames[PLUGIN_ISA_COUNT] =
+    {
+        "auto", "generic", "sse2", "avx2", "avx512"
+    };
+    if (isa < 0 || isa >= PLUGIN_ISA_COUNT)
+        return "?";
+    return s_apszNames[isa];
+}
+
+#endif  // ndef PLUGIN_CPU_H_
@@ -0,0 +1,417 @@
+// PluginPort.h --- PluginFramework portable Windows types
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#ifndef PLUGIN_PORT_H_
+#define PLUGIN_PORT_H_
+
+// NOTE: Plugin.h includes it.  On Windows it is <windows.h>.  Elsewhere it
+//       defines the few Windows types and functions that Plugin.h, the host
+//       and the frame paths of the plugins use, so that the plugins can be
+//       built and run without a window system, e.g. to run a chain on Linux
+//       with synthetic frames.
+//
+//       There MRegKey keeps the settings in a map of the module, guarded by
+//       a mutex.  If the environment variable PLUGIN_PORT_SETTINGS names a
+//       file, the map is loaded from it on first use and the file is
+//       rewritten on each change.  A line of the file is the path of a
+//       value and the value, e.g.
+//           Software\Katayama Hirofumi MZ\Rotation_yap\Rotation=1
+
+#ifdef _WIN32
+    #ifndef _INC_WINDOWS
+        #include <windows.h>
+    #endif
+#else
+    #define _INC_WINDOWS
+
+    #include <stdint.h>
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <stdarg.h>
+    #include <string.h>
+    #include <strings.h>
+    #include <time.h>
+    #include <string>
+    #include <map>
+    #include <mutex>
+
+    typedef int BOOL;
+    typedef int INT;
+    typedef unsigned int UINT;
+    typedef uint16_t WORD;
+    typedef uint32_t DWORD;
+    typedef int32_t LONG;
+    typedef long long LONGLONG;
+    typedef unsigned long long ULONGLONG;
+    typedef LONG HRESULT;
+    typedef uintptr_t WPARAM;
+    typedef intptr_t LPARAM;
+    typedef intptr_t LRESULT;
+    typedef struct HWND__ *HWND;
+    typedef struct HINSTANCE__ *HINSTANCE;
+    typedef HINSTANCE HMODULE;
+    typedef struct HKEY__ *HKEY;
+    typedef char CHAR;
+    typedef CHAR *LPSTR;
+    typedef const CHAR *LPCSTR;
+    typedef char TCHAR;
+    typedef TCHAR *LPTSTR;
+    typedef const TCHAR *LPCTSTR;
+
+    #define TRUE 1
+    #define FALSE 0
+    #define TEXT(x) x
+    #define MAX_PATH 260
+    #define APIENTRY
+    #define WINAPI
+    #define S_OK 0
+    #define ERROR_SUCCESS 0
+    #define ERROR_FILE_NOT_FOUND 2
+    #define CW_USEDEFAULT ((INT)0x80000000)
+    #define HKEY_CURRENT_USER ((HKEY)(uintptr_t)0x80000001)
+
+    #ifndef ARRAYSIZE
+        #define ARRAYSIZE(array) (sizeof(array) / sizeof((array)[0]))
+    #endif
+    #ifndef _countof
+        #define _countof ARRAYSIZE
+    #endif
+
+    #ifdef __GNUC__
+        #define PLUGIN_PORT_PRINTF(ifmt) __attribute__((format(printf, ifmt, ifmt + 1)))
+    #else
+        #define PLUGIN_PORT_PRINTF(ifmt)
+    #endif
+
+    typedef struct tagRECT
+    {
+        LONG left;
+        LONG top;
+        LONG right;
+        LONG bottom;
+    } RECT;
+
+    typedef struct _SYSTEMTIME
+    {
+        WORD wYear;
+        WORD wMonth;
+        WORD wDayOfWeek;
+        WORD wDay;
+        WORD wHour;
+        WORD wMinute;
+        WORD wSecond;
+        WORD wMilliseconds;
+    } SYSTEMTIME;
+
+    // 100-nanosecond intervals since January 1, 1601 (UTC)
+    typedef struct _FILETIME
+    {
+        DWORD dwLowDateTime;
+        DWORD dwHighDateTime;
+    } FILETIME;
+
+    typedef union _ULARGE_INTEGER
+    {
+        struct
+        {
+            DWORD LowPart;
+            DWORD HighPart;
+        };
+        ULONGLONG QuadPart;
+    } ULARGE_INTEGER;
+
+    #define PLUGIN_PORT_EPOCH_DIFF 116444736000000000ULL    // 1601 to 1970
+
+    inline int lstrcmpi(LPCTSTR psz1, LPCTSTR psz2)
+    {
+        return strcasecmp(psz1, psz2);
+    }
+
+    inline HRESULT StringCchCopy(LPTSTR pszDest, size_t cchDest, LPCTSTR pszSrc)
+    {
+        if (cchDest == 0)
+            return -1;
+        size_t cch = strlen(pszSrc);
+        if (cch >= cchDest)
+            cch = cchDest - 1;
+        memcpy(pszDest, pszSrc, cch);
+        pszDest[cch] = 0;
+        return S_OK;
+    }
+
+    inline HRESULT StringCbCopy(LPTSTR pszDest, size_t cbDest, LPCTSTR pszSrc)
+    {
+        return StringCchCopy(pszDest, cbDest / sizeof(TCHAR), pszSrc);
+    }
+
+    inline HRESULT StringCbCopyA(LPSTR pszDest, size_t cbDest, LPCSTR pszSrc)
+    {
+        return StringCchCopy(pszDest, cbDest, pszSrc);
+    }
+
+    inline HRESULT PLUGIN_PORT_PRINTF(3)
+    StringCchPrintf(LPTSTR pszDest, size_t cchDest, LPCTSTR pszFormat, ...)
+    {
+        va_list va;
+        va_start(va, pszFormat);
+        int n = vsnprintf(pszDest, cchDest, pszFormat, va);
+        va_end(va);
+        return (n < 0 || size_t(n) >= cchDest) ? -1 : S_OK;
+    }
+
+    inline HRESULT PLUGIN_PORT_PRINTF(3)
+    StringCbPrintfA(LPSTR pszDest, size_t cbDest, LPCSTR pszFormat, ...)
+    {
+        va_list va;
+        va_start(va, pszFormat);
+        int n = vsnprintf(pszDest, cbDest, pszFormat, va);
+        va_end(va);
+        return (n < 0 || size_t(n) >= cbDest) ? -1 : S_OK;
+    }
+
+    inline BOOL SetRect(RECT *prc, int left, int top, int right, int bottom)
+    {
+        prc->left = left;
+        prc->top = top;
+        prc->right = right;
+        prc->bottom = bottom;
+        return TRUE;
+    }
+
+    // No windows without a window system.
+    inline BOOL IsWindow(HWND hwnd)
+    {
+        (void)hwnd;
+        return FALSE;
+    }
+
+    inline BOOL DestroyWindow(HWND hwnd)
+    {
+        (void)hwnd;
+        return FALSE;
+    }
+
+    inline void DoPortTimeToSystemTime(const struct tm& tm, DWORD dwMilliseconds,
+                                       SYSTEMTIME *pst)
+    {
+        pst->wYear = WORD(tm.tm_year + 1900);
+        pst->wMonth = WORD(tm.tm_mon + 1);
+        pst->wDayOfWeek = WORD(tm.tm_wday);
+        pst->wDay = WORD(tm.tm_mday);
+        pst->wHour = WORD(tm.tm_hour);
+        pst->wMinute = WORD(tm.tm_min);
+        pst->wSecond = WORD(tm.tm_sec);
+        pst->wMilliseconds = WORD(dwMilliseconds);
+    }
+
+    inline void GetLocalTime(SYSTEMTIME *pst)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        struct tm tm;
+        localtime_r(&ts.tv_sec, &tm);
+        DoPortTimeToSystemTime(tm, DWORD(ts.tv_nsec / 1000000), pst);
+    }
+
+    inline BOOL FileTimeToLocalFileTime(const FILETIME *pft, FILETIME *pftLocal)
+    {
+        ULARGE_INTEGER uli;
+        uli.LowPart = pft->dwLowDateTime;
+        uli.HighPart = pft->dwHighDateTime;
+        if (uli.QuadPart < PLUGIN_PORT_EPOCH_DIFF)
+            return FALSE;
+
+        time_t t = time_t((uli.QuadPart - PLUGIN_PORT_EPOCH_DIFF) / 10000000);
+        struct tm tm;
+        if (!localtime_r(&t, &tm))
+            return FALSE;
+
+        uli.QuadPart += LONGLONG(tm.tm_gmtoff) * 10000000;
+        pftLocal->dwLowDateTime = uli.LowPart;
+        pftLocal->dwHighDateTime = uli.HighPart;
+        return TRUE;
+    }
+
+    inline BOOL FileTimeToSystemTime(const FILETIME *pft, SYSTEMTIME *pst)
+    {
+        ULARGE_INTEGER uli;
+        uli.LowPart = pft->dwLowDateTime;
+        uli.HighPart = pft->dwHighDateTime;
+        if (uli.QuadPart < PLUGIN_PORT_EPOCH_DIFF)
+            return FALSE;
+
+        ULONGLONG ullUnix = uli.QuadPart - PLUGIN_PORT_EPOCH_DIFF;
+        time_t t = time_t(ullUnix / 10000000);
+        struct tm tm;
+        if (!gmtime_r(&t, &tm))
+            return FALSE;
+
+        DoPortTimeToSystemTime(tm, DWORD(ullUnix % 10000000 / 10000), pst);
+        return TRUE;
+    }
+
+    typedef std::map<std::string, std::string> PLUGIN_PORT_VALUES;
+
+    struct PLUGIN_PORT_SETTINGS
+    {
+        std::mutex mutex;               // guards the members below
+        bool bLoaded;
+        std::string strFile;            // or empty
+        PLUGIN_PORT_VALUES values;      // by the path of a value
+
+        PLUGIN_PORT_SETTINGS() : bLoaded(false)
+        {
+        }
+    };
+
+    inline PLUGIN_PORT_SETTINGS& PluginPort_Settings()
+    {
+        static PLUGIN_PORT_SETTINGS s_settings;
+        return s_settings;
+    }
+
+    // Call it with the mutex held.
+    inline void DoPortLoadSettings(PLUGIN_PORT_SETTINGS& settings)
+    {
+        if (settings.bLoaded)
+            return;
+        settings.bLoaded = true;
+
+        const char *pszFile = getenv("PLUGIN_PORT_SETTINGS");
+        if (!pszFile || !*pszFile)
+            return;
+        settings.strFile = pszFile;
+
+        FILE *fp = fopen(pszFile, "r");
+        if (!fp)
+            return;
+
+        std::string strLine;
+        for (int ch = fgetc(fp); ch != EOF; ch = fgetc(fp))
+        {
+            if (ch != '\n')
+            {
+                strLine += char(ch);
+                continue;
+            }
+            size_t ich = strLine.find('=');
+            if (ich != std::string::npos)
+                settings.values[strLine.substr(0, ich)] = strLine.substr(ich + 1);
+            strLine.clear();
+        }
+        fclose(fp);
+    }
+
+    // Call it with the mutex held.
+    inline LONG DoPortSaveSettings(const PLUGIN_PORT_SETTINGS& settings)
+    {
+        if (settings.strFile.empty())
+            return ERROR_SUCCESS;
+
+        std::string strTemp = settings.strFile + ".tmp";
+        FILE *fp = fopen(strTemp.c_str(), "w");
+        if (!fp)
+            return ERROR_FILE_NOT_FOUND;
+
+        PLUGIN_PORT_VALUES::const_iterator it;
+        for (it = settings.values.begin(); it != settings.values.end(); ++it)
+        {
+            fprintf(fp, "%s=%s\n", it->first.c_str(), it->second.c_str());
+        }
+        if (fclose(fp) != 0 || rename(strTemp.c_str(), settings.strFile.c_str()) != 0)
+        {
+            remove(strTemp.c_str());
+            return ERROR_FILE_NOT_FOUND;
+        }
+        return ERROR_SUCCESS;
+    }
+
+    // The few members of MRegKey that the plugins use, on the map above.
+    class MRegKey
+    {
+    public:
+        MRegKey(HKEY hBaseKey, LPCTSTR pszSubKey, BOOL bCreate = FALSE)
+            : m_strPath(pszSubKey)
+        {
+            (void)hBaseKey;
+            (void)bCreate;
+        }
+
+        MRegKey(MRegKey& key, LPCTSTR pszSubKey, BOOL bCreate = FALSE)
+            : m_strPath(key.m_strPath + "\\" + pszSubKey)
+        {
+            (void)bCreate;
+        }
+
+        bool operator!() const
+        {
+            return false;
+        }
+
+        LONG QueryDword(LPCTSTR pszValueName, DWORD& dw)
+        {
+            std::string strValue;
+            if (!DoQuery(pszValueName, strValue) || strValue.empty())
+                return ERROR_FILE_NOT_FOUND;
+            dw = DWORD(strtoul(strValue.c_str(), NULL, 0));
+            return ERROR_SUCCESS;
+        }
+
+        LONG QuerySz(LPCTSTR pszValueName, LPTSTR pszValue, DWORD cchValue)
+        {
+            std::string strValue;
+            if (!DoQuery(pszValueName, strValue))
+                return ERROR_FILE_NOT_FOUND;
+            StringCchCopy(pszValue, cchValue, strValue.c_str());
+            return ERROR_SUCCESS;
+        }
+
+        LONG SetDword(LPCTSTR pszValueName, DWORD dw)
+        {
+            char sz[16];
+            StringCchPrintf(sz, ARRAYSIZE(sz), "%u", (unsigned int)dw);
+            return SetSz(pszValueName, sz);
+        }
+
+        // A line break would split the line of the file, so it is a space.
+        LONG SetSz(LPCTSTR pszValueName, LPCTSTR pszValue)
+        {
+            std::string strValue = pszValue;
+            for (size_t i = 0; i < strValue.size(); ++i)
+            {
+                if (strValue[i] == '\n' || strValue[i] == '\r')
+                    strValue[i] = ' ';
+            }
+
+            PLUGIN_PORT_SETTINGS& settings = PluginPort_Settings();
+            std::lock_guard<std::mutex> lock(settings.mutex);
+            DoPortLoadSettings(settings);
+            settings.values[DoGetPath(pszValueName)] = strValue;
+            return DoPortSaveSettings(settings);
+        }
+
+    protected:
+        std::string m_strPath;
+
+        std::string DoGetPath(LPCTSTR pszValueName) const
+        {
+            return m_strPath + "\\" + pszValueName;
+        }
+
+        bool DoQuery(LPCTSTR pszValueName, std::string& strValue) const
+        {
+            PLUGIN_PORT_SETTINGS& settings = PluginPort_Settings();
+            std::lock_guard<std::mutex> lock(settings.mutex);
+            DoPortLoadSettings(settings);
+
+            PLUGIN_PORT_VALUES::const_iterator it =
+                settings.values.find(DoGetPath(pszValueName));
+            if (it == settings.values.end())
+                return false;
+            strValue = it->second;
+            return true;
+        }
+    };
+#endif  // ndef _WIN32
+
+#endif  // ndef PLUGIN_PORT_H_
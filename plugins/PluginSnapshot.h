@@ -0,0 +1,154 @@
+// PluginSnapshot.h --- PluginFramework settings snapshots
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#ifndef PLUGIN_SNAPSHOT_H_
+#define PLUGIN_SNAPSHOT_H_
+
+// NOTE: The settings that the frame path reads are kept in an immutable
+//       snapshot.  The dialog publishes a new snapshot by an atomic pointer
+//       swap, and the frame path pins the current snapshot for a frame
+//       without taking a lock.  A replaced snapshot is deleted by a later
+//       Publish once no reader has it pinned (hazard pointers).
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <thread>
+
+#ifndef PLUGIN_SNAPSHOT_READERS
+    #define PLUGIN_SNAPSHOT_READERS 16  // how many pins can exist at once
+#endif
+
+template <typename T_SETTINGS>
+class PluginSnapshot
+{
+public:
+    PluginSnapshot() : m_pCurrent(new T_SETTINGS())
+    {
+        for (int i = 0; i < PLUGIN_SNAPSHOT_READERS; ++i)
+        {
+            m_hazards[i] = NULL;
+            m_busy[i] = false;
+        }
+    }
+
+    ~PluginSnapshot()
+    {
+        delete m_pCurrent.load();
+        for (size_t i = 0; i < m_retired.size(); ++i)
+        {
+            delete m_retired[i];
+        }
+    }
+
+    // Makes a copy of settings the current snapshot.  It never waits for the
+    // readers.
+    void Publish(const T_SETTINGS& settings)
+    {
+        T_SETTINGS *pNew = new T_SETTINGS(settings);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_retired.push_back(m_pCurrent.exchange(pNew));
+        DoReclaim();
+    }
+
+    // Pins the current snapshot during the lifetime of the pin.
+    class Pin
+    {
+    public:
+        explicit Pin(PluginSnapshot& snapshot) : m_snapshot(snapshot)
+        {
+            m_iSlot = snapshot.DoClaimSlot();
+            m_p = snapshot.DoProtect(m_iSlot);
+        }
+
+        ~Pin()
+        {
+            m_snapshot.m_hazards[m_iSlot].store(NULL);
+            m_snapshot.m_busy[m_iSlot].store(false, std::memory_order_release);
+        }
+
+        const T_SETTINGS *operator->() const
+        {
+            return m_p;
+        }
+
+        const T_SETTINGS& operator*() const
+        {
+            return *m_p;
+        }
+
+    private:
+        PluginSnapshot& m_snapshot;
+        int m_iSlot;
+        const T_SETTINGS *m_p;
+
+        Pin(const Pin&);
+        Pin& operator=(const Pin&);
+    };
+
+private:
+    std::atomic<T_SETTINGS *> m_pCurrent;
+    std::atomic<const T_SETTINGS *> m_hazards[PLUGIN_SNAPSHOT_READERS];
+    std::atomic<bool> m_busy[PLUGIN_SNAPSHOT_READERS];
+    std::mutex m_mutex;                 // guards m_retired
+    std::vector<T_SETTINGS *> m_retired;
+
+    int DoClaimSlot()
+    {
+        for (;;)
+        {
+            for (int i = 0; i < PLUGIN_SNAPSHOT_READERS; ++i)
+            {
+                if (!m_busy[i].load(std::memory_order_relaxed) &&
+                    !m_busy[i].exchange(true, std::memory_order_acquire))
+                {
+                    return i;
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    // The snapshot is safe once it is still current after being marked.
+    const T_SETTINGS *DoProtect(int iSlot)
+    {
+        const T_SETTINGS *p = m_pCurrent.load();
+        for (;;)
+        {
+            m_hazards[iSlot].store(p);
+            const T_SETTINGS *pCurrent = m_pCurrent.load();
+            if (p == pCurrent)
+                return p;
+            p = pCurrent;
+        }
+    }
+
+    bool DoIsPinned(const T_SETTINGS *p) const
+    {
+        for (int i = 0; i < PLUGIN_SNAPSHOT_READERS; ++i)
+        {
+            if (m_hazards[i].load() == p)
+                return true;
+        }
+        return false;
+    }
+
+    void DoReclaim()
+    {
+        size_t k = 0;
+        for (size_t i = 0; i < m_retired.size(); ++i)
+        {
+            if (DoIsPinned(m_retired[i]))
+                m_retired[k++] = m_retired[i];
+            else
+                delete m_retired[i];
+        }
+        m_retired.resize(k);
+    }
+
+    PluginSnapshot(const PluginSnapshot&);
+    PluginSnapshot& operator=(const PluginSnapshot&);
+};
+
+#endif  // ndef PLUGIN_SNAPSHOT_H_
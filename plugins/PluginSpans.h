@@ -0,0 +1,363 @@
+// PluginSpans.h --- PluginFramework timeline of spans
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#ifndef PLUGIN_SPANS_H_
+#define PLUGIN_SPANS_H_
+
+// NOTE: The host owns a PluginSpanRecorder.  A span is a named interval on
+//       a thread; the host records one for each call of Plugin_Act, and a
+//       plugin may record its own phases with PluginSpan, which hands them
+//       to the host by PLUGIN_DRIVER_RECORD_SPAN.  Each thread appends to a
+//       buffer of its own without locking, and Export writes the spans as
+//       the JSON of Chrome trace events (chrome://tracing or Perfetto).
+//
+//       The names must be string literals, or live until Export.  Call
+//       Begin and End when no frame is being processed, so that a plugin
+//       may ask once per action whether the host records spans.
+
+#include "Plugin.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <functional>
+#include <cstdio>
+
+// The same clock in every module.
+inline LONGLONG PluginSpans_Now()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(
+        steady_clock::now().time_since_epoch()).count();
+}
+
+#ifndef PLUGIN_SPAN_CHUNK
+    #define PLUGIN_SPAN_CHUNK 4096      // spans per chunk of a buffer
+#endif
+#ifndef PLUGIN_SPAN_MAX_CHUNKS
+    #define PLUGIN_SPAN_MAX_CHUNKS 256  // chunks per thread
+#endif
+
+struct PLUGIN_SPAN
+{
+    const char *pszName;
+    const char *pszCat;
+    LONGLONG llBegin;               // nanoseconds
+    LONGLONG llEnd;
+    LONGLONG llFrame;               // the frame index, or -1
+};
+
+// The spans of a thread.  Only the thread appends.
+struct PLUGIN_SPAN_BUFFER
+{
+    DWORD dwThreadID;
+    std::atomic<UINT> nCount;
+    std::atomic<UINT> nDropped;
+    std::atomic<PLUGIN_SPAN *> chunks[PLUGIN_SPAN_MAX_CHUNKS];
+
+    explicit PLUGIN_SPAN_BUFFER(DWORD dwThreadID_)
+        : dwThreadID(dwThreadID_), nCount(0), nDropped(0)
+    {
+        for (int i = 0; i < PLUGIN_SPAN_MAX_CHUNKS; ++i)
+        {
+            chunks[i].store(NULL, std::memory_order_relaxed);
+        }
+    }
+
+    ~PLUGIN_SPAN_BUFFER()
+    {
+        for (int i = 0; i < PLUGIN_SPAN_MAX_CHUNKS; ++i)
+        {
+            delete[] chunks[i].load(std::memory_order_relaxed);
+        }
+    }
+};
+
+class PluginSpanRecorder
+{
+public:
+    PluginSpanRecorder() : m_bEnabled(false), m_nSession(0), m_llStart(0)
+    {
+    }
+
+    ~PluginSpanRecorder()
+    {
+        DoFreeBuffers();
+    }
+
+    static LONGLONG Now()
+    {
+        return PluginSpans_Now();
+    }
+
+    // The same ID in every module, for the spans of a thread to nest.
+    static DWORD GetThreadID()
+    {
+#ifdef _WIN32
+        return GetCurrentThreadId();
+#else
+        return DWORD(std::hash<std::thread::id>()(std::this_thread::get_id()));
+#endif
+    }
+
+    bool IsEnabled() const
+    {
+        return m_bEnabled.load(std::memory_order_relaxed);
+    }
+
+    // Forgets the spans and starts recording.
+    void Begin()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        DoFreeBuffers();
+        m_nSession = DoNewSession();
+        m_llStart = Now();
+        m_bEnabled = true;
+    }
+
+    void End()
+    {
+        m_bEnabled = false;
+    }
+
+    void Record(const char *pszName, const char *pszCat, LONGLONG llBegin,
+                LONGLONG llEnd, LONGLONG llFrame = -1)
+    {
+        if (!IsEnabled())
+            return;
+
+        PLUGIN_SPAN_BUFFER *pBuffer = DoGetBuffer();
+        const UINT i = pBuffer->nCount.load(std::memory_order_relaxed);
+        const UINT iChunk = i / PLUGIN_SPAN_CHUNK;
+        if (iChunk >= PLUGIN_SPAN_MAX_CHUNKS)
+        {
+            pBuffer->nDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        PLUGIN_SPAN *pChunk = pBuffer->chunks[iChunk].load(std::memory_order_relaxed);
+        if (!pChunk)
+        {
+            pChunk = new PLUGIN_SPAN[PLUGIN_SPAN_CHUNK];
+            pBuffer->chunks[iChunk].store(pChunk, std::memory_order_release);
+        }
+
+        PLUGIN_SPAN& span = pChunk[i % PLUGIN_SPAN_CHUNK];
+        span.pszName = pszName;
+        span.pszCat = pszCat;
+        span.llBegin = llBegin;
+        span.llEnd = llEnd;
+        span.llFrame = llFrame;
+        pBuffer->nCount.store(i + 1, std::memory_order_release);
+    }
+
+    // Writes the spans of the session as Chrome trace events.
+    void Export(FILE *fp)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        fprintf(fp, "{\"traceEvents\":[\n");
+        const char *pszSep = "";
+        UINT nDropped = 0;
+        for (size_t k = 0; k < m_buffers.size(); ++k)
+        {
+            PLUGIN_SPAN_BUFFER *pBuffer = m_buffers[k];
+            const UINT nCount = pBuffer->nCount.load(std::memory_order_acquire);
+            for (UINT i = 0; i < nCount; ++i)
+            {
+                PLUGIN_SPAN *pChunk = pBuffer->chunks[i / PLUGIN_SPAN_CHUNK].load(
+                    std::memory_order_acquire);
+                const PLUGIN_SPAN& span = pChunk[i % PLUGIN_SPAN_CHUNK];
+
+                fprintf(fp, "%s{\"name\":\"", pszSep);
+                DoWriteString(fp, span.pszName);
+                fprintf(fp, "\",\"cat\":\"");
+                DoWriteString(fp, span.pszCat);
+                fprintf(fp, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,"
+                            "\"ts\":%.3f,\"dur\":%.3f",
+                        (unsigned long)pBuffer->dwThreadID,
+                        (span.llBegin - m_llStart) / 1000.0,
+                        (span.llEnd - span.llBegin) / 1000.0);
+                if (span.llFrame >= 0)
+                    fprintf(fp, ",\"args\":{\"frame\":%lld}", span.llFrame);
+                fprintf(fp, "}");
+                pszSep = ",\n";
+            }
+            nDropped += pBuffer->nDropped.load(std::memory_order_relaxed);
+        }
+        fprintf(fp, "\n],\"displayTimeUnit\":\"ms\","
+                    "\"otherData\":{\"dropped\":%u}}\n", nDropped);
+        fflush(fp);
+    }
+
+protected:
+    std::atomic<bool> m_bEnabled;
+    std::atomic<UINT> m_nSession;
+    LONGLONG m_llStart;
+    std::mutex m_mutex;                 // guards m_buffers
+    std::vector<PLUGIN_SPAN_BUFFER *> m_buffers;
+
+    // Unique in the process, for the cache of DoGetBuffer not to match a
+    // recorder that was freed at the same address.
+    static UINT DoNewSession()
+    {
+        static std::atomic<UINT> s_nSessions(0);
+        return ++s_nSessions;
+    }
+
+    void DoFreeBuffers()
+    {
+        for (size_t i = 0; i < m_buffers.size(); ++i)
+        {
+            delete m_buffers[i];
+        }
+        m_buffers.clear();
+    }
+
+    // Returns the buffer of the calling thread in this session.
+    PLUGIN_SPAN_BUFFER *DoGetBuffer()
+    {
+        static thread_local PluginSpanRecorder *t_pRecorder = NULL;
+        static thread_local UINT t_nSession = 0;
+        static thread_local PLUGIN_SPAN_BUFFER *t_pBuffer = NULL;
+
+        const UINT nSession = m_nSession.load(std::memory_order_acquire);
+        if (t_pRecorder == this && t_nSession == nSession)
+            return t_pBuffer;
+
+        const DWORD dwThreadID = GetThreadID();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        PLUGIN_SPAN_BUFFER *pBuffer = NULL;
+        for (size_t i = 0; i < m_buffers.size(); ++i)
+        {
+            if (m_buffers[i]->dwThreadID == dwThreadID)
+            {
+                pBuffer = m_buffers[i];
+                break;
+            }
+        }
+        if (!pBuffer)
+        {
+            pBuffer = new PLUGIN_SPAN_BUFFER(dwThreadID);
+            m_buffers.push_back(pBuffer);
+        }
+
+        t_pRecorder = this;
+        t_nSession = nSession;
+        t_pBuffer = pBuffer;
+        return pBuffer;
+    }
+
+    static void DoWriteString(FILE *fp, const char *psz)
+    {
+        for (; psz && *psz; ++psz)
+        {
+            if (*psz == '"' || *psz == '\\')
+                fputc('\\', fp);
+            fputc(*psz, fp);
+        }
+    }
+
+private:
+    PluginSpanRecorder(const PluginSpanRecorder&);
+    PluginSpanRecorder& operator=(const PluginSpanRecorder&);
+};
+
+// For the plugins: records a span on the timeline of the host.  Returns
+// FALSE if the host records no spans.  pSpan may be NULL to only ask it.
+inline BOOL PluginSpans_Record(PLUGIN *pi, const PLUGIN_SPAN_RECORD *pSpan)
+{
+    if (!pi || !pi->driver)
+        return FALSE;
+    return (BOOL)pi->driver(pi, PLUGIN_DRIVER_RECORD_SPAN, (WPARAM)pSpan, 0);
+}
+
+// For the plugins: asks the host at the start of an action.  Returns pi if
+// it records spans, or NULL.  The answer holds until the action returns.
+inline PLUGIN *PluginSpans_GetTarget(PLUGIN *pi)
+{
+    return PluginSpans_Record(pi, NULL) ? pi : NULL;
+}
+
+// Records a span for its lifetime, if the recorder is enabled.  The host
+// gives its recorder; a plugin gives the PLUGIN of PluginSpans_GetTarget,
+// for the span to go through the driver.  A NULL costs nothing.
+class PluginSpan
+{
+public:
+    PluginSpan(PluginSpanRecorder *pRecorder, const char *pszName,
+               const char *pszCat, LONGLONG llFrame = -1)
+        : m_pRecorder((pRecorder && pRecorder->IsEnabled()) ? pRecorder : NULL)
+        , m_pi(NULL)
+        , m_pszName(pszName)
+        , m_pszCat(pszCat)
+        , m_llFrame(llFrame)
+        , m_llBegin(m_pRecorder ? PluginSpans_Now() : 0)
+    {
+    }
+
+    PluginSpan(PLUGIN *pi, const char *pszName, const char *pszCat,
+               LONGLONG llFrame = -1)
+        : m_pRecorder(NULL)
+        , m_pi(pi)
+        , m_pszName(pszName)
+        , m_pszCat(pszCat)
+        , m_llFrame(llFrame)
+        , m_llBegin(m_pi ? PluginSpans_Now() : 0)
+    {
+    }
+
+    ~PluginSpan()
+    {
+        if (m_pRecorder)
+        {
+            m_pRecorder->Record(m_pszName, m_pszCat, m_llBegin,
+                                PluginSpans_Now(), m_llFrame);
+        }
+        else if (m_pi)
+        {
+            PLUGIN_SPAN_RECORD span;
+            span.cbSize = sizeof(span);
+            span.pszName = m_pszName;
+            span.pszCat = m_pszCat;
+            span.llBegin = m_llBegin;
+            span.llEnd = PluginSpans_Now();
+            span.llFrame = m_llFrame;
+            PluginSpans_Record(m_pi, &span);
+        }
+    }
+
+protected:
+    PluginSpanRecorder *m_pRecorder;
+    PLUGIN *m_pi;
+    const char *m_pszName;
+    const char *m_pszCat;
+    LONGLONG m_llFrame;
+    LONGLONG m_llBegin;
+
+private:
+    PluginSpan(const PluginSpan&);
+    PluginSpan& operator=(const PluginSpan&);
+};
+
+// For the host: call it in the driver of the plugins.  Returns FALSE if
+// uFunc is not a function of the spans.
+inline BOOL PluginSpans_Driver(PluginSpanRecorder& recorder, UINT uFunc,
+                               WPARAM wParam, LRESULT& result)
+{
+    if (uFunc != PLUGIN_DRIVER_RECORD_SPAN)
+        return FALSE;
+
+    result = recorder.IsEnabled();
+    const PLUGIN_SPAN_RECORD *pSpan = (const PLUGIN_SPAN_RECORD *)wParam;
+    if (result && pSpan && pSpan->cbSize >= sizeof(PLUGIN_SPAN_RECORD))
+    {
+        recorder.Record(pSpan->pszName, pSpan->pszCat, pSpan->llBegin,
+                        pSpan->llEnd, pSpan->llFrame);
+    }
+    return TRUE;
+}
+
+#endif  // ndef PLUGIN_SPANS_H_
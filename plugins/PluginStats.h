@@ -0,0 +1,454 @@
+// PluginStats.h --- PluginFramework timing histograms and counters
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#ifndef PLUGIN_STATS_H_
+#define PLUGIN_STATS_H_
+
+// NOTE: The host keeps a PluginStats for each plugin.  It times every call
+//       of Plugin_Act into a histogram of the action, and answers
+//       PLUGIN_DRIVER_GET_ACT_STATS.  A plugin adds its own counters by
+//       PLUGIN_DRIVER_ADD_COUNTER and changes them without calling the host.
+//
+//       A histogram has PLUGIN_HIST_SUB buckets for each power of two of
+//       nanoseconds, so that a percentile is within 1/PLUGIN_HIST_SUB of the
+//       true value.  Recording is a few relaxed atomic additions.
+
+#include "Plugin.h"
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#define PLUGIN_HIST_SUB_BITS 4
+#define PLUGIN_HIST_SUB (1 << PLUGIN_HIST_SUB_BITS)
+#define PLUGIN_HIST_MAX_BITS 40         // about 18 minutes
+#define PLUGIN_HIST_BUCKETS ((PLUGIN_HIST_MAX_BITS - PLUGIN_HIST_SUB_BITS + 1) * PLUGIN_HIST_SUB)
+
+#ifndef PLUGIN_STATS_ACTIONS
+    #define PLUGIN_STATS_ACTIONS 16     // the actions 0 to 15 are timed
+#endif
+#ifndef PLUGIN_STATS_MAX_COUNTERS
+    #define PLUGIN_STATS_MAX_COUNTERS 32
+#endif
+
+// A counter of a plugin.  The plugin changes it and the host reads it at
+// the same time, so every access is a relaxed atomic operation.
+typedef std::atomic<LONGLONG> PluginCounter;
+
+class PluginHistogram
+{
+public:
+    PluginHistogram()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        for (int i = 0; i < PLUGIN_HIST_BUCKETS; ++i)
+        {
+            m_counts[i].store(0, std::memory_order_relaxed);
+        }
+        m_ullCount.store(0, std::memory_order_relaxed);
+        m_ullTotal.store(0, std::memory_order_relaxed);
+        m_ullMax.store(0, std::memory_order_relaxed);
+    }
+
+    void Record(ULONGLONG ullNanos)
+    {
+        m_counts[GetBucket(ullNanos)].fetch_add(1, std::memory_order_relaxed);
+        m_ullCount.fetch_add(1, std::memory_order_relaxed);
+        m_ullTotal.fetch_add(ullNanos, std::memory_order_relaxed);
+
+        ULONGLONG ullMax = m_ullMax.load(std::memory_order_relaxed);
+        while (ullMax < ullNanos &&
+               !m_ullMax.compare_exchange_weak(ullMax, ullNanos,
+                                               std::memory_order_relaxed))
+        {
+        }
+    }
+
+    ULONGLONG GetCount() const
+    {
+        return m_ullCount.load(std::memory_order_relaxed);
+    }
+
+    ULONGLONG GetTotal() const
+    {
+        return m_ullTotal.load(std::memory_order_relaxed);
+    }
+
+    ULONGLONG GetMax() const
+    {
+        return m_ullMax.load(std::memory_order_relaxed);
+    }
+
+    // Returns the upper bound of the bucket of the percentile (0 to 100).
+    ULONGLONG GetPercentile(double ePercent) const
+    {
+        ULONGLONG ullCount = 0;
+        for (int i = 0; i < PLUGIN_HIST_BUCKETS; ++i)
+        {
+            ullCount += m_counts[i].load(std::memory_order_relaxed);
+        }
+        if (ullCount == 0)
+            return 0;
+
+        ULONGLONG ullRank = ULONGLONG(ullCount * ePercent / 100.0 + 0.5);
+        if (ullRank < 1)
+            ullRank = 1;
+
+        ULONGLONG ullSeen = 0;
+        for (int i = 0; i < PLUGIN_HIST_BUCKETS; ++i)
+        {
+            ullSeen += m_counts[i].load(std::memory_order_relaxed);
+            if (ullSeen >= ullRank)
+            {
+                ULONGLONG ullUpper = GetUpperBound(i);
+                ULONGLONG ullMax = GetMax();
+                return (ullUpper < ullMax) ? ullUpper : ullMax;
+            }
+        }
+        return GetMax();
+    }
+
+    static int GetBucket(ULONGLONG ullValue)
+    {
+        if (ullValue < PLUGIN_HIST_SUB)
+            return int(ullValue);
+
+        const ULONGLONG ullLimit = (ULONGLONG(1) << PLUGIN_HIST_MAX_BITS) - 1;
+        if (ullValue > ullLimit)
+            ullValue = ullLimit;
+
+        int nBits = 0;
+        while ((ullValue >> nBits) >= 2 * PLUGIN_HIST_SUB)
+            ++nBits;
+        int iSub = int(ullValue >> nBits) - PLUGIN_HIST_SUB;
+        return (nBits + 1) * PLUGIN_HIST_SUB + iSub;
+    }
+
+    static ULONGLONG GetUpperBound(int iBucket)
+    {
+        if (iBucket < PLUGIN_HIST_SUB)
+            return ULONGLONG(iBucket);
+
+        int nBits = iBucket / PLUGIN_HIST_SUB - 1;
+        int iSub = iBucket % PLUGIN_HIST_SUB;
+        return ((ULONGLONG(PLUGIN_HIST_SUB + iSub + 1)) << nBits) - 1;
+    }
+
+protected:
+    std::atomic<UINT> m_counts[PLUGIN_HIST_BUCKETS];
+    std::atomic<ULONGLONG> m_ullCount;
+    std::atomic<ULONGLONG> m_ullTotal;
+    std::atomic<ULONGLONG> m_ullMax;
+
+private:
+    PluginHistogram(const PluginHistogram&);
+    PluginHistogram& operator=(const PluginHistogram&);
+};
+
+class PluginStats
+{
+public:
+    PluginStats() : m_nCounters(0)
+    {
+        ResetActs();
+    }
+
+    // Restarts the timing of the actions, but not the counters.
+    void ResetActs()
+    {
+        for (int i = 0; i < PLUGIN_STATS_ACTIONS; ++i)
+        {
+            m_acts[i].hist.Reset();
+            m_acts[i].ullFrames.store(0, std::memory_order_relaxed);
+            m_acts[i].ullBytes.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void RecordAct(UINT uAction, ULONGLONG ullNanos, ULONGLONG ullFrames,
+                   ULONGLONG ullBytes)
+    {
+        if (uAction >= PLUGIN_STATS_ACTIONS)
+            return;
+
+        ACT& act = m_acts[uAction];
+        act.hist.Record(ullNanos);
+        if (ullFrames)
+        {
+            act.ullFrames.fetch_add(ullFrames, std::memory_order_relaxed);
+            act.ullBytes.fetch_add(ullBytes, std::memory_order_relaxed);
+        }
+    }
+
+    BOOL GetActStats(PLUGIN_ACT_STATS& stats) const
+    {
+        if (stats.cbSize < sizeof(PLUGIN_ACT_STATS) ||
+            stats.uAction >= PLUGIN_STATS_ACTIONS)
+        {
+            return FALSE;
+        }
+
+        const ACT& act = m_acts[stats.uAction];
+        stats.ullCalls = act.hist.GetCount();
+        stats.ullFrames = act.ullFrames.load(std::memory_order_relaxed);
+        stats.ullBytes = act.ullBytes.load(std::memory_order_relaxed);
+        stats.ullTotalNanos = act.hist.GetTotal();
+        stats.ullP50Nanos = act.hist.GetPercentile(50);
+        stats.ullP95Nanos = act.hist.GetPercentile(95);
+        stats.ullP99Nanos = act.hist.GetPercentile(99);
+        stats.ullMaxNanos = act.hist.GetMax();
+        return TRUE;
+    }
+
+    // Returns the counter of the name, adding it if new.  Returns NULL if
+    // there is no room.
+    PluginCounter *AddCounter(const char *pszName)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        UINT nCounters = m_nCounters.load(std::memory_order_relaxed);
+        for (UINT i = 0; i < nCounters; ++i)
+        {
+            if (strcmp(m_counters[i].szName, pszName) == 0)
+                return &m_counters[i].llValue;
+        }
+        if (nCounters >= PLUGIN_STATS_MAX_COUNTERS)
+            return NULL;
+
+        COUNTER& counter = m_counters[nCounters];
+        strncpy(counter.szName, pszName, sizeof(counter.szName) - 1);
+        counter.szName[sizeof(counter.szName) - 1] = 0;
+        counter.llValue.store(0, std::memory_order_relaxed);
+        m_nCounters.store(nCounters + 1, std::memory_order_release);
+        return &counter.llValue;
+    }
+
+    BOOL GetCounter(UINT iCounter, PLUGIN_COUNTER& counter) const
+    {
+        if (counter.cbSize < sizeof(PLUGIN_COUNTER) ||
+            iCounter >= m_nCounters.load(std::memory_order_acquire))
+        {
+            return FALSE;
+        }
+
+        memcpy(counter.szName, m_counters[iCounter].szName,
+               sizeof(counter.szName));
+        counter.llValue = m_counters[iCounter].llValue.load(std::memory_order_relaxed);
+        return TRUE;
+    }
+
+    // Writes the actions that were called and the counters.
+    void Dump(FILE *fp, const char *pszName) const
+    {
+        fprintf(fp, "%s:\n", pszName);
+        for (UINT uAction = 0; uAction < PLUGIN_STATS_ACTIONS; ++uAction)
+        {
+            PLUGIN_ACT_STATS stats;
+            stats.cbSize = sizeof(stats);
+            stats.uAction = uAction;
+            if (!GetActStats(stats) || stats.ullCalls == 0)
+                continue;
+
+            fprintf(fp, "  action %u: %llu calls, p50 %.3f ms, p95 %.3f ms, "
+                        "p99 %.3f ms, max %.3f ms",
+                    uAction, stats.ullCalls, stats.ullP50Nanos / 1e6,
+                    stats.ullP95Nanos / 1e6, stats.ullP99Nanos / 1e6,
+                    stats.ullMaxNanos / 1e6);
+            if (stats.ullFrames)
+            {
+                fprintf(fp, ", %llu frames, %.1f MB", stats.ullFrames,
+                        stats.ullBytes / 1e6);
+            }
+            fprintf(fp, "\n");
+        }
+
+        PLUGIN_COUNTER counter;
+        counter.cbSize = sizeof(counter);
+        for (UINT i = 0; GetCounter(i, counter); ++i)
+        {
+            fprintf(fp, "  %s: %lld\n", counter.szName, counter.llValue);
+        }
+    }
+
+    // Writes the same as a JSON object, one member per line, so that the
+    // dumps of two builds can be diffed.
+    void DumpJson(FILE *fp, const char *pszName) const
+    {
+        fprintf(fp, "{\n  \"name\": \"");
+        DoWriteJsonString(fp, pszName);
+        fprintf(fp, "\",\n  \"actions\": [");
+        const char *pszSep = "\n";
+        for (UINT uAction = 0; uAction < PLUGIN_STATS_ACTIONS; ++uAction)
+        {
+            PLUGIN_ACT_STATS stats;
+            stats.cbSize = sizeof(stats);
+            stats.uAction = uAction;
+            if (!GetActStats(stats) || stats.ullCalls == 0)
+                continue;
+
+            fprintf(fp, "%s    {\"action\": %u, \"calls\": %llu, "
+                        "\"frames\": %llu, \"bytes\": %llu, "
+                        "\"total_ns\": %llu, \"p50_ns\": %llu, "
+                        "\"p95_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu}",
+                    pszSep, uAction, stats.ullCalls, stats.ullFrames,
+                    stats.ullBytes, stats.ullTotalNanos, stats.ullP50Nanos,
+                    stats.ullP95Nanos, stats.ullP99Nanos, stats.ullMaxNanos);
+            pszSep = ",\n";
+        }
+        fprintf(fp, "\n  ],\n  \"counters\": {");
+
+        pszSep = "\n";
+        PLUGIN_COUNTER counter;
+        counter.cbSize = sizeof(counter);
+        for (UINT i = 0; GetCounter(i, counter); ++i)
+        {
+            fprintf(fp, "%s    \"", pszSep);
+            DoWriteJsonString(fp, counter.szName);
+            fprintf(fp, "\": %lld", counter.llValue);
+            pszSep = ",\n";
+        }
+        fprintf(fp, "\n  }\n}");
+    }
+
+protected:
+    struct ACT
+    {
+        PluginHistogram hist;
+        std::atomic<ULONGLONG> ullFrames;
+        std::atomic<ULONGLONG> ullBytes;
+    };
+    struct COUNTER
+    {
+        char szName[32];
+        PluginCounter llValue;          // written by the plugin
+    };
+
+    ACT m_acts[PLUGIN_STATS_ACTIONS];
+    std::mutex m_mutex;                 // guards adding a counter
+    std::atomic<UINT> m_nCounters;
+    COUNTER m_counters[PLUGIN_STATS_MAX_COUNTERS];
+
+    static void DoWriteJsonString(FILE *fp, const char *psz)
+    {
+        for (; psz && *psz; ++psz)
+        {
+            if (*psz == '"' || *psz == '\\')
+                fputc('\\', fp);
+            fputc(*psz, fp);
+        }
+    }
+
+private:
+    PluginStats(const PluginStats&);
+    PluginStats& operator=(const PluginStats&);
+};
+
+// For the host: call it in the driver of the plugins.  Returns FALSE if
+// uFunc is not a function of the statistics.
+inline BOOL PluginStats_Driver(PluginStats& stats, UINT uFunc, WPARAM wParam,
+                               LPARAM lParam, LRESULT& result)
+{
+    switch (uFunc)
+    {
+    case PLUGIN_DRIVER_GET_ACT_STATS:
+        {
+            PLUGIN_ACT_STATS *pStats = (PLUGIN_ACT_STATS *)wParam;
+            result = pStats && stats.GetActStats(*pStats);
+        }
+        return TRUE;
+    case PLUGIN_DRIVER_ADD_COUNTER:
+        {
+            const char *pszName = (const char *)wParam;
+            result = pszName ? (LRESULT)stats.AddCounter(pszName) : 0;
+        }
+        return TRUE;
+    case PLUGIN_DRIVER_GET_COUNTER:
+        {
+            PLUGIN_COUNTER *pCounter = (PLUGIN_COUNTER *)lParam;
+            result = pCounter && stats.GetCounter(UINT(wParam), *pCounter);
+        }
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// For the plugins: returns the counter of the name, or NULL if the host has
+// no counters.
+inline PluginCounter *PluginStats_Counter(PLUGIN *pi, const char *pszName)
+{
+    if (!pi || !pi->driver)
+        return NULL;
+    return (PluginCounter *)pi->driver(pi, PLUGIN_DRIVER_ADD_COUNTER,
+                                       (WPARAM)pszName, 0);
+}
+
+inline void PluginStats_Add(PluginCounter *pCounter, LONGLONG llValue)
+{
+    if (pCounter)
+        pCounter->fetch_add(llValue, std::memory_order_relaxed);
+}
+
+inline void PluginStats_Set(PluginCounter *pCounter, LONGLONG llValue)
+{
+    if (pCounter)
+        pCounter->store(llValue, std::memory_order_relaxed);
+}
+
+// Raises the counter to llValue if it is less.
+inline void PluginStats_Max(PluginCounter *pCounter, LONGLONG llValue)
+{
+    if (!pCounter)
+        return;
+
+    LONGLONG llOld = pCounter->load(std::memory_order_relaxed);
+    while (llOld < llValue &&
+           !pCounter->compare_exchange_weak(llOld, llValue,
+                                            std::memory_order_relaxed))
+    {
+    }
+}
+
+// Adds the nanoseconds of its lifetime to a counter.
+class PluginStatsTimer
+{
+public:
+    explicit PluginStatsTimer(PluginCounter *pCounter)
+        : m_pCounter(pCounter)
+    {
+        if (m_pCounter)
+            m_start = std::chrono::steady_clock::now();
+    }
+
+    ~PluginStatsTimer()
+    {
+        if (m_pCounter)
+        {
+            std::chrono::nanoseconds elapsed =
+                std::chrono::steady_clock::now() - m_start;
+            m_pCounter->fetch_add(elapsed.count(), std::memory_order_relaxed);
+        }
+    }
+
+protected:
+    PluginCounter *m_pCounter;
+    std::chrono::steady_clock::time_point m_start;
+
+private:
+    PluginStatsTimer(const PluginStatsTimer&);
+    PluginStatsTimer& operator=(const PluginStatsTimer&);
+};
+
+// The timers of the phases of a plugin are compiled in only if
+// PLUGIN_PHASES is defined.  Otherwise PLUGIN_PHASE_TIMER expands to nothing
+// and does not evaluate its counter, so that the counters can be left out.
+#ifdef PLUGIN_PHASES
+    #define PLUGIN_PHASE_TIMER(pCounter) PluginStatsTimer phase_timer(pCounter)
+#else
+    #define PLUGIN_PHASE_TIMER(pCounter) ((void)0)
+#endif
+
+#endif  // ndef PLUGIN_STATS_H_
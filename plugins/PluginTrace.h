@@ -0,0 +1,199 @@
+// PluginTrace.h --- PluginFramework lock-free tracing
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#ifndef PLUGIN_TRACE_H_
+#define PLUGIN_TRACE_H_
+
+// NOTE: Tracing is compiled in only if PLUGIN_TRACE is defined.
+//       Otherwise the PLUGIN_TRACE_... macros expand to nothing.
+//
+// Each thread that traces owns a single-producer ring of fixed-size records.
+// Writing a record never blocks; if the ring is full, the record is dropped
+// and counted.  A background thread drains the rings to the console.
+
+#ifdef PLUGIN_TRACE
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <cstdarg>
+
+#ifndef PLUGIN_TRACE_RING_SIZE
+    #define PLUGIN_TRACE_RING_SIZE 256  // must be a power of two
+#endif
+#define PLUGIN_TRACE_TEXT_MAX 120
+
+struct PLUGIN_TRACE_RECORD
+{
+    unsigned int msec;                  // milliseconds since PluginTrace_Init
+    char text[PLUGIN_TRACE_TEXT_MAX];
+};
+
+struct PLUGIN_TRACE_RING
+{
+    std::atomic<unsigned int> head;     // written by the producer
+    std::atomic<unsigned int> tail;     // written by the drainer
+    std::atomic<unsigned int> dropped;
+    PLUGIN_TRACE_RECORD records[PLUGIN_TRACE_RING_SIZE];
+};
+
+struct PLUGIN_TRACE_STATE
+{
+    std::mutex mutex;                   // guards the members below
+    std::vector<PLUGIN_TRACE_RING *> rings;
+    std::thread drainer;
+    int nRefs;
+    std::atomic<bool> quit;
+    std::atomic<unsigned int> generation;
+    std::chrono::steady_clock::time_point start;
+};
+
+inline PLUGIN_TRACE_STATE& PluginTrace_State()
+{
+    static PLUGIN_TRACE_STATE s_state;
+    return s_state;
+}
+
+// Only the drainer calls it.  The mutex is held just to copy the list of
+// the rings, so that a thread registering its ring never waits for the
+// console.  The rings are deleted only after the drainer is joined.
+inline void PluginTrace_DrainAll(std::vector<PLUGIN_TRACE_RING *>& rings)
+{
+    PLUGIN_TRACE_STATE& state = PluginTrace_State();
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        rings.assign(state.rings.begin(), state.rings.end());
+    }
+
+    for (size_t i = 0; i < rings.size(); ++i)
+    {
+        PLUGIN_TRACE_RING *ring = rings[i];
+        unsigned int tail = ring->tail.load(std::memory_order_relaxed);
+        unsigned int head = ring->head.load(std::memory_order_acquire);
+        for (; tail != head; ++tail)
+        {
+            const PLUGIN_TRACE_RECORD& rec =
+                ring->records[tail & (PLUGIN_TRACE_RING_SIZE - 1)];
+            fprintf(stdout, "[%u.%03u] %s\n", rec.msec / 1000, rec.msec % 1000,
+                    rec.text);
+        }
+        ring->tail.store(tail, std::memory_order_release);
+
+        if (unsigned int dropped = ring->dropped.exchange(0))
+            fprintf(stdout, "(%u trace records dropped)\n", dropped);
+    }
+
+    fflush(stdout);
+}
+
+inline void PluginTrace_DrainerProc()
+{
+    PLUGIN_TRACE_STATE& state = PluginTrace_State();
+    std::vector<PLUGIN_TRACE_RING *> rings;
+    while (!state.quit.load())
+    {
+        PluginTrace_DrainAll(rings);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    PluginTrace_DrainAll(rings);
+}
+
+// Call it in Plugin_Load.
+inline void PluginTrace_Init()
+{
+    PLUGIN_TRACE_STATE& state = PluginTrace_State();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    if (state.nRefs++ == 0)
+    {
+        state.start = std::chrono::steady_clock::now();
+        state.quit = false;
+        state.drainer = std::thread(PluginTrace_DrainerProc);
+    }
+}
+
+// Call it in Plugin_Unload, when no frame is being processed.
+inline void PluginTrace_Exit()
+{
+    PLUGIN_TRACE_STATE& state = PluginTrace_State();
+
+    std::thread drainer;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.nRefs == 0 || --state.nRefs > 0)
+            return;
+        state.quit = true;
+        drainer.swap(state.drainer);
+    }
+    drainer.join();
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+    for (size_t i = 0; i < state.rings.size(); ++i)
+    {
+        delete state.rings[i];
+    }
+    state.rings.clear();
+    ++state.generation;
+}
+
+// Returns the ring of the calling thread, registering it on first use.
+inline PLUGIN_TRACE_RING *PluginTrace_GetRing()
+{
+    static thread_local PLUGIN_TRACE_RING *t_ring = NULL;
+    static thread_local unsigned int t_generation = 0;
+
+    PLUGIN_TRACE_STATE& state = PluginTrace_State();
+    if (t_ring && t_generation == state.generation.load(std::memory_order_acquire))
+        return t_ring;
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.nRefs == 0)
+        return NULL;
+
+    t_ring = new PLUGIN_TRACE_RING;
+    t_ring->head = 0;
+    t_ring->tail = 0;
+    t_ring->dropped = 0;
+    state.rings.push_back(t_ring);
+    t_generation = state.generation.load();
+    return t_ring;
+}
+
+inline void PluginTrace_Printf(const char *fmt, ...)
+{
+    PLUGIN_TRACE_RING *ring = PluginTrace_GetRing();
+    if (!ring)
+        return;
+
+    unsigned int head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= PLUGIN_TRACE_RING_SIZE)
+    {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    PLUGIN_TRACE_RECORD& rec = ring->records[head & (PLUGIN_TRACE_RING_SIZE - 1)];
+    rec.msec = (unsigned int)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - PluginTrace_State().start).count();
+
+    va_list va;
+    va_start(va, fmt);
+    vsnprintf(rec.text, sizeof(rec.text), fmt, va);
+    va_end(va);
+
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+    #define PLUGIN_TRACE_INIT() PluginTrace_Init()
+    #define PLUGIN_TRACE_EXIT() PluginTrace_Exit()
+    #define PLUGIN_TRACEA(...) PluginTrace_Printf(__VA_ARGS__)
+#else
+    #define PLUGIN_TRACE_INIT() ((void)0)
+    #define PLUGIN_TRACE_EXIT() ((void)0)
+    #define PLUGIN_TRACEA(...) ((void)0)
+#endif  // def PLUGIN_TRACE
+
+#endif  // ndef PLUGIN_TRACE_H_
@@ -0,0 +1,313 @@
+// Rotation_avx2.cpp --- PluginFramework Plugin #2 kernels for AVX2
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "Rotation_kernels.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+typedef unsigned int PIXEL32;
+
+static inline PIXEL32 *DoRow(const ROTATION_VIEW& view, int y)
+{
+    return (PIXEL32 *)(view.pb + y * view.step);
+}
+
+// a[i] becomes the column i of the 8x8 block
+static inline void DoTranspose8x8AVX2(__m256i a[8])
+{
+    __m256i t[8], u[8];
+    for (int i = 0; i < 8; i += 2)
+    {
+        t[i] = _mm256_unpacklo_epi32(a[i], a[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(a[i], a[i + 1]);
+    }
+    for (int i = 0; i < 8; i += 4)
+    {
+        u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        a[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        a[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+static inline __m256i DoLoad8(const ROTATION_VIEW& view, int y, int x)
+{
+    return _mm256_loadu_si256((const __m256i *)(DoRow(view, y) + x));
+}
+
+static inline void DoStore8(const ROTATION_VIEW& view, int y, int x, __m256i v)
+{
+    _mm256_storeu_si256((__m256i *)(DoRow(view, y) + x), v);
+}
+
+static inline __m256i DoReverse8(__m256i v)
+{
+    return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+// the edges that are not a whole block
+static void DoRotate90RectC(const ROTATION_VIEW& src, const ROTATION_VIEW& dst,
+                            int y0, int y1, int x0, int x1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        PIXEL32 *pd = DoRow(dst, y);
+        for (int x = x0; x < x1; ++x)
+        {
+            pd[x] = DoRow(src, src.rows - 1 - x)[y];
+        }
+    }
+}
+
+static void DoRotate270RectC(const ROTATION_VIEW& src, const ROTATION_VIEW& dst,
+                             int y0, int y1, int x0, int x1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        PIXEL32 *pd = DoRow(dst, y);
+        for (int x = x0; x < x1; ++x)
+        {
+            pd[x] = DoRow(src, x)[src.cols - 1 - y];
+        }
+    }
+}
+
+// 32-bit pixels, transposed in 8x8 register blocks
+static void DoRotate90RectAVX2(const ROTATION_VIEW& src, const ROTATION_VIEW& dst,
+                               int y0, int y1, int x0, int x1)
+{
+    const int y8 = y0 + (y1 - y0) / 8 * 8;
+    const int x8 = x0 + (x1 - x0) / 8 * 8;
+    __m256i a[8];
+    for (int y = y0; y < y8; y += 8)
+    {
+        for (int x = x0; x < x8; x += 8)
+        {
+            const int row = src.rows - 1 - x;
+            for (int i = 0; i < 8; ++i)
+            {
+                a[i] = DoLoad8(src, row - i, y);
+            }
+            DoTranspose8x8AVX2(a);
+            for (int i = 0; i < 8; ++i)
+            {
+                DoStore8(dst, y + i, x, a[i]);
+            }
+        }
+    }
+    DoRotate90RectC(src, dst, y0, y8, x8, x1);
+    DoRotate90RectC(src, dst, y8, y1, x0, x1);
+}
+
+static void DoRotate270RectAVX2(const ROTATION_VIEW& src, const ROTATION_VIEW& dst,
+                                int y0, int y1, int x0, int x1)
+{
+    const int y8 = y0 + (y1 - y0) / 8 * 8;
+    const int x8 = x0 + (x1 - x0) / 8 * 8;
+    __m256i a[8];
+    for (int y = y0; y < y8; y += 8)
+    {
+        const int col = src.cols - 8 - y;
+        for (int x = x0; x < x8; x += 8)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                a[i] = DoLoad8(src, x + i, col);
+            }
+            DoTranspose8x8AVX2(a);
+            for (int i = 0; i < 8; ++i)
+            {
+                DoStore8(dst, y + 7 - i, x, a[i]);
+            }
+        }
+    }
+    DoRotate270RectC(src, dst, y0, y8, x8, x1);
+    DoRotate270RectC(src, dst, y8, y1, x0, x1);
+}
+
+static void DoSwapReversedAVX2(PIXEL32 *a, PIXEL32 *b, int cols)
+{
+    // a == b reverses the row by swapping its two halves
+    const int n = (a == b) ? cols / 2 : cols;
+    int x = 0;
+    for (; x + 8 <= n && (a != b || x + 8 <= cols - x - 8); x += 8)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + x));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + cols - 8 - x));
+        _mm256_storeu_si256((__m256i *)(a + x), DoReverse8(vb));
+        _mm256_storeu_si256((__m256i *)(b + cols - 8 - x), DoReverse8(va));
+    }
+    for (; x < n; ++x)
+    {
+        const PIXEL32 t = a[x];
+        a[x] = b[cols - 1 - x];
+        b[cols - 1 - x] = t;
+    }
+}
+
+static void DoRotate180InPlaceAVX2(const ROTATION_VIEW& mat, int y0, int y1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        DoSwapReversedAVX2(DoRow(mat, y), DoRow(mat, mat.rows - 1 - y), mat.cols);
+    }
+}
+
+static void DoFlipHInPlaceAVX2(const ROTATION_VIEW& mat, int y0, int y1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        DoSwapReversedAVX2(DoRow(mat, y), DoRow(mat, y), mat.cols);
+    }
+}
+
+// The 24-bit pixels (CV_8UC3) are widened to 32 bits in the registers, so
+// that they share the 8x8 transpose of the 32-bit ones.
+
+static inline unsigned char *DoRow24(const ROTATION_VIEW& view, int y, int x)
+{
+    return view.pb + y * view.step + x * 3;
+}
+
+// the 24 bytes of 8 pixels, a pixel in each dword
+static inline __m256i DoLoad8x24(const ROTATION_VIEW& view, int y, int x)
+{
+    const unsigned char *pb = DoRow24(view, y, x);
+    const __m256i v = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)pb)),
+        _mm_loadu_si128((const __m128i *)(pb + 8)), 1);
+    // the high lane holds the pixels 4 to 7 at its byte 4
+    const __m256i widen = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+        4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15, -1);
+    return _mm256_shuffle_epi8(v, widen);
+}
+
+static inline void DoStore8x24(const ROTATION_VIEW& view, int y, int x, __m256i v)
+{
+    const __m256i narrow = _mm256_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    v = _mm256_shuffle_epi8(v, narrow);
+    v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    unsigned char *pb = DoRow24(view, y, x);
+    _mm_storeu_si128((__m128i *)pb, _mm256_castsi256_si128(v));
+    _mm_storel_epi64((__m128i *)(pb + 16), _mm256_extracti128_si256(v, 1));
+}
+
+static inline void DoCopy24(unsigned char *pd, const unsigned char *ps)
+{
+    pd[0] = ps[0];
+    pd[1] = ps[1];
+    pd[2] = ps[2];
+}
+
+static void DoRotate90Rect24C(const ROTATION_VIEW& src, const ROTATION_VIEW& dst,
+                              int y0, int y1, int x0, int x1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        for (int x = x0; x < x1; ++x)
+        {
+            DoCopy24(DoRow24(dst, y, x), DoRow24(src, src.rows - 1 - x, y));
+        }
+    }
+}
+
+static void DoRotate270Rect24C(const ROTATION_VIEW& src, const ROTATION_VIEW& dst,
+                               int y0, int y1, int x0, int x1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        for (int x = x0; x < x1; ++x)
+        {
+            DoCopy24(DoRow24(dst, y, x), DoRow24(src, x, src.cols - 1 - y));
+        }
+    }
+}
+
+static void DoRotate90Rect24AVX2(const ROTATION_VIEW& src, const ROTATION_VIEW& dst,
+                                 int y0, int y1, int x0, int x1)
+{
+    const int y8 = y0 + (y1 - y0) / 8 * 8;
+    const int x8 = x0 + (x1 - x0) / 8 * 8;
+    __m256i a[8];
+    for (int y = y0; y < y8; y += 8)
+    {
+        for (int x = x0; x < x8; x += 8)
+        {
+            const int row = src.rows - 1 - x;
+            for (int i = 0; i < 8; ++i)
+            {
+                a[i] = DoLoad8x24(src, row - i, y);
+            }
+            DoTranspose8x8AVX2(a);
+            for (int i = 0; i < 8; ++i)
+            {
+                DoStore8x24(dst, y + i, x, a[i]);
+            }
+        }
+    }
+    DoRotate90Rect24C(src, dst, y0, y8, x8, x1);
+    DoRotate90Rect24C(src, dst, y8, y1, x0, x1);
+}
+
+static void DoRotate270Rect24AVX2(const ROTATION_VIEW& src, const ROTATION_VIEW& dst,
+                                  int y0, int y1, int x0, int x1)
+{
+    const int y8 = y0 + (y1 - y0) / 8 * 8;
+    const int x8 = x0 + (x1 - x0) / 8 * 8;
+    __m256i a[8];
+    for (int y = y0; y < y8; y += 8)
+    {
+        const int col = src.cols - 8 - y;
+        for (int x = x0; x < x8; x += 8)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                a[i] = DoLoad8x24(src, x + i, col);
+            }
+            DoTranspose8x8AVX2(a);
+            for (int i = 0; i < 8; ++i)
+            {
+                DoStore8x24(dst, y + 7 - i, x, a[i]);
+            }
+        }
+    }
+    DoRotate270Rect24C(src, dst, y0, y8, x8, x1);
+    DoRotate270Rect24C(src, dst, y8, y1, x0, x1);
+}
+
+bool Rotation_GetKernels32AVX2(ROTATION_KERNELS& kernels)
+{
+    kernels.fn90 = DoRotate90RectAVX2;
+    kernels.fn270 = DoRotate270RectAVX2;
+    kernels.fn180 = DoRotate180InPlaceAVX2;
+    kernels.fnFlipH = DoFlipHInPlaceAVX2;
+    return true;
+}
+
+bool Rotation_GetKernels24AVX2(ROTATION_KERNELS& kernels)
+{
+    kernels.fn90 = DoRotate90Rect24AVX2;
+    kernels.fn270 = DoRotate270Rect24AVX2;
+    return true;
+}
+#else
+bool Rotation_GetKernels32AVX2(ROTATION_KERNELS& kernels)
+{
+    (void)kernels;
+    return false;
+}
+
+bool Rotation_GetKernels24AVX2(ROTATION_KERNELS& kernels)
+{
+    (void)kernels;
+    return false;
+}
+#endif
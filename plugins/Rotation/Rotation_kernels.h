@@ -0,0 +1,46 @@
+// Rotation_kernels.h --- PluginFramework Plugin #2 kernels of each CPU level
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#ifndef ROTATION_KERNELS_H_
+#define ROTATION_KERNELS_H_
+
+#include <cstddef>
+
+// NOTE: Rotation_sse2.cpp and Rotation_avx2.cpp are built with the flags of
+//       their PLUGIN_ISA (see PluginCpu.h), so the kernels see views, not
+//       cv::Mat.  There are no AVX-512 kernels: a 64-byte row of 16 pixels
+//       gains nothing over two of 8 on the tiles of TILE_SIZE.
+
+// The rows of a frame; row y is at pb + y * step.
+struct ROTATION_VIEW
+{
+    unsigned char *pb;
+    size_t step;
+    int rows;
+    int cols;
+};
+
+// dst rows [y0, y1), columns [x0, x1)
+typedef void (*ROTATE_RECT)(const ROTATION_VIEW& src, const ROTATION_VIEW& dst,
+                            int y0, int y1, int x0, int x1);
+// rows or row pairs [y0, y1)
+typedef void (*ROTATE_INPLACE)(const ROTATION_VIEW& mat, int y0, int y1);
+
+struct ROTATION_KERNELS
+{
+    ROTATE_RECT fn90;
+    ROTATE_RECT fn270;
+    ROTATE_INPLACE fn180;
+    ROTATE_INPLACE fnFlipH;
+};
+
+// The kernels of any pixel of 32 bits.  false if the file of the level was
+// built without its flags.
+bool Rotation_GetKernels32SSE2(ROTATION_KERNELS& kernels);
+bool Rotation_GetKernels32AVX2(ROTATION_KERNELS& kernels);
+
+// The quarter turns of the 24-bit pixels (CV_8UC3); the other kernels are
+// left as they are.  There are none for SSE2, which has no byte shuffle.
+bool Rotation_GetKernels24AVX2(ROTATION_KERNELS& kernels);
+
+#endif  // ndef ROTATION_KERNELS_H_
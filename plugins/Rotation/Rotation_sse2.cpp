@@ -0,0 +1,171 @@
+// Rotation_sse2.cpp --- PluginFramework Plugin #2 kernels for SSE2
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "Rotation_kernels.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+typedef unsigned int PIXEL32;
+
+static inline PIXEL32 *DoRow(const ROTATION_VIEW& view, int y)
+{
+    return (PIXEL32 *)(view.pb + y * view.step);
+}
+
+static inline void DoTranspose4x4SSE2(__m128i& a0, __m128i& a1,
+                                      __m128i& a2, __m128i& a3)
+{
+    __m128i t0 = _mm_unpacklo_epi32(a0, a1);
+    __m128i t1 = _mm_unpacklo_epi32(a2, a3);
+    __m128i t2 = _mm_unpackhi_epi32(a0, a1);
+    __m128i t3 = _mm_unpackhi_epi32(a2, a3);
+    a0 = _mm_unpacklo_epi64(t0, t1);
+    a1 = _mm_unpackhi_epi64(t0, t1);
+    a2 = _mm_unpacklo_epi64(t2, t3);
+    a3 = _mm_unpackhi_epi64(t2, t3);
+}
+
+static inline __m128i DoLoad4(const ROTATION_VIEW& view, int y, int x)
+{
+    return _mm_loadu_si128((const __m128i *)(DoRow(view, y) + x));
+}
+
+static inline void DoStore4(const ROTATION_VIEW& view, int y, int x, __m128i v)
+{
+    _mm_storeu_si128((__m128i *)(DoRow(view, y) + x), v);
+}
+
+static inline __m128i DoReverse4(__m128i v)
+{
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+// the edges that are not a whole block
+static void DoRotate90RectC(const ROTATION_VIEW& src, const ROTATION_VIEW& dst,
+                            int y0, int y1, int x0, int x1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        PIXEL32 *pd = DoRow(dst, y);
+        for (int x = x0; x < x1; ++x)
+        {
+            pd[x] = DoRow(src, src.rows - 1 - x)[y];
+        }
+    }
+}
+
+static void DoRotate270RectC(const ROTATION_VIEW& src, const ROTATION_VIEW& dst,
+                             int y0, int y1, int x0, int x1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        PIXEL32 *pd = DoRow(dst, y);
+        for (int x = x0; x < x1; ++x)
+        {
+            pd[x] = DoRow(src, x)[src.cols - 1 - y];
+        }
+    }
+}
+
+// 32-bit pixels, transposed in 4x4 register blocks
+static void DoRotate90RectSSE2(const ROTATION_VIEW& src, const ROTATION_VIEW& dst,
+                               int y0, int y1, int x0, int x1)
+{
+    const int y4 = y0 + (y1 - y0) / 4 * 4;
+    const int x4 = x0 + (x1 - x0) / 4 * 4;
+    for (int y = y0; y < y4; y += 4)
+    {
+        for (int x = x0; x < x4; x += 4)
+        {
+            const int row = src.rows - 1 - x;
+            __m128i a0 = DoLoad4(src, row, y);
+            __m128i a1 = DoLoad4(src, row - 1, y);
+            __m128i a2 = DoLoad4(src, row - 2, y);
+            __m128i a3 = DoLoad4(src, row - 3, y);
+            DoTranspose4x4SSE2(a0, a1, a2, a3);
+            DoStore4(dst, y, x, a0);
+            DoStore4(dst, y + 1, x, a1);
+            DoStore4(dst, y + 2, x, a2);
+            DoStore4(dst, y + 3, x, a3);
+        }
+    }
+    DoRotate90RectC(src, dst, y0, y4, x4, x1);
+    DoRotate90RectC(src, dst, y4, y1, x0, x1);
+}
+
+static void DoRotate270RectSSE2(const ROTATION_VIEW& src, const ROTATION_VIEW& dst,
+                                int y0, int y1, int x0, int x1)
+{
+    const int y4 = y0 + (y1 - y0) / 4 * 4;
+    const int x4 = x0 + (x1 - x0) / 4 * 4;
+    for (int y = y0; y < y4; y += 4)
+    {
+        const int col = src.cols - 4 - y;
+        for (int x = x0; x < x4; x += 4)
+        {
+            __m128i a0 = DoLoad4(src, x, col);
+            __m128i a1 = DoLoad4(src, x + 1, col);
+            __m128i a2 = DoLoad4(src, x + 2, col);
+            __m128i a3 = DoLoad4(src, x + 3, col);
+            DoTranspose4x4SSE2(a0, a1, a2, a3);
+            DoStore4(dst, y, x, a3);
+            DoStore4(dst, y + 1, x, a2);
+            DoStore4(dst, y + 2, x, a1);
+            DoStore4(dst, y + 3, x, a0);
+        }
+    }
+    DoRotate270RectC(src, dst, y0, y4, x4, x1);
+    DoRotate270RectC(src, dst, y4, y1, x0, x1);
+}
+
+static void DoSwapReversedSSE2(PIXEL32 *a, PIXEL32 *b, int cols)
+{
+    // a == b reverses the row by swapping its two halves
+    const int n = (a == b) ? cols / 2 : cols;
+    int x = 0;
+    for (; x + 4 <= n && (a != b || x + 4 <= cols - x - 4); x += 4)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + cols - 4 - x));
+        _mm_storeu_si128((__m128i *)(a + x), DoReverse4(vb));
+        _mm_storeu_si128((__m128i *)(b + cols - 4 - x), DoReverse4(va));
+    }
+    for (; x < n; ++x)
+    {
+        const PIXEL32 t = a[x];
+        a[x] = b[cols - 1 - x];
+        b[cols - 1 - x] = t;
+    }
+}
+
+static void DoRotate180InPlaceSSE2(const ROTATION_VIEW& mat, int y0, int y1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        DoSwapReversedSSE2(DoRow(mat, y), DoRow(mat, mat.rows - 1 - y), mat.cols);
+    }
+}
+
+static void DoFlipHInPlaceSSE2(const ROTATION_VIEW& mat, int y0, int y1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        DoSwapReversedSSE2(DoRow(mat, y), DoRow(mat, y), mat.cols);
+    }
+}
+
+bool Rotation_GetKernels32SSE2(ROTATION_KERNELS& kernels)
+{
+    kernels.fn90 = DoRotate90RectSSE2;
+    kernels.fn270 = DoRotate270RectSSE2;
+    kernels.fn180 = DoRotate180InPlaceSSE2;
+    kernels.fnFlipH = DoFlipHInPlaceSSE2;
+    return true;
+}
+#else
+bool Rotation_GetKernels32SSE2(ROTATION_KERNELS& kernels)
+{
+    (void)kernels;
+    return false;
+}
+#endif
@@ -1,14 +1,42 @@
 // Rotation_yap.cpp --- PluginFramework Plugin #2
 // Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
 // This file is public domain software.
+#ifdef PLUGIN_STATIC
+    // the entry points when linked into the host
+    #define Plugin_Load Rotation_Plugin_Load
+    #define Plugin_Unload Rotation_Plugin_Unload
+    #define Plugin_Act Rotation_Plugin_Act
+#endif
 #include "../Plugin.h"
-#include "../mregkey.hpp"
-#include <windowsx.h>
-#include <commctrl.h>
+#ifdef _WIN32
+    #include "../mregkey.hpp"
+#endif
+#include "../PluginTrace.h"
+#include "../PluginSnapshot.h"
+#include "../PluginAllocator.h"
+#include "../PluginStats.h"
+#include "../PluginSpans.h"
+#include "../PluginCpu.h"
+#ifndef PLUGIN_HEADLESS
+    #include <windowsx.h>
+    #include <commctrl.h>
+#endif
 #include <string>
+#include <new>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <cassert>
-#include <strsafe.h>
+#ifdef _WIN32
+    #include <strsafe.h>
+    #include <tchar.h>
+#endif
 #include "resource.h"
+#include "Rotation_kernels.h"
 
 enum ROTATION
 {
@@ -18,15 +46,37 @@ enum ROTATION
     ROTATION_270,
     ROTATION_FLIPH,
     ROTATION_FLIPV,
+    ROTATION_CUSTOM,
 };
 
 static HINSTANCE s_hinstDLL;
-static PLUGIN *s_pi;
-static ROTATION s_nRotation;
-static INT s_nWindowX;
-static INT s_nWindowY;
-static BOOL s_bDialogInit = FALSE;
 
+#ifdef PLUGIN_PHASES
+// The names of the counters of the time of each ROTATION.
+static const char *const s_apszModeCounters[] =
+{
+    NULL,
+    "ns_rotate90",
+    "ns_rotate180",
+    "ns_rotate270",
+    "ns_fliph",
+    "ns_flipv",
+    "ns_custom",
+};
+#endif
+
+// The settings as the frame path sees them.  The dialog publishes a new
+// snapshot whenever it changes one of them.
+struct ROTATION_SETTINGS
+{
+    ROTATION nRotation;
+    INT nThreads;                       // of DoResolveThreads
+    INT nAngle;                         // in 0.1 degrees, for ROTATION_CUSTOM
+    INT nZoom;                          // in percent, for ROTATION_CUSTOM
+    INT nKeystone;                      // in percent, for ROTATION_CUSTOM
+};
+
+#ifndef PLUGIN_HEADLESS
 LPTSTR LoadStringDx(INT nID)
 {
     static UINT s_index = 0;
@@ -54,19 +104,691 @@ LPWSTR wide_from_ansi(LPCSTR pszAnsi)
     MultiByteToWideChar(CP_ACP, 0, pszAnsi, -1, s_buf, ARRAYSIZE(s_buf));
     return s_buf;
 }
+#endif  // ndef PLUGIN_HEADLESS
+
+//////////////////////////////////////////////////////////////////////////////
+// Rotation kernels
+//
+// Each kernel reads every source pixel once and writes every destination
+// pixel once.  The 90/270 degree kernels walk the destination in square
+// tiles, so that the source columns being gathered stay in L1.  180 degrees
+// and the flips work in place, on the pairs of rows y and rows - 1 - y.
+// The kernels see the frames as views, and those of 32-bit pixels are built
+// for each CPU level and picked at Plugin_Load (Rotation_kernels.h).
+
+#define TILE_SIZE 64
+
+// a pixel of CN channels of T_ELEM, copied as a whole
+template <typename T_ELEM, int CN>
+struct PIXEL
+{
+    T_ELEM v[CN];
+};
+
+static ROTATION_VIEW DoGetView(const cv::Mat& mat)
+{
+    ROTATION_VIEW view = { const_cast<uchar *>(mat.data), mat.step, mat.rows, mat.cols };
+    return view;
+}
+
+template <typename T_PIXEL>
+static inline T_PIXEL *DoRow(const ROTATION_VIEW& view, int y)
+{
+    return (T_PIXEL *)(view.pb + y * view.step);
+}
+
+// dst(y, x) = src(src.rows - 1 - x, y)
+template <typename T_PIXEL>
+static void DoRotate90Rect(const ROTATION_VIEW& src, const ROTATION_VIEW& dst,
+                           int y0, int y1, int x0, int x1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        T_PIXEL *pd = DoRow<T_PIXEL>(dst, y);
+        const uchar *ps = src.pb + (src.rows - 1 - x0) * src.step + y * sizeof(T_PIXEL);
+        for (int x = x0; x < x1; ++x, ps -= src.step)
+        {
+            pd[x] = *(const T_PIXEL *)ps;
+        }
+    }
+}
+
+// dst(y, x) = src(x, src.cols - 1 - y)
+template <typename T_PIXEL>
+static void DoRotate270Rect(const ROTATION_VIEW& src, const ROTATION_VIEW& dst,
+                            int y0, int y1, int x0, int x1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        T_PIXEL *pd = DoRow<T_PIXEL>(dst, y);
+        const uchar *ps = src.pb + x0 * src.step + (src.cols - 1 - y) * sizeof(T_PIXEL);
+        for (int x = x0; x < x1; ++x, ps += src.step)
+        {
+            pd[x] = *(const T_PIXEL *)ps;
+        }
+    }
+}
+
+// Swaps a[x] and b[cols - 1 - x] for all x.  If a == b, reverses the row.
+template <typename T_PIXEL>
+static void DoSwapReversed(T_PIXEL *a, T_PIXEL *b, int cols)
+{
+    if (a == b)
+    {
+        std::reverse(a, a + cols);
+        return;
+    }
+
+    T_PIXEL *pb = b + cols;
+    for (int x = 0; x < cols; ++x)
+    {
+        std::swap(a[x], *--pb);
+    }
+}
+
+// rows y and rows - 1 - y for y in [y0, y1), where y1 <= (rows + 1) / 2
+template <typename T_PIXEL>
+static void DoRotate180InPlace(const ROTATION_VIEW& mat, int y0, int y1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        DoSwapReversed(DoRow<T_PIXEL>(mat, y), DoRow<T_PIXEL>(mat, mat.rows - 1 - y),
+                       mat.cols);
+    }
+}
+
+// rows [y0, y1)
+template <typename T_PIXEL>
+static void DoFlipHInPlace(const ROTATION_VIEW& mat, int y0, int y1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        T_PIXEL *p = DoRow<T_PIXEL>(mat, y);
+        std::reverse(p, p + mat.cols);
+    }
+}
+
+// Any pixel size
+static void DoSwapReversedAny(uchar *a, uchar *b, int cols, size_t cb)
+{
+    uchar *pa = a, *pb = b + (cols - 1) * cb;
+    for (int x = 0; x < cols; ++x, pa += cb, pb -= cb)
+    {
+        if (a == b && pa >= pb)
+            break;
+        std::swap_ranges(pa, pa + cb, pb);
+    }
+}
+
+static void DoRotate180InPlaceAny(cv::Mat& mat, int y0, int y1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        DoSwapReversedAny(mat.ptr(y), mat.ptr(mat.rows - 1 - y), mat.cols,
+                          mat.elemSize());
+    }
+}
+
+static void DoFlipHInPlaceAny(cv::Mat& mat, int y0, int y1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        DoSwapReversedAny(mat.ptr(y), mat.ptr(y), mat.cols, mat.elemSize());
+    }
+}
+
+// rows y and rows - 1 - y for y in [y0, y1), where y1 <= rows / 2
+static void DoFlipVInPlace(cv::Mat& mat, int y0, int y1)
+{
+    const size_t cb = mat.cols * mat.elemSize();
+    for (int y = y0; y < y1; ++y)
+    {
+        uchar *a = mat.ptr(y);
+        std::swap_ranges(a, a + cb, mat.ptr(mat.rows - 1 - y));
+    }
+}
+
+template <typename T_PIXEL>
+static ROTATION_KERNELS DoMakeKernels(void)
+{
+    ROTATION_KERNELS kernels =
+    {
+        DoRotate90Rect<T_PIXEL>, DoRotate270Rect<T_PIXEL>,
+        DoRotate180InPlace<T_PIXEL>, DoFlipHInPlace<T_PIXEL>
+    };
+    return kernels;
+}
+
+// The kernels of any pixel of 32 bits, of the best level up to isa.  isa
+// becomes the level of the kernels.
+static ROTATION_KERNELS DoSelectKernels32(PLUGIN_ISA& isa)
+{
+    ROTATION_KERNELS kernels;
+    for (; isa > PLUGIN_ISA_GENERIC; isa = PLUGIN_ISA(isa - 1))
+    {
+        switch (isa)
+        {
+        case PLUGIN_ISA_AVX2:
+            if (Rotation_GetKernels32AVX2(kernels))
+                return kernels;
+            break;
+        case PLUGIN_ISA_SSE2:
+            if (Rotation_GetKernels32SSE2(kernels))
+                return kernels;
+            break;
+        default:
+            break;
+        }
+    }
+    return DoMakeKernels<UINT>();
+}
+
+// The kernels of CV_8UC3, of the best level up to isa.  Only AVX2 has its
+// own quarter turns.
+static ROTATION_KERNELS DoSelectKernels24(PLUGIN_ISA isa)
+{
+    ROTATION_KERNELS kernels = DoMakeKernels<PIXEL<uchar, 3> >();
+    if (isa >= PLUGIN_ISA_AVX2)
+        Rotation_GetKernels24AVX2(kernels);
+    return kernels;
+}
+
+// The kernels of the pixels that have SIMD ones, selected at load.
+struct ROTATION_KERNEL_SET
+{
+    ROTATION_KERNELS kernels32;     // any pixel of 32 bits
+    ROTATION_KERNELS kernels24;     // CV_8UC3
+};
+
+struct ROTATION_KERNEL_ENTRY
+{
+    int type;
+    ROTATION_KERNELS kernels;
+};
+
+// Returns NULL for the types without a kernel of their own.  They use the
+// generic byte-wise fallbacks (or cv::transpose and cv::flip).  The pixels of
+// 32 bits and CV_8UC3 use those of simd.
+static const ROTATION_KERNELS *DoGetKernels(int type,
+                                            const ROTATION_KERNEL_SET& simd)
+{
+    static const ROTATION_KERNEL_ENTRY s_table[] =
+    {
+        { CV_8UC1, DoMakeKernels<PIXEL<uchar, 1> >() },
+        { CV_8UC2, DoMakeKernels<PIXEL<uchar, 2> >() },
+        { CV_16UC1, DoMakeKernels<PIXEL<ushort, 1> >() },
+        { CV_16UC3, DoMakeKernels<PIXEL<ushort, 3> >() },
+        { CV_16UC4, DoMakeKernels<PIXEL<ushort, 4> >() },
+        { CV_32FC3, DoMakeKernels<PIXEL<float, 3> >() },
+    };
+
+    switch (type)
+    {
+    case CV_8UC3:
+        return &simd.kernels24;
+    case CV_8UC4:
+    case CV_16UC2:
+    case CV_32FC1:
+        return &simd.kernels32;
+    default:
+        break;
+    }
+
+    for (size_t i = 0; i < _countof(s_table); ++i)
+    {
+        if (s_table[i].type == type)
+            return &s_table[i].kernels;
+    }
+    return NULL;
+}
+
+static void DoRotateTiles(ROTATE_RECT fn, const ROTATION_VIEW& src,
+                          const ROTATION_VIEW& dst, int y0, int y1)
+{
+    for (int ty = y0; ty < y1; ty += TILE_SIZE)
+    {
+        const int ty1 = std::min(ty + TILE_SIZE, y1);
+        for (int tx = 0; tx < dst.cols; tx += TILE_SIZE)
+        {
+            fn(src, dst, ty, ty1, tx, std::min(tx + TILE_SIZE, dst.cols));
+        }
+    }
+}
+
+// Makes buf a rows x cols buffer of the type, without allocating if the
+// buffer is ours alone and large enough.
+static void DoReuseBuffer(cv::Mat& buf, int rows, int cols, int type)
+{
+    if (!buf.u || buf.u->refcount > 1)
+    {
+        buf.release();
+    }
+    else if (buf.rows != rows && buf.type() == type && buf.isContinuous() &&
+             buf.total() == size_t(rows) * cols)
+    {
+        buf = buf.reshape(0, rows);
+        return;
+    }
+    buf.create(rows, cols, type);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Worker pool
+//
+// A job is split into chunks that are numbered from 0.  The calling thread
+// and the workers take the chunks in turn until none is left, so the result
+// does not depend on the number of threads.
+
+#define MAX_THREADS 64
+
+typedef void (*ROTATION_JOB_PROC)(void *context, int iChunk);
+
+struct ROTATION_POOL
+{
+    std::mutex mutex;                   // guards the members below
+    std::condition_variable cvWork;
+    std::condition_variable cvDone;
+    std::vector<std::thread> threads;
+    ROTATION_JOB_PROC proc;
+    void *context;
+    int nChunks;
+    int nBusy;                          // workers still in the current job
+    unsigned int nJob;                  // serial number of the current job
+    bool bQuit;
+    std::atomic<int> iNextChunk;
+};
+
+static void DoRunChunks(ROTATION_POOL& pool)
+{
+    for (;;)
+    {
+        const int iChunk = pool.iNextChunk.fetch_add(1);
+        if (iChunk >= pool.nChunks)
+            break;
+        pool.proc(pool.context, iChunk);
+    }
+}
+
+static void DoWorkerProc(ROTATION_POOL *ppool, unsigned int nJob)
+{
+    ROTATION_POOL& pool = *ppool;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(pool.mutex);
+            while (!pool.bQuit && pool.nJob == nJob)
+                pool.cvWork.wait(lock);
+            if (pool.bQuit)
+                return;
+            nJob = pool.nJob;
+        }
+
+        DoRunChunks(pool);
+
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (--pool.nBusy == 0)
+            pool.cvDone.notify_one();
+    }
+}
+
+static void DoStopWorkers(ROTATION_POOL& pool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.bQuit = true;
+    }
+    pool.cvWork.notify_all();
+
+    for (size_t i = 0; i < pool.threads.size(); ++i)
+    {
+        pool.threads[i].join();
+    }
+    pool.threads.clear();
+    pool.bQuit = false;
+}
+
+// The threads of the setting "Threads", counting the calling thread.  Zero
+// means one per processor.  It is resolved when the settings are published,
+// not per frame.
+static INT DoResolveThreads(INT nThreads)
+{
+    if (nThreads <= 0)
+        nThreads = INT(std::thread::hardware_concurrency());
+    return std::max(1, std::min(nThreads, MAX_THREADS));
+}
+
+// nThreads is of DoResolveThreads.  The pool is restarted only if the
+// number changes, so the frame path may call it for every frame.
+static void DoStartWorkers(ROTATION_POOL& pool, INT nThreads)
+{
+    if (pool.threads.size() == size_t(nThreads - 1))
+        return;
+
+    DoStopWorkers(pool);
+    for (INT i = 1; i < nThreads; ++i)
+    {
+        pool.threads.push_back(std::thread(DoWorkerProc, &pool, pool.nJob));
+    }
+}
+
+// Runs proc for the chunks 0 to nChunks - 1 and waits for all of them.
+static void DoRunJob(ROTATION_POOL& pool, ROTATION_JOB_PROC proc,
+                     void *context, int nChunks)
+{
+    if (pool.threads.empty() || nChunks <= 1)
+    {
+        for (int iChunk = 0; iChunk < nChunks; ++iChunk)
+        {
+            proc(context, iChunk);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.proc = proc;
+        pool.context = context;
+        pool.nChunks = nChunks;
+        pool.nBusy = (int)pool.threads.size();
+        pool.iNextChunk = 0;
+        ++pool.nJob;
+    }
+    pool.cvWork.notify_all();
+
+    DoRunChunks(pool);
+
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    while (pool.nBusy > 0)
+        pool.cvDone.wait(lock);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Rotation jobs
+//
+// The chunks are bands of TILE_SIZE destination rows.  For the in-place
+// rotations, a band is a range of the row pairs (y, rows - 1 - y).
+
+struct ROTATION_JOB
+{
+    ROTATION nRotation;
+    const ROTATION_KERNELS *kernels;    // NULL for the generic fallbacks
+    const cv::Mat *src;
+    cv::Mat *dst;
+    int nRows;                          // the rows or row pairs to process
+};
+
+static void DoRotateChunk(void *context, int iChunk)
+{
+    const ROTATION_JOB& job = *(const ROTATION_JOB *)context;
+    const ROTATION_KERNELS *kernels = job.kernels;
+    const ROTATION_VIEW src = DoGetView(*job.src), dst = DoGetView(*job.dst);
+    const int y0 = iChunk * TILE_SIZE;
+    const int y1 = std::min(y0 + TILE_SIZE, job.nRows);
+
+    switch (job.nRotation)
+    {
+    case ROTATION_90:
+        DoRotateTiles(kernels->fn90, src, dst, y0, y1);
+        break;
+    case ROTATION_270:
+        DoRotateTiles(kernels->fn270, src, dst, y0, y1);
+        break;
+    case ROTATION_180:
+        if (kernels)
+            kernels->fn180(dst, y0, y1);
+        else
+            DoRotate180InPlaceAny(*job.dst, y0, y1);
+        break;
+    case ROTATION_FLIPH:
+        if (kernels)
+            kernels->fnFlipH(dst, y0, y1);
+        else
+            DoFlipHInPlaceAny(*job.dst, y0, y1);
+        break;
+    case ROTATION_FLIPV:
+        DoFlipVInPlace(*job.dst, y0, y1);
+        break;
+    default:
+        break;
+    }
+}
+
+static void DoRunRotation(ROTATION_POOL& pool, ROTATION_JOB& job)
+{
+    const int nChunks = (job.nRows + TILE_SIZE - 1) / TILE_SIZE;
+    DoRunJob(pool, DoRotateChunk, &job, nChunks);
+}
+
+// Rotates src into dst by 90 or 270 degrees in a single pass.  dst must not
+// share the buffer of src.  Returns false if the pixel format has no kernel.
+static bool DoRotateFast(ROTATION_POOL& pool, const ROTATION_KERNEL_SET& simd,
+                         const cv::Mat& src, cv::Mat& dst, ROTATION nRotation)
+{
+    // dst gets the rows of the columns of src
+    ROTATION_JOB job =
+    {
+        nRotation, DoGetKernels(src.type(), simd), &src, &dst, src.cols
+    };
+    if (!job.kernels)
+        return false;
+    if (nRotation != ROTATION_90 && nRotation != ROTATION_270)
+        return false;
+
+    DoReuseBuffer(dst, src.cols, src.rows, src.type());
+    DoRunRotation(pool, job);
+    return true;
+}
+
+// Rotates 180 degrees or flips inside the buffer of mat.
+static void DoRotateInPlace(ROTATION_POOL& pool, const ROTATION_KERNEL_SET& simd,
+                            cv::Mat& mat, ROTATION nRotation)
+{
+    ROTATION_JOB job =
+    {
+        nRotation, DoGetKernels(mat.type(), simd), &mat, &mat, 0
+    };
+    switch (nRotation)
+    {
+    case ROTATION_180:
+        job.nRows = (mat.rows + 1) / 2;
+        break;
+    case ROTATION_FLIPH:
+        job.nRows = mat.rows;
+        break;
+    case ROTATION_FLIPV:
+        job.nRows = mat.rows / 2;
+        break;
+    default:
+        return;
+    }
+    DoRunRotation(pool, job);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Warp engine
+//
+// ROTATION_CUSTOM rotates by any angle about the center, zooms, and corrects
+// a vertical keystone.  The destination keeps the size of the frame.  The
+// mapping from destination to source pixels is built once per frame size and
+// parameters, stored as fixed-point maps, and applied with cv::remap.
+
+// the ranges of the dialog; the registry values are clamped to them
+#define ZOOM_MIN 10
+#define ZOOM_MAX 400
+#define KEYSTONE_MAX 50
+
+struct WARP_MAPS
+{
+    cv::Size size;
+    INT nAngle;                         // in 0.1 degrees, clockwise
+    INT nZoom;                          // in percent
+    INT nKeystone;                      // in percent
+    cv::Mat map1;                       // CV_16SC2 integer coordinates
+    cv::Mat map2;                       // CV_16UC1 interpolation weights
+};
+
+static bool DoIsIdentityWarp(INT nAngle, INT nZoom, INT nKeystone)
+{
+    return nAngle % 3600 == 0 && nZoom == 100 && nKeystone == 0;
+}
+
+// Follows a destination pixel back to the source: it undoes the keystone,
+// the zoom and the rotation in this order.  A positive keystone widens the
+// top edge of the picture.  A row whose scale is not positive (never within
+// the ranges of the settings) maps outside the source, to the border.
+static void DoBuildWarpMaps(WARP_MAPS& warp, cv::Size size,
+                            INT nAngle, INT nZoom, INT nKeystone)
+{
+    const double cx = (size.width - 1) * 0.5, cy = (size.height - 1) * 0.5;
+    const double radians = nAngle * (CV_PI / 1800);
+    const double c = cos(radians), s = sin(radians);
+    const double zoom = std::max(nZoom, 1) / 100.0;
+    const double a = (nKeystone / 100.0) / std::max(cy, 1.0);
+
+    cv::Mat mapX(size, CV_32FC1), mapY(size, CV_32FC1);
+    for (int y = 0; y < size.height; ++y)
+    {
+        float *px = mapX.ptr<float>(y);
+        float *py = mapY.ptr<float>(y);
+        const double qy = y - cy;
+        const double w = (1 - a * qy) * zoom;
+        if (w <= 1e-6)
+        {
+            for (int x = 0; x < size.width; ++x)
+            {
+                px[x] = py[x] = -1;
+            }
+            continue;
+        }
+        for (int x = 0; x < size.width; ++x)
+        {
+            const double u = (x - cx) / w, v = qy / w;
+            px[x] = float(cx + c * u + s * v);
+            py[x] = float(cy - s * u + c * v);
+        }
+    }
+
+    cv::convertMaps(mapX, mapY, warp.map1, warp.map2, CV_16SC2);
+    warp.size = size;
+    warp.nAngle = nAngle;
+    warp.nZoom = nZoom;
+    warp.nKeystone = nKeystone;
+}
+
+// Warps src into dst, which must not share the buffer of src.
+static void DoWarp(WARP_MAPS& warp, const cv::Mat& src, cv::Mat& dst,
+                   INT nAngle, INT nZoom, INT nKeystone)
+{
+    if (warp.map1.empty() || warp.size != src.size() || warp.nAngle != nAngle ||
+        warp.nZoom != nZoom || warp.nKeystone != nKeystone)
+    {
+        DoBuildWarpMaps(warp, src.size(), nAngle, nZoom, nKeystone);
+    }
+
+    DoReuseBuffer(dst, src.rows, src.cols, src.type());
+    cv::remap(src, dst, warp.map1, warp.map2, cv::INTER_LINEAR,
+              cv::BORDER_CONSTANT);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Instances
+//
+// The host loads the plugin once per stream, each time with its own PLUGIN.
+// All the state of a stream lives in the instance at p_user_data, so that
+// the streams can call Plugin_Act in parallel.
+
+struct ROTATION_INSTANCE
+{
+    PLUGIN *pi;
+    DWORD dwInstance;                   // lParam of Plugin_Load
+
+    // owned by the dialog
+    ROTATION nRotation;
+    INT nThreads;
+    INT nAngle;
+    INT nZoom;
+    INT nKeystone;
+    INT nIsa;                           // a PLUGIN_ISA, applied at Plugin_Load
+    INT nWindowX;
+    INT nWindowY;
+    BOOL bDialogInit;
+
+    // read by the frame path
+    PluginSnapshot<ROTATION_SETTINGS> settings;
+
+    // owned by the frame path
+    cv::MatAllocator *pAllocator;   // of the host, or NULL
+    PLUGIN *piSpans;                // of PluginSpans_GetTarget, per action
+#ifdef PLUGIN_PHASES
+    PluginCounter *apllNanos[ROTATION_CUSTOM + 1];  // the time of each mode
+#endif
+    PLUGIN_ISA isa;                 // the level of simd.kernels32
+    ROTATION_KERNEL_SET simd;
+    cv::Mat matSpare;
+    ROTATION_POOL pool;
+    WARP_MAPS warp;
+#ifdef PLUGIN_TRACE
+    cv::Size sizeTrace;
+    INT nTypeTrace;
+    INT nRotationTrace;
+#endif
+};
+
+static ROTATION_INSTANCE *DoGetInstance(PLUGIN *pi)
+{
+    return (ROTATION_INSTANCE *)pi->p_user_data;
+}
+
+#ifndef PLUGIN_HEADLESS
+static ROTATION_INSTANCE *DoGetDialogInstance(HWND hwnd)
+{
+    return (ROTATION_INSTANCE *)GetWindowLongPtr(hwnd, DWLP_USER);
+}
+#endif
+
+// The first instance keeps the settings in the key of the plugin, and the
+// others in its subkeys.
+static void DoGetAppKeyName(const ROTATION_INSTANCE *pInst, LPTSTR pszKey,
+                            size_t cchKey)
+{
+    if (pInst->dwInstance == 0)
+        StringCchCopy(pszKey, cchKey, TEXT("Rotation_yap"));
+    else
+        StringCchPrintf(pszKey, cchKey, TEXT("Rotation_yap\\Instance%lu"),
+                        (unsigned long)pInst->dwInstance);
+}
 
 extern "C" {
 
+static void DoPublishSettings(ROTATION_INSTANCE *pInst)
+{
+    ROTATION_SETTINGS settings;
+    settings.nRotation = pInst->nRotation;
+    settings.nThreads = DoResolveThreads(pInst->nThreads);
+    settings.nAngle = pInst->nAngle;
+    settings.nZoom = pInst->nZoom;
+    settings.nKeystone = pInst->nKeystone;
+    pInst->settings.Publish(settings);
+}
+
 static LRESULT DoResetSettings(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
 {
-    s_nRotation = ROTATION_NONE;
-    s_nWindowX = CW_USEDEFAULT;
-    s_nWindowY = CW_USEDEFAULT;
+    ROTATION_INSTANCE *pInst = DoGetInstance(pi);
+    pInst->nRotation = ROTATION_NONE;
+    pInst->nThreads = 0;
+    pInst->nAngle = 0;
+    pInst->nZoom = 100;
+    pInst->nKeystone = 0;
+    pInst->nIsa = PLUGIN_ISA_AUTO;
+    pInst->nWindowX = CW_USEDEFAULT;
+    pInst->nWindowY = CW_USEDEFAULT;
+    DoPublishSettings(pInst);
     return 0;
 }
 
 static LRESULT DoLoadSettings(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
 {
+    ROTATION_INSTANCE *pInst = DoGetInstance(pi);
     DoResetSettings(pi, wParam, lParam);
 
     MRegKey hkeyCompany(HKEY_CURRENT_USER,
@@ -75,32 +797,50 @@ static LRESULT DoLoadSettings(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
     if (!hkeyCompany)
         return FALSE;
 
-    MRegKey hkeyApp(hkeyCompany, TEXT("Rotation_yap"), FALSE);
+    TCHAR szKey[64];
+    DoGetAppKeyName(pInst, szKey, _countof(szKey));
+    MRegKey hkeyApp(hkeyCompany, szKey, FALSE);
     if (!hkeyApp)
         return FALSE;
 
-    hkeyApp.QueryDword(TEXT("WindowX"), (DWORD&)s_nWindowX);
-    hkeyApp.QueryDword(TEXT("WindowY"), (DWORD&)s_nWindowY);
-    hkeyApp.QueryDword(TEXT("Rotation"), (DWORD&)s_nRotation);
+    hkeyApp.QueryDword(TEXT("WindowX"), (DWORD&)pInst->nWindowX);
+    hkeyApp.QueryDword(TEXT("WindowY"), (DWORD&)pInst->nWindowY);
+    hkeyApp.QueryDword(TEXT("Rotation"), (DWORD&)pInst->nRotation);
+    hkeyApp.QueryDword(TEXT("Threads"), (DWORD&)pInst->nThreads);
+    hkeyApp.QueryDword(TEXT("Angle"), (DWORD&)pInst->nAngle);
+    hkeyApp.QueryDword(TEXT("Zoom"), (DWORD&)pInst->nZoom);
+    hkeyApp.QueryDword(TEXT("Keystone"), (DWORD&)pInst->nKeystone);
+    pInst->nZoom = std::max(ZOOM_MIN, std::min(pInst->nZoom, ZOOM_MAX));
+    pInst->nKeystone = std::max(-KEYSTONE_MAX, std::min(pInst->nKeystone, KEYSTONE_MAX));
+    hkeyApp.QueryDword(TEXT("Isa"), (DWORD&)pInst->nIsa);
+    DoPublishSettings(pInst);
 
     return TRUE;
 }
 
 static LRESULT DoSaveSettings(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
 {
+    ROTATION_INSTANCE *pInst = DoGetInstance(pi);
     MRegKey hkeyCompany(HKEY_CURRENT_USER,
                         TEXT("Software\\Katayama Hirofumi MZ"),
                         TRUE);
     if (!hkeyCompany)
         return FALSE;
 
-    MRegKey hkeyApp(hkeyCompany, TEXT("Rotation_yap"), TRUE);
+    TCHAR szKey[64];
+    DoGetAppKeyName(pInst, szKey, _countof(szKey));
+    MRegKey hkeyApp(hkeyCompany, szKey, TRUE);
     if (!hkeyApp)
         return FALSE;
 
-    hkeyApp.SetDword(TEXT("WindowX"), s_nWindowX);
-    hkeyApp.SetDword(TEXT("WindowY"), s_nWindowY);
-    hkeyApp.SetDword(TEXT("Rotation"), s_nRotation);
+    hkeyApp.SetDword(TEXT("WindowX"), pInst->nWindowX);
+    hkeyApp.SetDword(TEXT("WindowY"), pInst->nWindowY);
+    hkeyApp.SetDword(TEXT("Rotation"), pInst->nRotation);
+    hkeyApp.SetDword(TEXT("Threads"), pInst->nThreads);
+    hkeyApp.SetDword(TEXT("Angle"), pInst->nAngle);
+    hkeyApp.SetDword(TEXT("Zoom"), pInst->nZoom);
+    hkeyApp.SetDword(TEXT("Keystone"), pInst->nKeystone);
+    hkeyApp.SetDword(TEXT("Isa"), pInst->nIsa);
 
     return TRUE;
 }
@@ -133,19 +873,45 @@ Plugin_Load(PLUGIN *pi, LPARAM lParam)
     }
 
     pi->plugin_version = 1;
+#ifndef PLUGIN_HEADLESS
     StringCbCopy(pi->plugin_product_name, sizeof(pi->plugin_product_name), LoadStringDx(IDS_TITLE));
+#else
+    StringCbCopy(pi->plugin_product_name, sizeof(pi->plugin_product_name), TEXT("Rotation"));
+#endif
     StringCbCopy(pi->plugin_filename, sizeof(pi->plugin_filename), TEXT("Rotation.yap"));
     StringCbCopy(pi->plugin_company, sizeof(pi->plugin_company), TEXT("Katayama Hirofumi MZ"));
     StringCbCopy(pi->plugin_copyright, sizeof(pi->plugin_copyright), TEXT("Copyright (C) 2019 Katayama Hirofumi MZ"));
+    ROTATION_INSTANCE *pInst = new(std::nothrow) ROTATION_INSTANCE();
+    if (!pInst)
+        return FALSE;
+    pInst->pi = pi;
+    pInst->dwInstance = (DWORD)lParam;
+    pInst->pAllocator = PluginAllocator_Get(pi);
+    pInst->piSpans = NULL;
+#ifdef PLUGIN_PHASES
+    for (INT i = ROTATION_90; i <= ROTATION_CUSTOM; ++i)
+    {
+        pInst->apllNanos[i] = PluginStats_Counter(pi, s_apszModeCounters[i]);
+    }
+#endif
+
     pi->plugin_instance = s_hinstDLL;
     pi->plugin_window = NULL;
-    pi->p_user_data = NULL;
+    pi->p_user_data = pInst;
     pi->l_user_data = 0;
-    pi->dwFlags = PLUGIN_FLAG_PICWRITER;
+    pi->dwFlags = PLUGIN_FLAG_PICWRITER | PLUGIN_FLAG_BATCH;
     pi->bEnabled = FALSE;
     DoLoadSettings(pi, 0, 0);
 
-    s_pi = pi;
+    pInst->isa = PluginCpu_Select(pInst->nIsa);
+    pInst->simd.kernels24 = DoSelectKernels24(pInst->isa);
+    pInst->simd.kernels32 = DoSelectKernels32(pInst->isa);
+    PluginCounter *pllIsa = PluginStats_Counter(pi, "isa");
+    PluginStats_Set(pllIsa, pInst->isa);
+
+    PLUGIN_TRACE_INIT();
+    PLUGIN_TRACEA("Rotation.yap #%lu: %s kernels", (unsigned long)pInst->dwInstance,
+                  PluginCpu_GetName(pInst->isa));
 
     return TRUE;
 }
@@ -156,8 +922,20 @@ Plugin_Load(PLUGIN *pi, LPARAM lParam)
 BOOL APIENTRY
 Plugin_Unload(PLUGIN *pi, LPARAM lParam)
 {
+    ROTATION_INSTANCE *pInst = DoGetInstance(pi);
+    if (!pInst)
+        return FALSE;
+
+    if (IsWindow(pi->plugin_window))
+        DestroyWindow(pi->plugin_window);
+
     DoSaveSettings(pi, 0, 0);
-    s_pi = NULL;
+
+    DoStopWorkers(pInst->pool);
+    pi->p_user_data = NULL;
+    delete pInst;
+
+    PLUGIN_TRACE_EXIT();
     return TRUE;
 }
 
@@ -167,47 +945,141 @@ inline LRESULT Plugin_PicRead(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
     return 0;
 }
 
-static LRESULT Plugin_PicWrite(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
+// Rotates mat with the workers, the SIMD kernels, the warp maps
+// and the spare buffer.  Returns false if the frame is left untouched.
+static bool DoRotate(ROTATION_POOL& pool, const ROTATION_KERNEL_SET& simd,
+                     WARP_MAPS& warp, cv::Mat& matSpare,
+                     PLUGIN *piSpans, cv::Mat& mat,
+                     const ROTATION_SETTINGS& settings)
 {
-    cv::Mat *pmat = (cv::Mat *)wParam;
-    if (!pmat || !pmat->data)
-        return 0;
-
-    cv::Mat& mat = *pmat;
-    cv::Mat image1;
-    switch (s_nRotation)
+    const ROTATION nRotation = settings.nRotation;
+    switch (nRotation)
     {
     case ROTATION_NONE:
     default:
-        break;
+        return false;
     case ROTATION_90:
-        cv::transpose(mat, image1);
-        cv::flip(image1, mat, 1);
-        break;
-    case ROTATION_180:
-        cv::flip(mat, image1, 0);
-        cv::flip(image1, mat, 1);
-        break;
     case ROTATION_270:
-        cv::transpose(mat, image1);
-        cv::flip(image1, mat, 0);
+        {
+            PluginSpan span(piSpans, "transpose", "Rotation.yap");
+
+            // rotate into the spare buffer, then trade it for the frame buffer
+            if (DoRotateFast(pool, simd, mat, matSpare, nRotation))
+            {
+                cv::swap(mat, matSpare);
+                break;
+            }
+            cv::transpose(mat, matSpare);
+            cv::flip(matSpare, mat, (nRotation == ROTATION_90) ? 1 : 0);
+        }
         break;
+    case ROTATION_180:
     case ROTATION_FLIPH:
-        cv::flip(mat, image1, 1);
-        mat = image1;
-        break;
     case ROTATION_FLIPV:
-        cv::flip(mat, image1, 0);
-        mat = image1;
+        {
+            PluginSpan span(piSpans, "flip", "Rotation.yap");
+            DoRotateInPlace(pool, simd, mat, nRotation);
+        }
+        break;
+    case ROTATION_CUSTOM:
+        if (DoIsIdentityWarp(settings.nAngle, settings.nZoom, settings.nKeystone))
+            return false;
+        {
+            PluginSpan span(piSpans, "warp", "Rotation.yap");
+            DoWarp(warp, mat, matSpare, settings.nAngle, settings.nZoom,
+                   settings.nKeystone);
+            cv::swap(mat, matSpare);
+        }
         break;
     }
+    return true;
+}
+
+// Returns false if the frame is left untouched.
+static bool DoRotateFrame(ROTATION_INSTANCE *pInst, cv::Mat& mat,
+                          const ROTATION_SETTINGS& settings)
+{
+    const ROTATION nRotation = settings.nRotation;
+
+#ifdef PLUGIN_TRACE
+    if (pInst->sizeTrace != mat.size() || pInst->nTypeTrace != mat.type() ||
+        pInst->nRotationTrace != nRotation)
+    {
+        pInst->sizeTrace = mat.size();
+        pInst->nTypeTrace = mat.type();
+        pInst->nRotationTrace = nRotation;
+        PLUGIN_TRACEA("Rotation.yap #%lu: %dx%d type %d, rotation %d",
+                      (unsigned long)pInst->dwInstance, mat.cols, mat.rows, mat.type(),
+                      nRotation);
+    }
+#endif
+
+    // the spare buffer may have come from the host by the last swap
+    pInst->matSpare.allocator = pInst->pAllocator;
+
+#ifdef PLUGIN_PHASES
+    PluginCounter *pllNanos = NULL;
+    if (nRotation >= ROTATION_NONE && nRotation <= ROTATION_CUSTOM)
+        pllNanos = pInst->apllNanos[nRotation];
+#endif
+    PLUGIN_PHASE_TIMER(pllNanos);
+
+    return DoRotate(pInst->pool, pInst->simd, pInst->warp, pInst->matSpare,
+                    pInst->piSpans, mat, settings);
+}
+
+static LRESULT Plugin_PicWrite(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
+{
+    cv::Mat *pmat = (cv::Mat *)wParam;
+    if (!pmat || !pmat->data)
+        return 0;
+
+    ROTATION_INSTANCE *pInst = DoGetInstance(pi);
+    PluginSnapshot<ROTATION_SETTINGS>::Pin settings(pInst->settings);
+    if (settings->nRotation != ROTATION_NONE)
+        DoStartWorkers(pInst->pool, settings->nThreads);
+    pInst->piSpans = PluginSpans_GetTarget(pi);
+
+    bool bModified = DoRotateFrame(pInst, *pmat, *settings);
+
+    // a rotated frame may have a new size, so it is all dirty
+    PLUGIN_FRAME_INFO *pInfo = (PLUGIN_FRAME_INFO *)lParam;
+    if (pInfo && pInfo->cbSize >= sizeof(PLUGIN_FRAME_INFO))
+        pInfo->nDirtyRects = bModified ? PLUGIN_DIRTY_ALL : 0;
+    return 0;
+}
+
+// All the frames of a batch share the settings, the workers and the spare
+// buffer.
+static LRESULT Plugin_PicWriteBatch(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
+{
+    const PLUGIN_BATCH *pBatch = (const PLUGIN_BATCH *)wParam;
+    if (!pBatch || pBatch->cbSize < sizeof(PLUGIN_BATCH) || !pBatch->ppmat)
+        return 0;
+
+    ROTATION_INSTANCE *pInst = DoGetInstance(pi);
+    PluginSnapshot<ROTATION_SETTINGS>::Pin settings(pInst->settings);
+    if (settings->nRotation == ROTATION_NONE)
+        return 0;
+
+    DoStartWorkers(pInst->pool, settings->nThreads);
+    pInst->piSpans = PluginSpans_GetTarget(pi);
 
+    for (UINT i = 0; i < pBatch->nCount; ++i)
+    {
+        cv::Mat *pmat = pBatch->ppmat[i];
+        if (pmat && pmat->data)
+            DoRotateFrame(pInst, *pmat, *settings);
+    }
     return 0;
 }
 
+#ifndef PLUGIN_HEADLESS
 static BOOL OnInitDialog(HWND hwnd, HWND hwndFocus, LPARAM lParam)
 {
-    s_pi->plugin_window = hwnd;
+    ROTATION_INSTANCE *pInst = (ROTATION_INSTANCE *)lParam;
+    SetWindowLongPtr(hwnd, DWLP_USER, lParam);
+    pInst->pi->plugin_window = hwnd;
 
     HWND hCmb1 = GetDlgItem(hwnd, cmb1);
     ComboBox_AddString(hCmb1, LoadStringDx(IDS_ROTATION_NONE));
@@ -216,8 +1088,9 @@ static BOOL OnInitDialog(HWND hwnd, HWND hwndFocus, LPARAM lParam)
     ComboBox_AddString(hCmb1, LoadStringDx(IDS_ROTATION_270));
     ComboBox_AddString(hCmb1, LoadStringDx(IDS_FLIPH));
     ComboBox_AddString(hCmb1, LoadStringDx(IDS_FLIPV));
+    ComboBox_AddString(hCmb1, LoadStringDx(IDS_ROTATION_CUSTOM));
 
-    switch (s_nRotation)
+    switch (pInst->nRotation)
     {
     case ROTATION_NONE:
         ComboBox_SetCurSel(hCmb1, 0);
@@ -237,25 +1110,106 @@ static BOOL OnInitDialog(HWND hwnd, HWND hwndFocus, LPARAM lParam)
     case ROTATION_FLIPV:
         ComboBox_SetCurSel(hCmb1, 5);
         break;
+    case ROTATION_CUSTOM:
+        ComboBox_SetCurSel(hCmb1, 6);
+        break;
     }
 
-    s_bDialogInit = TRUE;
+    SendDlgItemMessage(hwnd, scr1, UDM_SETRANGE, 0, MAKELONG(MAX_THREADS, 0));
+    SendDlgItemMessage(hwnd, scr1, UDM_SETPOS, 0, MAKELONG(pInst->nThreads, 0));
+
+    TCHAR szText[64];
+    StringCchPrintf(szText, _countof(szText), TEXT("%.1f"), pInst->nAngle / 10.0);
+    SetDlgItemText(hwnd, edt2, szText);
+
+    SendDlgItemMessage(hwnd, scr3, UDM_SETRANGE, 0, MAKELONG(ZOOM_MAX, ZOOM_MIN));
+    SendDlgItemMessage(hwnd, scr3, UDM_SETPOS, 0, MAKELONG(pInst->nZoom, 0));
+
+    SendDlgItemMessage(hwnd, scr4, UDM_SETRANGE, 0, MAKELONG(KEYSTONE_MAX, -KEYSTONE_MAX));
+    SendDlgItemMessage(hwnd, scr4, UDM_SETPOS, 0, MAKELONG(pInst->nKeystone, 0));
+
+    pInst->bDialogInit = TRUE;
     return TRUE;
 }
 
 static void OnCmb1(HWND hwnd)
 {
-    if (!s_bDialogInit)
+    ROTATION_INSTANCE *pInst = DoGetDialogInstance(hwnd);
+    if (!pInst || !pInst->bDialogInit)
         return;
 
     HWND hCmb1 = GetDlgItem(hwnd, cmb1);
 
     TCHAR szText[MAX_PATH];
     INT iItem = ComboBox_GetCurSel(hCmb1);
-    if (iItem == CB_ERR || iItem > ROTATION_FLIPV)
+    if (iItem == CB_ERR || iItem > ROTATION_CUSTOM)
+        return;
+
+    pInst->nRotation = (ROTATION)iItem;
+    DoPublishSettings(pInst);
+}
+
+static void OnEdt1(HWND hwnd)
+{
+    ROTATION_INSTANCE *pInst = DoGetDialogInstance(hwnd);
+    if (!pInst || !pInst->bDialogInit)
+        return;
+
+    BOOL bTranslated = FALSE;
+    INT nValue = GetDlgItemInt(hwnd, edt1, &bTranslated, FALSE);
+    if (bTranslated && nValue <= MAX_THREADS)
+    {
+        pInst->nThreads = nValue;
+        DoPublishSettings(pInst);
+    }
+}
+
+static void OnEdt2(HWND hwnd)
+{
+    ROTATION_INSTANCE *pInst = DoGetDialogInstance(hwnd);
+    if (!pInst || !pInst->bDialogInit)
+        return;
+
+    TCHAR szText[64];
+    GetDlgItemText(hwnd, edt2, szText, _countof(szText));
+
+    LPTSTR pchEnd;
+    double eAngle = _tcstod(szText, &pchEnd);
+    if (pchEnd != szText && -360 <= eAngle && eAngle <= 360)
+    {
+        pInst->nAngle = (INT)floor(eAngle * 10 + 0.5);
+        DoPublishSettings(pInst);
+    }
+}
+
+static void OnEdt3(HWND hwnd)
+{
+    ROTATION_INSTANCE *pInst = DoGetDialogInstance(hwnd);
+    if (!pInst || !pInst->bDialogInit)
+        return;
+
+    BOOL bTranslated = FALSE;
+    INT nValue = GetDlgItemInt(hwnd, edt3, &bTranslated, FALSE);
+    if (bTranslated && ZOOM_MIN <= nValue && nValue <= ZOOM_MAX)
+    {
+        pInst->nZoom = nValue;
+        DoPublishSettings(pInst);
+    }
+}
+
+static void OnEdt4(HWND hwnd)
+{
+    ROTATION_INSTANCE *pInst = DoGetDialogInstance(hwnd);
+    if (!pInst || !pInst->bDialogInit)
         return;
 
-    s_nRotation = (ROTATION)iItem;
+    BOOL bTranslated = FALSE;
+    INT nValue = GetDlgItemInt(hwnd, edt4, &bTranslated, TRUE);
+    if (bTranslated && -KEYSTONE_MAX <= nValue && nValue <= KEYSTONE_MAX)
+    {
+        pInst->nKeystone = nValue;
+        DoPublishSettings(pInst);
+    }
 }
 
 static void OnCommand(HWND hwnd, int id, HWND hwndCtl, UINT codeNotify)
@@ -280,24 +1234,57 @@ static void OnCommand(HWND hwnd, int id, HWND hwndCtl, UINT codeNotify)
             break;
         }
         break;
+    case edt1:
+        if (codeNotify == EN_CHANGE)
+        {
+            OnEdt1(hwnd);
+        }
+        break;
+    case edt2:
+        if (codeNotify == EN_CHANGE)
+        {
+            OnEdt2(hwnd);
+        }
+        break;
+    case edt3:
+        if (codeNotify == EN_CHANGE)
+        {
+            OnEdt3(hwnd);
+        }
+        break;
+    case edt4:
+        if (codeNotify == EN_CHANGE)
+        {
+            OnEdt4(hwnd);
+        }
+        break;
     }
 }
 
 static void OnDestroy(HWND hwnd)
 {
-    s_pi->plugin_window = NULL;
-    s_bDialogInit = FALSE;
+    ROTATION_INSTANCE *pInst = DoGetDialogInstance(hwnd);
+    if (!pInst)
+        return;
+
+    pInst->pi->plugin_window = NULL;
+    pInst->bDialogInit = FALSE;
 }
 
 static void OnMove(HWND hwnd, int x, int y)
 {
+    // WM_MOVE comes before WM_INITDIALOG
+    ROTATION_INSTANCE *pInst = DoGetDialogInstance(hwnd);
+    if (!pInst)
+        return;
+
     if (IsMinimized(hwnd) || IsMaximized(hwnd))
         return;
 
     RECT rc;
     GetWindowRect(hwnd, &rc);
-    s_nWindowX = rc.left;
-    s_nWindowY = rc.top;
+    pInst->nWindowX = rc.left;
+    pInst->nWindowY = rc.top;
 }
 
 static INT_PTR CALLBACK
@@ -318,8 +1305,6 @@ static LRESULT Plugin_ShowDialog(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
     HWND hMainWnd = (HWND)wParam;
     BOOL bShowOrHide = (BOOL)lParam;
 
-    s_pi = pi;
-
     if (bShowOrHide)
     {
         if (IsWindow(pi->plugin_window))
@@ -332,7 +1317,8 @@ static LRESULT Plugin_ShowDialog(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
         }
         else
         {
-            CreateDialog(s_hinstDLL, MAKEINTRESOURCE(IDD_CONFIG), hMainWnd, DialogProc);
+            CreateDialogParam(s_hinstDLL, MAKEINTRESOURCE(IDD_CONFIG), hMainWnd,
+                              DialogProc, (LPARAM)DoGetInstance(pi));
             if (pi->plugin_window)
             {
                 ShowWindow(pi->plugin_window, SW_SHOWNORMAL);
@@ -349,11 +1335,15 @@ static LRESULT Plugin_ShowDialog(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
 
     return FALSE;
 }
+#else
+static LRESULT Plugin_ShowDialog(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
+{
+    return FALSE;
+}
+#endif  // ndef PLUGIN_HEADLESS
 
 static LRESULT Plugin_Refresh(PLUGIN *pi, WPARAM wParam, LPARAM lParam)
 {
-    s_pi = pi;
-
     if (BOOL bResetSettings = (BOOL)wParam)
     {
         DoResetSettings(pi, 0, 0);
@@ -377,6 +1367,8 @@ Plugin_Act(PLUGIN *pi, UINT uAction, WPARAM wParam, LPARAM lParam)
         return Plugin_PicRead(pi, wParam, lParam);
     case PLUGIN_ACTION_PICWRITE:
         return Plugin_PicWrite(pi, wParam, lParam);
+    case PLUGIN_ACTION_PICWRITE_BATCH:
+        return Plugin_PicWriteBatch(pi, wParam, lParam);
     case PLUGIN_ACTION_SHOWDIALOG:
         return Plugin_ShowDialog(pi, wParam, lParam);
     case PLUGIN_ACTION_REFRESH:
@@ -385,6 +1377,7 @@ Plugin_Act(PLUGIN *pi, UINT uAction, WPARAM wParam, LPARAM lParam)
     return 0;
 }
 
+#ifndef PLUGIN_HEADLESS
 BOOL WINAPI
 DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 {
@@ -399,5 +1392,6 @@ DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
     }
     return TRUE;
 }
+#endif
 
 } // extern "C"
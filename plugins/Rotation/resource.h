@@ -14,6 +14,7 @@
 #define IDS_ROTATION_270                    104
 #define IDS_FLIPH                           105
 #define IDS_FLIPV                           106
+#define IDS_ROTATION_CUSTOM                 107
 
 #ifdef APSTUDIO_INVOKED
     #ifndef APSTUDIO_READONLY_SYMBOLS
@@ -0,0 +1,76 @@
+// PluginTest.h --- PluginFramework headless tests
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#ifndef PLUGIN_TEST_H_
+#define PLUGIN_TEST_H_
+
+// NOTE: The tests link the plugins in (PLUGIN_STATIC) and drive them through
+//       a PluginHost, as a host would.  A test sets the settings of a plugin
+//       by MRegKey before it loads the plugin, and loads it again whenever
+//       they change.  The hosts of the tests use the stream
+//       PLUGIN_TEST_STREAM, so that the settings go to a subkey of their own
+//       and never change those of a real stream.
+//
+//       The random cases are seeded, so that a failure can be repeated.  A
+//       failure is printed to stderr and counted; a test returns the number
+//       of its failures.
+
+#include "../host/PluginHost.h"
+#ifdef _WIN32
+    #include "../plugins/mregkey.hpp"
+#endif
+#include <cstdio>
+
+#define PLUGIN_TEST_STREAM 9000
+
+// The sizes of the random frames are up to this, and then some are cut to
+// a row or a column.
+#define PLUGIN_TEST_MAX_SIZE 640
+
+PLUGIN_DECLARE_STATIC(Clock)
+PLUGIN_DECLARE_STATIC(Rotation)
+
+typedef INT (*PLUGIN_TEST_PROC)(void);
+
+INT Test_Rotation(void);
+INT Test_Clock(void);
+INT Test_Composite(void);
+INT Test_Alloc(void);
+INT Test_Stress(void);
+
+// Prints a failure.  Returns 1, for the count of the failures.
+INT PluginTest_Fail(const char *pszFormat, ...);
+
+// Sets a setting of the plugin of pszApp ("Clock_yap" etc.) for the stream
+// PLUGIN_TEST_STREAM.  It is read by the next Plugin_Load.
+void PluginTest_SetDword(LPCTSTR pszApp, LPCTSTR pszName, DWORD dwValue);
+void PluginTest_SetSz(LPCTSTR pszApp, LPCTSTR pszName, LPCTSTR pszValue);
+
+// The same for the stream dwStreamID, for the tests that run several
+// streams with settings of their own.
+void PluginTest_SetStreamDword(DWORD dwStreamID, LPCTSTR pszApp,
+                               LPCTSTR pszName, DWORD dwValue);
+void PluginTest_SetStreamSz(DWORD dwStreamID, LPCTSTR pszApp,
+                            LPCTSTR pszName, LPCTSTR pszValue);
+
+// A random frame size.  One in eight is a single row and one in eight is a
+// single column.
+cv::Size PluginTest_RandomSize(cv::RNG& rng);
+
+// Makes a frame of random values.  Half of the frames are views into a
+// larger buffer, so that their rows are not continuous.
+cv::Mat PluginTest_RandomFrame(cv::RNG& rng, cv::Size size, int type);
+
+// Returns the largest difference of the values of two frames, or -1 if
+// their sizes or types differ.
+double PluginTest_MaxError(const cv::Mat& mat1, const cv::Mat& mat2);
+
+// Returns the tolerance in the environment variable pszName, e.g.
+// YAPTEST_CLOCK_MAX_ERROR=64, or eDefault if it is not set.
+double PluginTest_GetTolerance(const char *pszName, double eDefault);
+
+// Returns the value of a counter of the plugin, or -1 if there is none.
+LONGLONG PluginTest_GetCounter(PluginHost& host, PLUGIN *pi,
+                               const char *pszName);
+
+#endif  // ndef PLUGIN_TEST_H_
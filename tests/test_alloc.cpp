@@ -0,0 +1,260 @@
+// test_alloc.cpp --- PluginFramework tests of the allocations of the frame paths
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "PluginTest.h"
+#include "../plugins/PluginCpu.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// After a few frames of warm-up, a plugin must write the frames of a steady
+// stream without allocating: neither a buffer of the allocator of the host
+// (PLUGIN_ALLOC_STATS) nor anything else by operator new, which also counts
+// the cv::UMatData of every cv::Mat buffer and the containers.  This runs
+// Clock.yap with a caption that changes every frame and Rotation.yap in
+// every mode, with one and several workers.
+//
+// A host that submits a new frame of the allocator each time must get the
+// buffers and their cv::UMatData from the pool, without operator new.
+
+#define ALLOC_WARM_UP_FRAMES 3
+#define ALLOC_TEST_FRAMES 30
+
+// The calls of operator new of all the threads.
+static std::atomic<ULONGLONG> s_ullNews(0);
+
+void *operator new(size_t cb)
+{
+    s_ullNews.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(cb ? cb : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t cb)
+{
+    return operator new(cb);
+}
+
+void *operator new(size_t cb, const std::nothrow_t&) throw()
+{
+    s_ullNews.fetch_add(1, std::memory_order_relaxed);
+    return malloc(cb ? cb : 1);
+}
+
+void *operator new[](size_t cb, const std::nothrow_t& nt) throw()
+{
+    return operator new(cb, nt);
+}
+
+void operator delete(void *p) throw()
+{
+    free(p);
+}
+
+void operator delete[](void *p) throw()
+{
+    free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t&) throw()
+{
+    free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t&) throw()
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) throw()
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) throw()
+{
+    free(p);
+}
+
+struct ALLOC_CASE
+{
+    const char *pszName;
+    int type;
+    cv::Size size;
+};
+
+static const ALLOC_CASE s_cases[] =
+{
+    { "640x480 8UC3", CV_8UC3, cv::Size(640, 480) },
+    { "333x201 8UC4", CV_8UC4, cv::Size(333, 201) },
+    { "160x120 16UC1", CV_16UC1, cv::Size(160, 120) },
+};
+
+static const INT s_anThreads[] = { 1, 4 };
+
+// Writes the frames on one frame, as the capture thread of a host does with
+// its buffer, and counts the allocations after the warm-up.
+static INT DoCheckFrames(PluginHost& host, PLUGIN *pi, const char *pszPlugin,
+                         const ALLOC_CASE& ac)
+{
+    cv::Mat mat;
+    mat.allocator = &host.GetAllocator();
+    mat.create(ac.size, ac.type);
+    mat.setTo(cv::Scalar::all(100));
+
+    PLUGIN_FRAME_INFO info;
+    memset(&info, 0, sizeof(info));
+    info.cbSize = sizeof(info);
+    info.dwStreamID = PLUGIN_TEST_STREAM;
+    info.llCaptureTime = 132000000000000000LL;
+    info.nFormat = ac.type;
+
+    PLUGIN_ALLOC_STATS stats;
+    ULONGLONG ullAllocs = 0, ullNews = 0;
+    for (INT iFrame = 0; iFrame < ALLOC_WARM_UP_FRAMES + ALLOC_TEST_FRAMES; ++iFrame)
+    {
+        if (iFrame == ALLOC_WARM_UP_FRAMES)
+        {
+            host.GetAllocator().GetStats(stats);
+            ullAllocs = stats.ullAllocs;
+            ullNews = s_ullNews.load();
+        }
+
+        info.ullFrameIndex = iFrame;
+        info.llCaptureTime += 333333;   // 30 fps, so that the caption changes
+        info.nDirtyRects = PLUGIN_DIRTY_ALL;
+        host.Act(pi, PLUGIN_ACTION_PICWRITE, (WPARAM)&mat, (LPARAM)&info);
+    }
+
+    host.GetAllocator().GetStats(stats);
+    ullAllocs = stats.ullAllocs - ullAllocs;
+    ullNews = s_ullNews.load() - ullNews;
+    if (ullAllocs == 0 && ullNews == 0)
+        return 0;
+
+    return PluginTest_Fail("alloc %s, %s: %llu buffers and %llu news in %d frames",
+                           pszPlugin, ac.pszName, ullAllocs, ullNews,
+                           ALLOC_TEST_FRAMES);
+}
+
+static INT DoTestClock(const ALLOC_CASE& ac)
+{
+    PluginTest_SetDword(TEXT("Clock_yap"), TEXT("Scale"), 100);
+    PluginTest_SetDword(TEXT("Clock_yap"), TEXT("Thickness"), 2);
+    PluginTest_SetDword(TEXT("Clock_yap"), TEXT("Align"), 2);
+    PluginTest_SetDword(TEXT("Clock_yap"), TEXT("VAlign"), 2);
+    PluginTest_SetDword(TEXT("Clock_yap"), TEXT("Margin"), 8);
+    PluginTest_SetSz(TEXT("Clock_yap"), TEXT("Caption"),
+                     TEXT("&y.&M.&d &h:&m:&s.&f"));
+    PluginTest_SetDword(TEXT("Clock_yap"), TEXT("Isa"), PLUGIN_ISA_AUTO);
+
+    PluginHost host(PLUGIN_TEST_STREAM);
+    PLUGIN *pi = host.LoadEntries(Clock_Plugin_Load, Clock_Plugin_Unload,
+                                  Clock_Plugin_Act);
+    if (!pi)
+        return PluginTest_Fail("Clock.yap not loaded");
+
+    INT nFailures = DoCheckFrames(host, pi, "Clock", ac);
+    host.UnloadAll();
+    return nFailures;
+}
+
+static INT DoTestRotation(const ALLOC_CASE& ac, INT nRotation, INT nThreads)
+{
+    PluginTest_SetDword(TEXT("Rotation_yap"), TEXT("Rotation"), nRotation);
+    PluginTest_SetDword(TEXT("Rotation_yap"), TEXT("Angle"), 150);
+    PluginTest_SetDword(TEXT("Rotation_yap"), TEXT("Zoom"), 120);
+    PluginTest_SetDword(TEXT("Rotation_yap"), TEXT("Keystone"), 10);
+    PluginTest_SetDword(TEXT("Rotation_yap"), TEXT("Threads"), nThreads);
+    PluginTest_SetDword(TEXT("Rotation_yap"), TEXT("Isa"), PLUGIN_ISA_AUTO);
+
+    PluginHost host(PLUGIN_TEST_STREAM);
+    PLUGIN *pi = host.LoadEntries(Rotation_Plugin_Load, Rotation_Plugin_Unload,
+                                  Rotation_Plugin_Act);
+    if (!pi)
+        return PluginTest_Fail("Rotation.yap not loaded");
+
+    char szName[64];
+    StringCbPrintfA(szName, sizeof(szName), "Rotation %d, %d threads",
+                    nRotation, nThreads);
+    INT nFailures = DoCheckFrames(host, pi, szName, ac);
+    host.UnloadAll();
+    return nFailures;
+}
+
+// Submits a new frame of the allocator each time, as the capture thread of
+// a host does, through Rotation.yap.
+static INT DoTestSubmit(const ALLOC_CASE& ac)
+{
+    PluginTest_SetDword(TEXT("Rotation_yap"), TEXT("Rotation"), 1);    // 90
+    PluginTest_SetDword(TEXT("Rotation_yap"), TEXT("Threads"), 1);
+    PluginTest_SetDword(TEXT("Rotation_yap"), TEXT("Isa"), PLUGIN_ISA_AUTO);
+
+    PluginHost host(PLUGIN_TEST_STREAM);
+    PLUGIN *pi = host.LoadEntries(Rotation_Plugin_Load, Rotation_Plugin_Unload,
+                                  Rotation_Plugin_Act);
+    if (!pi)
+        return PluginTest_Fail("Rotation.yap not loaded");
+    pi->bEnabled = TRUE;
+
+    PLUGIN_FRAME_INFO info;
+    memset(&info, 0, sizeof(info));
+    info.cbSize = sizeof(info);
+    info.dwStreamID = PLUGIN_TEST_STREAM;
+
+    PLUGIN_ALLOC_STATS stats;
+    ULONGLONG ullMisses = 0, ullNews = 0;
+    host.Start(PLUGIN_HOST_INLINE, NULL, NULL);
+    for (INT iFrame = 0; iFrame < ALLOC_WARM_UP_FRAMES + ALLOC_TEST_FRAMES; ++iFrame)
+    {
+        if (iFrame == ALLOC_WARM_UP_FRAMES)
+        {
+            host.GetAllocator().GetStats(stats);
+            ullMisses = stats.ullAllocs - stats.ullHits;
+            ullNews = s_ullNews.load();
+        }
+
+        cv::Mat mat;
+        mat.allocator = &host.GetAllocator();
+        mat.create(ac.size, ac.type);
+        info.ullFrameIndex = iFrame;
+        host.Submit(mat, &info);
+    }
+
+    host.GetAllocator().GetStats(stats);
+    ullMisses = (stats.ullAllocs - stats.ullHits) - ullMisses;
+    ullNews = s_ullNews.load() - ullNews;
+    host.Stop();
+    host.UnloadAll();
+    if (ullMisses == 0 && ullNews == 0)
+        return 0;
+
+    return PluginTest_Fail("alloc Submit, %s: %llu buffers and %llu news in %d "
+                           "frames", ac.pszName, ullMisses, ullNews,
+                           ALLOC_TEST_FRAMES);
+}
+
+INT Test_Alloc(void)
+{
+    INT nFailures = 0;
+    for (size_t iCase = 0; iCase < ARRAYSIZE(s_cases); ++iCase)
+    {
+        const ALLOC_CASE& ac = s_cases[iCase];
+        if (ac.type == CV_8UC3 || ac.type == CV_8UC4)
+            nFailures += DoTestClock(ac);
+        nFailures += DoTestSubmit(ac);
+
+        // ROTATION_NONE (0) to ROTATION_CUSTOM (6)
+        for (INT nRotation = 0; nRotation <= 6; ++nRotation)
+        {
+            for (size_t i = 0; i < ARRAYSIZE(s_anThreads); ++i)
+            {
+                nFailures += DoTestRotation(ac, nRotation, s_anThreads[i]);
+            }
+        }
+    }
+    return nFailures;
+}
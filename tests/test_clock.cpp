@@ -0,0 +1,388 @@
+// test_clock.cpp --- PluginFramework headless tests of Clock.yap
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "PluginTest.h"
+#include "../plugins/PluginCpu.h"
+#include "../plugins/Clock/Clock_caption.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+// Each case draws a random caption with random settings at a fixed capture
+// time, on a black, a white and a random frame of the same size.
+//
+// - Every level of the kernels must give the plain level's frame bit for
+//   bit, and so must a text patch that is rebuilt after a frame of another
+//   size.
+// - The black and the white frames give the fill coverage f and the outline
+//   coverage o of each byte.  The random frame must be within 1 LSB of the
+//   exact blend dst * (1 - o) * (1 - f) + f.
+// - The bytes out of the dirty rectangle must not change.
+// - The random frame is drawn by DoDrawText as the putText fallback does,
+//   the outline (thickness * 3, black) and then the fill (thickness,
+//   white), and the glyph atlas must be close to it in the color channels.
+//   The error of a case is the largest difference of a byte and the mean
+//   difference of the bytes that either of them drew; their tolerances are
+//   YAPTEST_CLOCK_MAX_ERROR and YAPTEST_CLOCK_MEAN_ERROR (in LSB).
+
+#define CLOCK_TEST_CASES 40
+#define CLOCK_MAX_ERROR 96.0        // the defaults of the tolerances
+#define CLOCK_MEAN_ERROR 2.0
+
+// The caption fields of DoCompileCaption.
+static const char s_szFields[] = "yMdhmsf";
+
+struct CLOCK_CASE
+{
+    INT nScale;
+    INT nThickness;
+    INT nAlign;
+    INT nVAlign;
+    INT nMargin;
+    char szCaption[64];
+    int type;
+    cv::Size asize[2];              // the warm-up frame and the tested one
+    ULONGLONG ullSeed;              // of the random frame
+    LONGLONG llTime;                // a FILETIME
+};
+
+enum
+{
+    CLOCK_FRAME_BLACK,
+    CLOCK_FRAME_WHITE,
+    CLOCK_FRAME_RANDOM,
+    CLOCK_FRAME_COUNT
+};
+
+static void DoRandomCaption(cv::RNG& rng, char *psz, INT cch)
+{
+    INT ich = 0, nLength = rng.uniform(0, 24);
+    for (INT i = 0; i < nLength && ich + 3 < cch; ++i)
+    {
+        switch (rng.uniform(0, 4))
+        {
+        case 0:
+            psz[ich++] = '&';
+            psz[ich++] = s_szFields[rng.uniform(0, int(sizeof(s_szFields)) - 1)];
+            break;
+        case 1:
+            psz[ich++] = '&';
+            psz[ich++] = '&';
+            break;
+        default:
+            do
+            {
+                psz[ich] = char(rng.uniform(0x20, 0x7F));
+            } while (psz[ich] == '&');
+            ++ich;
+            break;
+        }
+    }
+    psz[ich] = 0;
+}
+
+static cv::Mat DoMakeFrame(const CLOCK_CASE& cc, INT iSize, INT iFrame)
+{
+    cv::Mat mat;
+    switch (iFrame)
+    {
+    case CLOCK_FRAME_BLACK:
+    case CLOCK_FRAME_WHITE:
+        mat.create(cc.asize[iSize], cc.type);
+        mat.setTo(cv::Scalar::all(iFrame == CLOCK_FRAME_WHITE ? 255 : 0));
+        break;
+    default:
+        {
+            cv::RNG rng(cc.ullSeed + iSize);
+            mat = PluginTest_RandomFrame(rng, cc.asize[iSize], cc.type);
+        }
+        break;
+    }
+    return mat;
+}
+
+// Loads Clock.yap with the settings of the case and draws the caption on a
+// frame of the other size and then on the three frames.  isa gets the level
+// that the plugin chose.
+static BOOL DoDrawFrames(const CLOCK_CASE& cc, PLUGIN_ISA isaCap,
+                         cv::Mat amat[CLOCK_FRAME_COUNT], cv::Rect& rcDirty,
+                         PLUGIN_ISA& isa)
+{
+    TCHAR szCaption[64];
+    for (INT ich = 0; ; ++ich)
+    {
+        szCaption[ich] = TCHAR(cc.szCaption[ich]);
+        if (!szCaption[ich])
+            break;
+    }
+
+    PluginTest_SetDword(TEXT("Clock_yap"), TEXT("Scale"), cc.nScale);
+    PluginTest_SetDword(TEXT("Clock_yap"), TEXT("Thickness"), cc.nThickness);
+    PluginTest_SetDword(TEXT("Clock_yap"), TEXT("Align"), cc.nAlign);
+    PluginTest_SetDword(TEXT("Clock_yap"), TEXT("VAlign"), cc.nVAlign);
+    PluginTest_SetDword(TEXT("Clock_yap"), TEXT("Margin"), cc.nMargin);
+    PluginTest_SetSz(TEXT("Clock_yap"), TEXT("Caption"), szCaption);
+    PluginTest_SetDword(TEXT("Clock_yap"), TEXT("Isa"), isaCap);
+
+    PluginHost host(PLUGIN_TEST_STREAM);
+    PLUGIN *pi = host.LoadEntries(Clock_Plugin_Load, Clock_Plugin_Unload,
+                                  Clock_Plugin_Act);
+    if (!pi)
+        return FALSE;
+    isa = PLUGIN_ISA(PluginTest_GetCounter(host, pi, "isa"));
+
+    PLUGIN_FRAME_INFO info;
+    memset(&info, 0, sizeof(info));
+    info.cbSize = sizeof(info);
+    info.dwStreamID = PLUGIN_TEST_STREAM;
+    info.llCaptureTime = cc.llTime;
+
+    cv::Mat matWarmUp = DoMakeFrame(cc, 0, CLOCK_FRAME_RANDOM);
+    info.nFormat = matWarmUp.type();
+    host.Act(pi, PLUGIN_ACTION_PICWRITE, (WPARAM)&matWarmUp, (LPARAM)&info);
+
+    for (INT iFrame = 0; iFrame < CLOCK_FRAME_COUNT; ++iFrame)
+    {
+        amat[iFrame] = DoMakeFrame(cc, 1, iFrame);
+        info.ullFrameIndex = iFrame + 1;
+        info.nDirtyRects = PLUGIN_DIRTY_ALL;
+        host.Act(pi, PLUGIN_ACTION_PICWRITE, (WPARAM)&amat[iFrame], (LPARAM)&info);
+
+        // the frame may be in the allocator of the host
+        amat[iFrame] = amat[iFrame].clone();
+    }
+    host.UnloadAll();
+
+    if (info.nDirtyRects == PLUGIN_DIRTY_ALL)
+    {
+        rcDirty = cv::Rect(0, 0, amat[0].cols, amat[0].rows);
+    }
+    else if (info.nDirtyRects == 0)
+    {
+        rcDirty = cv::Rect();
+    }
+    else
+    {
+        const RECT& rc = info.rcDirty[0];
+        rcDirty = cv::Rect(rc.left, rc.top, rc.right - rc.left, rc.bottom - rc.top);
+    }
+    return TRUE;
+}
+
+static int DoDiv255(int value)
+{
+    value += 128;
+    return (value + (value >> 8)) >> 8;
+}
+
+// Whether a byte of the random frame is the blend of its input dst, for a
+// fill coverage and an outline coverage that give the black and the white
+// bytes.
+static bool DoCheckByte(int dst, int nBlack, int nWhite, int nOut)
+{
+    const int f = nBlack;
+    for (int o = 0; o < 256; ++o)
+    {
+        const int t = DoDiv255(255 * (255 - o));
+        if (DoDiv255(t * (255 - f) + 255 * f) != nWhite)
+            continue;
+
+        const double eExact = dst * (255.0 - o) * (255.0 - f) / 65025.0 + f;
+        if (fabs(nOut - eExact) <= 1.0)
+            return true;
+    }
+    return false;
+}
+
+static INT DoCheckComposite(const CLOCK_CASE& cc, INT iCase,
+                            const cv::Mat amat[CLOCK_FRAME_COUNT],
+                            const cv::Rect& rcDirty)
+{
+    const cv::Mat matIn = DoMakeFrame(cc, 1, CLOCK_FRAME_RANDOM);
+    const int cb = matIn.cols * matIn.channels();
+    const int cn = matIn.channels();
+    for (int y = 0; y < matIn.rows; ++y)
+    {
+        const uchar *pbIn = matIn.ptr<uchar>(y);
+        const uchar *pbBlack = amat[CLOCK_FRAME_BLACK].ptr<uchar>(y);
+        const uchar *pbWhite = amat[CLOCK_FRAME_WHITE].ptr<uchar>(y);
+        const uchar *pbOut = amat[CLOCK_FRAME_RANDOM].ptr<uchar>(y);
+        for (int i = 0; i < cb; ++i)
+        {
+            const bool bDirty = rcDirty.contains(cv::Point(i / cn, y));
+            if (bDirty ? DoCheckByte(pbIn[i], pbBlack[i], pbWhite[i], pbOut[i])
+                       : (pbBlack[i] == 0 && pbWhite[i] == 255 &&
+                          pbOut[i] == pbIn[i]))
+            {
+                continue;
+            }
+
+            return PluginTest_Fail(
+                "clock case %d: \"%s\" at (%d, %d) byte %d of %dx%d type %d, "
+                "%s: %d on %d (black %d, white %d)",
+                iCase, cc.szCaption, i / cn, y, i % cn, matIn.cols, matIn.rows,
+                cc.type, bDirty ? "dirty" : "clean", pbOut[i], pbIn[i],
+                pbBlack[i], pbWhite[i]);
+        }
+    }
+    return 0;
+}
+
+// The text that Clock.yap draws for the case, from the capture time as
+// the plugin converts it.
+static void DoGetText(const CLOCK_CASE& cc, char *pszText, size_t cchText)
+{
+    ULARGE_INTEGER uli;
+    uli.QuadPart = ULONGLONG(cc.llTime);
+
+    FILETIME ft, ftLocal;
+    ft.dwLowDateTime = uli.LowPart;
+    ft.dwHighDateTime = uli.HighPart;
+    SYSTEMTIME st;
+    FileTimeToLocalFileTime(&ft, &ftLocal);
+    FileTimeToSystemTime(&ftLocal, &st);
+
+    static CAPTION_PROGRAM s_program;
+    DoCompileCaption(s_program, cc.szCaption);
+    DoRenderCaption(s_program, st, pszText, cchText);
+}
+
+// Compares the random frame of the atlas with the two passes of DoDrawText.
+static INT DoCheckPutText(const CLOCK_CASE& cc, INT iCase, const cv::Mat& matAtlas,
+                          double eMaxTolerance, double eMeanTolerance,
+                          double& eWorstMax, double& eWorstMean)
+{
+    char szText[CAPTION_MAX_TEXT];
+    DoGetText(cc, szText, ARRAYSIZE(szText));
+
+    CLOCK_SETTINGS settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.eScale = cc.nScale / 100.0;
+    settings.nAlign = cc.nAlign;
+    settings.nVAlign = cc.nVAlign;
+    settings.nMargin = cc.nMargin;
+    settings.nThickness = cc.nThickness;
+
+    const cv::Mat matIn = DoMakeFrame(cc, 1, CLOCK_FRAME_RANDOM);
+    cv::Mat matPutText = matIn.clone();
+    cv::Scalar black(0, 0, 0), white(255, 255, 255);
+    DoDrawText(settings, matPutText, szText, settings.eScale,
+               settings.nThickness * 3, black);
+    DoDrawText(settings, matPutText, szText, settings.eScale,
+               settings.nThickness, white);
+
+    // the atlas leaves the alpha channel alone, and putText does not
+    const int cn = matIn.channels();
+    const int cb = matIn.cols * cn;
+    int nMax = 0;
+    double eSum = 0;
+    size_t cDrawn = 0;
+    for (int y = 0; y < matIn.rows; ++y)
+    {
+        const uchar *pbIn = matIn.ptr<uchar>(y);
+        const uchar *pbAtlas = matAtlas.ptr<uchar>(y);
+        const uchar *pbPutText = matPutText.ptr<uchar>(y);
+        for (int i = 0; i < cb; ++i)
+        {
+            if (i % cn == 3 ||
+                (pbAtlas[i] == pbIn[i] && pbPutText[i] == pbIn[i]))
+            {
+                continue;
+            }
+
+            const int nError = abs(pbAtlas[i] - pbPutText[i]);
+            nMax = std::max(nMax, nError);
+            eSum += nError;
+            ++cDrawn;
+        }
+    }
+
+    const double eMean = cDrawn ? eSum / cDrawn : 0;
+    eWorstMax = std::max(eWorstMax, double(nMax));
+    eWorstMean = std::max(eWorstMean, eMean);
+    if (nMax <= eMaxTolerance && eMean <= eMeanTolerance)
+        return 0;
+
+    return PluginTest_Fail(
+        "clock case %d: \"%s\" on %dx%d type %d: the atlas is off putText by "
+        "max %d, mean %.3f (tolerances %g, %g)",
+        iCase, szText, matIn.cols, matIn.rows, cc.type, nMax, eMean,
+        eMaxTolerance, eMeanTolerance);
+}
+
+INT Test_Clock(void)
+{
+    const PLUGIN_ISA isaBest = PluginCpu_Select(PLUGIN_ISA_AUTO);
+    const double eMaxTolerance =
+        PluginTest_GetTolerance("YAPTEST_CLOCK_MAX_ERROR", CLOCK_MAX_ERROR);
+    const double eMeanTolerance =
+        PluginTest_GetTolerance("YAPTEST_CLOCK_MEAN_ERROR", CLOCK_MEAN_ERROR);
+    double eWorstMax = 0, eWorstMean = 0;
+
+    cv::RNG rng(0x434C4B);
+    INT nFailures = 0;
+    for (INT iCase = 0; iCase < CLOCK_TEST_CASES; ++iCase)
+    {
+        CLOCK_CASE cc;
+        cc.nScale = rng.uniform(20, 301);
+        cc.nThickness = rng.uniform(1, 8);
+        cc.nAlign = rng.uniform(0, 3);
+        cc.nVAlign = rng.uniform(0, 3);
+        cc.nMargin = rng.uniform(0, 20);
+        DoRandomCaption(rng, cc.szCaption, int(ARRAYSIZE(cc.szCaption)));
+        cc.type = rng.uniform(0, 2) ? CV_8UC3 : CV_8UC4;
+        cc.asize[0] = PluginTest_RandomSize(rng);
+        cc.asize[1] = PluginTest_RandomSize(rng);
+        cc.ullSeed = ULONGLONG(rng.uniform(1, 0x7FFFFFFF));
+        // 2001 to 2035
+        cc.llTime = 126227808000000000LL +
+                    LONGLONG(rng.uniform(0, 0x7FFFFFFF)) * 5000000LL;
+
+        cv::Mat amatRef[CLOCK_FRAME_COUNT];
+        cv::Rect rcDirty;
+        PLUGIN_ISA isa;
+        if (!DoDrawFrames(cc, PLUGIN_ISA_GENERIC, amatRef, rcDirty, isa))
+            return nFailures + PluginTest_Fail("Clock.yap not loaded");
+
+        nFailures += DoCheckComposite(cc, iCase, amatRef, rcDirty);
+        nFailures += DoCheckPutText(cc, iCase, amatRef[CLOCK_FRAME_RANDOM],
+                                    eMaxTolerance, eMeanTolerance, eWorstMax,
+                                    eWorstMean);
+
+        // a level without kernels of its own uses those of a lower one
+        bool abTested[PLUGIN_ISA_COUNT] = { false };
+        if (isa >= PLUGIN_ISA_GENERIC && isa < PLUGIN_ISA_COUNT)
+            abTested[isa] = true;
+        for (INT nIsa = PLUGIN_ISA_GENERIC + 1; nIsa <= isaBest; ++nIsa)
+        {
+            cv::Mat amat[CLOCK_FRAME_COUNT];
+            cv::Rect rc;
+            if (!DoDrawFrames(cc, PLUGIN_ISA(nIsa), amat, rc, isa))
+                return nFailures + PluginTest_Fail("Clock.yap not loaded");
+            if (isa < PLUGIN_ISA_GENERIC || isa >= PLUGIN_ISA_COUNT ||
+                abTested[isa])
+            {
+                continue;
+            }
+            abTested[isa] = true;
+
+            for (INT iFrame = 0; iFrame < CLOCK_FRAME_COUNT; ++iFrame)
+            {
+                double eError = PluginTest_MaxError(amat[iFrame], amatRef[iFrame]);
+                if (eError == 0 && rc == rcDirty)
+                    continue;
+
+                nFailures += PluginTest_Fail(
+                    "clock case %d frame %d: %s, \"%s\" on %dx%d type %d: "
+                    "max error %g",
+                    iCase, iFrame, PluginCpu_GetName(isa), cc.szCaption,
+                    cc.asize[1].width, cc.asize[1].height, cc.type, eError);
+            }
+        }
+    }
+
+    printf("clock: the atlas is off putText by max %g, mean %.3f\n",
+           eWorstMax, eWorstMean);
+    return nFailures;
+}
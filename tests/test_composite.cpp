@@ -0,0 +1,185 @@
+// test_composite.cpp --- PluginFramework tests of the composite kernels of Clock.yap
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "PluginTest.h"
+#include "../plugins/PluginCpu.h"
+#include "../plugins/Clock/Clock_kernels.h"
+#include <cstring>
+#include <vector>
+
+// Each COMPOSITE_ROW kernel that the CPU can run must give the bytes of
+//     dst = div255(div255(dst * (255 - o)) * (255 - f) + 255 * f)
+// for every dst, o and f, and for rows of every length and alignment.  It
+// must return a multiple of its width and not touch the bytes after it.
+
+#define COMPOSITE_TEST_ROWS 2000
+#define COMPOSITE_MAX_WIDTH 64      // of the vectors of the kernels
+#define COMPOSITE_GUARD 0xA5
+
+struct COMPOSITE_KERNEL
+{
+    const char *pszName;
+    PLUGIN_ISA isa;
+    COMPOSITE_ROW (*pfnGet)(void);
+    int nWidth;                     // bytes per vector
+};
+
+static const COMPOSITE_KERNEL s_kernels[] =
+{
+    { "sse2", PLUGIN_ISA_SSE2, Clock_GetCompositeRowSSE2, 16 },
+    { "avx2", PLUGIN_ISA_AVX2, Clock_GetCompositeRowAVX2, 32 },
+    { "avx512", PLUGIN_ISA_AVX512, Clock_GetCompositeRowAVX512, 64 },
+};
+
+static inline int DoDiv255(int value)
+{
+    value += 128;
+    return (value + (value >> 8)) >> 8;
+}
+
+static void DoCompositeRowRef(unsigned char *pb, const unsigned char *po,
+                              const unsigned char *pf, int cb)
+{
+    for (int i = 0; i < cb; ++i)
+    {
+        const int o = po[i], f = pf[i];
+        pb[i] = (unsigned char)DoDiv255(DoDiv255(pb[i] * (255 - o)) * (255 - f) +
+                                        255 * f);
+    }
+}
+
+// Runs the kernel on cb bytes at the offset ib of the buffers, as
+// DoCompositeText does, and compares them with the reference.
+static INT DoCheckRow(const COMPOSITE_KERNEL& kernel, COMPOSITE_ROW fn,
+                      std::vector<unsigned char>& vecDst,
+                      const std::vector<unsigned char>& vecOutline,
+                      const std::vector<unsigned char>& vecFill, int ib, int cb)
+{
+    std::vector<unsigned char> vecRef(vecDst);
+    DoCompositeRowRef(&vecRef[ib], &vecOutline[ib], &vecFill[ib], cb);
+
+    const int cbDone = fn(&vecDst[ib], &vecOutline[ib], &vecFill[ib], cb);
+    if (cbDone < 0 || cb < cbDone || cbDone % kernel.nWidth != 0 ||
+        cb - cbDone >= kernel.nWidth)
+    {
+        return PluginTest_Fail("composite %s: %d of %d bytes at %d done",
+                               kernel.pszName, cbDone, cb, ib);
+    }
+    DoCompositeRowRef(&vecDst[ib + cbDone], &vecOutline[ib + cbDone],
+                      &vecFill[ib + cbDone], cb - cbDone);
+
+    if (memcmp(&vecDst[0], &vecRef[0], vecDst.size()) == 0)
+        return 0;
+
+    for (size_t i = 0; i < vecDst.size(); ++i)
+    {
+        if (vecDst[i] == vecRef[i])
+            continue;
+
+        const int ibDiff = int(i) - ib;
+        return PluginTest_Fail(
+            "composite %s: byte %d of %d at %d: %d, not %d (o %d, f %d)",
+            kernel.pszName, ibDiff, cb, ib, vecDst[i], vecRef[i],
+            vecOutline[i], vecFill[i]);
+    }
+    return 0;
+}
+
+// Every dst for every o and f, in rows of 256 bytes.
+static INT DoCheckAll(const COMPOSITE_KERNEL& kernel, COMPOSITE_ROW fn)
+{
+    std::vector<unsigned char> vecDst(256), vecOutline(256), vecFill(256);
+    for (int o = 0; o < 256; ++o)
+    {
+        for (int f = 0; f < 256; ++f)
+        {
+            for (int d = 0; d < 256; ++d)
+            {
+                vecDst[d] = (unsigned char)d;
+                vecOutline[d] = (unsigned char)o;
+                vecFill[d] = (unsigned char)f;
+            }
+            if (DoCheckRow(kernel, fn, vecDst, vecOutline, vecFill, 0, 256))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+// Fills a coverage row as the text patches look: mostly zero, with runs
+// of full and partial coverage.
+static void DoRandomCoverage(cv::RNG& rng, std::vector<unsigned char>& vec)
+{
+    int nMode = rng.uniform(0, 3);
+    for (size_t i = 0; i < vec.size(); ++i)
+    {
+        if (rng.uniform(0, 16) == 0)
+            nMode = rng.uniform(0, 3);
+
+        switch (nMode)
+        {
+        case 0:
+            vec[i] = 0;
+            break;
+        case 1:
+            vec[i] = rng.uniform(0, 2) ? 255 : 0;
+            break;
+        default:
+            vec[i] = (unsigned char)rng.uniform(0, 256);
+            break;
+        }
+    }
+}
+
+// Random rows of every tail up to the width of the kernel, at every
+// alignment, between guard bytes.
+static INT DoCheckRandom(const COMPOSITE_KERNEL& kernel, COMPOSITE_ROW fn,
+                         cv::RNG& rng)
+{
+    for (INT iRow = 0; iRow < COMPOSITE_TEST_ROWS; ++iRow)
+    {
+        const int cb = (iRow < 4 * kernel.nWidth) ? iRow
+                                                  : rng.uniform(0, 4096);
+        const int ib = iRow % COMPOSITE_MAX_WIDTH;
+        const size_t cbBuffer = ib + cb + COMPOSITE_MAX_WIDTH;
+
+        std::vector<unsigned char> vecDst(cbBuffer, COMPOSITE_GUARD);
+        std::vector<unsigned char> vecOutline(cbBuffer), vecFill(cbBuffer);
+        for (int i = 0; i < cb; ++i)
+        {
+            vecDst[ib + i] = (unsigned char)rng.uniform(0, 256);
+        }
+        DoRandomCoverage(rng, vecOutline);
+        DoRandomCoverage(rng, vecFill);
+
+        if (DoCheckRow(kernel, fn, vecDst, vecOutline, vecFill, ib, cb))
+            return 1;
+    }
+    return 0;
+}
+
+INT Test_Composite(void)
+{
+    const PLUGIN_ISA isaBest = PluginCpu_Select(PLUGIN_ISA_AUTO);
+
+    cv::RNG rng(0x434F4D);
+    INT nFailures = 0, nTested = 0;
+    for (size_t i = 0; i < ARRAYSIZE(s_kernels); ++i)
+    {
+        const COMPOSITE_KERNEL& kernel = s_kernels[i];
+        COMPOSITE_ROW fn = kernel.pfnGet();
+        if (!fn || isaBest < kernel.isa)
+        {
+            printf("composite %s: skipped\n", kernel.pszName);
+            continue;
+        }
+
+        nFailures += DoCheckAll(kernel, fn);
+        nFailures += DoCheckRandom(kernel, fn, rng);
+        ++nTested;
+    }
+
+    if (nTested == 0)
+        printf("composite: no kernels for this CPU\n");
+    return nFailures;
+}
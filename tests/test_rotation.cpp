@@ -0,0 +1,382 @@
+// test_rotation.cpp --- PluginFramework headless tests of Rotation.yap
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "PluginTest.h"
+#include "../plugins/PluginCpu.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// The quarter turns and the flips must equal cv::transpose and cv::flip bit
+// for bit, at every level of the kernels and with one or several workers.
+// ROTATION_CUSTOM must equal the plain level with one worker, and that must
+// be close to a bilinear warp by the homography of the settings, computed
+// here in doubles: the plugin rounds the source coordinates to 1/32 pixel.
+// Each load rotates frames of two sizes, so that the cached warp maps are
+// rebuilt.
+//
+// The matrix runs every type and mode on fixed sizes, and then the random
+// cases vary the sizes, the views and the warps.
+
+#define ROTATION_TEST_CASES 60
+
+// The tolerances of ROTATION_CUSTOM, in parts of the range of the values of
+// the frame.  A step of 1/64 pixel in x and y moves a bilinear sample by up
+// to 1/32 of the range.
+#define ROTATION_WARP_MAX_ERROR (1.0 / 16)
+#define ROTATION_WARP_MEAN_ERROR (1.0 / 128)
+
+// The values of the setting "Rotation".
+enum
+{
+    TEST_ROTATION_NONE,
+    TEST_ROTATION_90,
+    TEST_ROTATION_180,
+    TEST_ROTATION_270,
+    TEST_ROTATION_FLIPH,
+    TEST_ROTATION_FLIPV,
+    TEST_ROTATION_CUSTOM
+};
+
+struct ROTATION_CASE
+{
+    INT nRotation;
+    INT nAngle;
+    INT nZoom;
+    INT nKeystone;
+    int type;
+    cv::Size asize[2];
+    ULONGLONG aullSeeds[2];         // of the frames
+};
+
+static const int s_anTypes[] =
+{
+    CV_8UC1, CV_8UC2, CV_8UC3, CV_8UC4, CV_16UC1, CV_16UC2, CV_16UC3,
+    CV_16UC4, CV_32FC1, CV_32FC3, CV_16SC1, CV_16SC3, CV_64FC1,
+};
+
+// The sizes of the matrix: single pixels, rows and columns, the edges of
+// the tiles and the vectors, and a frame of a camera.
+static const cv::Size s_asizeMatrix[] =
+{
+    cv::Size(1, 1), cv::Size(37, 1), cv::Size(1, 29), cv::Size(7, 5),
+    cv::Size(16, 16), cv::Size(17, 33), cv::Size(64, 64), cv::Size(65, 127),
+    cv::Size(640, 480),
+};
+
+static const INT s_anThreads[] = { 1, 3 };
+
+static cv::Mat DoMakeFrame(const ROTATION_CASE& rc, INT iFrame)
+{
+    cv::RNG rng(rc.aullSeeds[iFrame]);
+    return PluginTest_RandomFrame(rng, rc.asize[iFrame], rc.type);
+}
+
+static void DoRotateReference(const ROTATION_CASE& rc, const cv::Mat& src,
+                              cv::Mat& dst)
+{
+    cv::Mat matTransposed;
+    switch (rc.nRotation)
+    {
+    case TEST_ROTATION_90:
+        cv::transpose(src, matTransposed);
+        cv::flip(matTransposed, dst, 1);
+        break;
+    case TEST_ROTATION_270:
+        cv::transpose(src, matTransposed);
+        cv::flip(matTransposed, dst, 0);
+        break;
+    case TEST_ROTATION_180:
+        cv::flip(src, dst, -1);
+        break;
+    case TEST_ROTATION_FLIPH:
+        cv::flip(src, dst, 1);
+        break;
+    case TEST_ROTATION_FLIPV:
+        cv::flip(src, dst, 0);
+        break;
+    default:
+        src.copyTo(dst);
+        break;
+    }
+}
+
+// The homography of ROTATION_CUSTOM from a destination pixel to the source
+// (see DoBuildWarpMaps): about the center, it undoes the keystone, then the
+// zoom and the rotation.
+//     H = T(cx, cy) * [c s 0; -s c 0; 0 0 zoom] * [1 0 0; 0 1 0; 0 -k 1]
+//         * T(-cx, -cy)
+static void DoGetWarpHomography(const ROTATION_CASE& rc, cv::Size size,
+                                double h[3][3])
+{
+    const double cx = (size.width - 1) * 0.5, cy = (size.height - 1) * 0.5;
+    const double radians = rc.nAngle * (CV_PI / 1800);
+    const double c = cos(radians), s = sin(radians);
+    const double zoom = rc.nZoom / 100.0;
+    const double k = (rc.nKeystone / 100.0) / std::max(cy, 1.0);
+
+    const double a[4][3][3] =
+    {
+        { { 1, 0, cx }, { 0, 1, cy }, { 0, 0, 1 } },
+        { { c, s, 0 }, { -s, c, 0 }, { 0, 0, zoom } },
+        { { 1, 0, 0 }, { 0, 1, 0 }, { 0, -k, 1 } },
+        { { 1, 0, -cx }, { 0, 1, -cy }, { 0, 0, 1 } },
+    };
+    double m[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    for (INT n = 0; n < 4; ++n)
+    {
+        for (INT i = 0; i < 3; ++i)
+        {
+            for (INT j = 0; j < 3; ++j)
+            {
+                h[i][j] = m[i][0] * a[n][0][j] + m[i][1] * a[n][1][j] +
+                          m[i][2] * a[n][2][j];
+            }
+        }
+        memcpy(m, h, sizeof(m));
+    }
+}
+
+static double DoGetValue(const cv::Mat& mat, int y, int i)
+{
+    switch (mat.depth())
+    {
+    case CV_8U:
+        return mat.ptr<uchar>(y)[i];
+    case CV_16U:
+        return mat.ptr<ushort>(y)[i];
+    case CV_16S:
+        return mat.ptr<short>(y)[i];
+    case CV_32F:
+        return mat.ptr<float>(y)[i];
+    default:
+        return mat.ptr<double>(y)[i];
+    }
+}
+
+// The range of the values of PluginTest_RandomFrame.
+static double DoGetRange(int type)
+{
+    switch (CV_MAT_DEPTH(type))
+    {
+    case CV_8U:
+        return 255;
+    case CV_16U:
+    case CV_16S:
+        return 65535;
+    default:
+        return 2000;
+    }
+}
+
+// Compares dst with the bilinear warp of src by the homography; the pixels
+// out of src are zero (BORDER_CONSTANT).
+static INT DoCheckWarp(const ROTATION_CASE& rc, INT iCase, INT iFrame,
+                       const cv::Mat& src, const cv::Mat& dst)
+{
+    if (dst.size() != src.size() || dst.type() != src.type())
+    {
+        return PluginTest_Fail("rotation case %d frame %d: custom, %dx%d "
+                               "type %d to %dx%d type %d",
+                               iCase, iFrame, src.cols, src.rows, src.type(),
+                               dst.cols, dst.rows, dst.type());
+    }
+
+    double h[3][3];
+    DoGetWarpHomography(rc, src.size(), h);
+
+    const int cn = src.channels();
+    double eMax = 0, eSum = 0;
+    for (int y = 0; y < dst.rows; ++y)
+    {
+        for (int x = 0; x < dst.cols; ++x)
+        {
+            const double w = h[2][0] * x + h[2][1] * y + h[2][2];
+            const double xSrc = (h[0][0] * x + h[0][1] * y + h[0][2]) / w;
+            const double ySrc = (h[1][0] * x + h[1][1] * y + h[1][2]) / w;
+            const int x0 = cvFloor(xSrc), y0 = cvFloor(ySrc);
+            const double fx = xSrc - x0, fy = ySrc - y0;
+            for (int ch = 0; ch < cn; ++ch)
+            {
+                double value = 0;
+                for (INT k = 0; k < 4; ++k)
+                {
+                    const int xk = x0 + (k & 1), yk = y0 + (k >> 1);
+                    if (xk < 0 || yk < 0 || xk >= src.cols || yk >= src.rows)
+                        continue;
+                    value += ((k & 1) ? fx : 1 - fx) * ((k >> 1) ? fy : 1 - fy) *
+                             DoGetValue(src, yk, xk * cn + ch);
+                }
+
+                const double eError = fabs(DoGetValue(dst, y, x * cn + ch) - value);
+                eMax = std::max(eMax, eError);
+                eSum += eError;
+            }
+        }
+    }
+
+    const double eRange = DoGetRange(src.type());
+    const double eMean = eSum / (double(dst.total()) * cn);
+    if (eMax <= eRange * ROTATION_WARP_MAX_ERROR + 1 &&
+        eMean <= eRange * ROTATION_WARP_MEAN_ERROR)
+    {
+        return 0;
+    }
+
+    return PluginTest_Fail(
+        "rotation case %d frame %d: custom (%d, %d, %d), %dx%d type %d: "
+        "off the homography by max %g, mean %g",
+        iCase, iFrame, rc.nAngle, rc.nZoom, rc.nKeystone, src.cols, src.rows,
+        src.type(), eMax, eMean);
+}
+
+// Loads Rotation.yap with the settings of the case, rotates both frames and
+// unloads it.  isa gets the level that the plugin chose.
+static BOOL DoRotateFrames(const ROTATION_CASE& rc, PLUGIN_ISA isaCap,
+                           INT nThreads, cv::Mat amat[2], PLUGIN_ISA& isa)
+{
+    PluginTest_SetDword(TEXT("Rotation_yap"), TEXT("Rotation"), rc.nRotation);
+    PluginTest_SetDword(TEXT("Rotation_yap"), TEXT("Angle"), DWORD(rc.nAngle));
+    PluginTest_SetDword(TEXT("Rotation_yap"), TEXT("Zoom"), rc.nZoom);
+    PluginTest_SetDword(TEXT("Rotation_yap"), TEXT("Keystone"), DWORD(rc.nKeystone));
+    PluginTest_SetDword(TEXT("Rotation_yap"), TEXT("Threads"), nThreads);
+    PluginTest_SetDword(TEXT("Rotation_yap"), TEXT("Isa"), isaCap);
+
+    PluginHost host(PLUGIN_TEST_STREAM);
+    PLUGIN *pi = host.LoadEntries(Rotation_Plugin_Load, Rotation_Plugin_Unload,
+                                  Rotation_Plugin_Act);
+    if (!pi)
+        return FALSE;
+    isa = PLUGIN_ISA(PluginTest_GetCounter(host, pi, "isa"));
+
+    for (INT iFrame = 0; iFrame < 2; ++iFrame)
+    {
+        amat[iFrame] = DoMakeFrame(rc, iFrame);
+        host.Act(pi, PLUGIN_ACTION_PICWRITE, (WPARAM)&amat[iFrame], 0);
+
+        // the frame may be in the allocator of the host
+        amat[iFrame] = amat[iFrame].clone();
+    }
+    host.UnloadAll();
+    return TRUE;
+}
+
+static INT DoCheck(const ROTATION_CASE& rc, INT iCase, PLUGIN_ISA isa,
+                   INT nThreads, const cv::Mat amat[2], const cv::Mat amatRef[2])
+{
+    INT nFailures = 0;
+    for (INT iFrame = 0; iFrame < 2; ++iFrame)
+    {
+        double eError = PluginTest_MaxError(amat[iFrame], amatRef[iFrame]);
+        if (eError == 0)
+            continue;
+
+        nFailures += PluginTest_Fail(
+            "rotation case %d frame %d: %s, %d threads, %dx%d type %d, "
+            "rotation %d (%d, %d, %d): %dx%d, max error %g",
+            iCase, iFrame, PluginCpu_GetName(isa), nThreads,
+            rc.asize[iFrame].width, rc.asize[iFrame].height, rc.type,
+            rc.nRotation, rc.nAngle, rc.nZoom, rc.nKeystone,
+            amat[iFrame].cols, amat[iFrame].rows, eError);
+    }
+    return nFailures;
+}
+
+// Checks the case at every level with one and several workers.
+static INT DoTestCase(const ROTATION_CASE& rc, INT iCase, PLUGIN_ISA isaBest)
+{
+    cv::Mat amatRef[2];
+    INT nFailures = 0;
+    if (rc.nRotation == TEST_ROTATION_CUSTOM)
+    {
+        PLUGIN_ISA isa;
+        if (!DoRotateFrames(rc, PLUGIN_ISA_GENERIC, 1, amatRef, isa))
+            return PluginTest_Fail("Rotation.yap not loaded");
+        for (INT iFrame = 0; iFrame < 2; ++iFrame)
+        {
+            nFailures += DoCheckWarp(rc, iCase, iFrame, DoMakeFrame(rc, iFrame),
+                                     amatRef[iFrame]);
+        }
+    }
+    else
+    {
+        for (INT iFrame = 0; iFrame < 2; ++iFrame)
+        {
+            DoRotateReference(rc, DoMakeFrame(rc, iFrame), amatRef[iFrame]);
+        }
+    }
+
+    // a level without kernels of its own uses those of a lower one
+    bool abTested[PLUGIN_ISA_COUNT][ARRAYSIZE(s_anThreads)] = { { false } };
+    for (INT nIsa = PLUGIN_ISA_GENERIC; nIsa <= isaBest; ++nIsa)
+    {
+        for (size_t iThreads = 0; iThreads < ARRAYSIZE(s_anThreads); ++iThreads)
+        {
+            cv::Mat amat[2];
+            PLUGIN_ISA isa;
+            if (!DoRotateFrames(rc, PLUGIN_ISA(nIsa), s_anThreads[iThreads],
+                                amat, isa))
+            {
+                return nFailures + PluginTest_Fail("Rotation.yap not loaded");
+            }
+            if (isa < PLUGIN_ISA_GENERIC || isa >= PLUGIN_ISA_COUNT ||
+                abTested[isa][iThreads])
+            {
+                continue;
+            }
+            abTested[isa][iThreads] = true;
+
+            nFailures += DoCheck(rc, iCase, isa, s_anThreads[iThreads],
+                                 amat, amatRef);
+        }
+    }
+    return nFailures;
+}
+
+INT Test_Rotation(void)
+{
+    const PLUGIN_ISA isaBest = PluginCpu_Select(PLUGIN_ISA_AUTO);
+
+    // every type and mode on the sizes of s_asizeMatrix, each followed by
+    // the next one
+    INT nFailures = 0, iCase = 0;
+    for (size_t iType = 0; iType < ARRAYSIZE(s_anTypes); ++iType)
+    {
+        for (INT nRotation = TEST_ROTATION_90; nRotation <= TEST_ROTATION_CUSTOM;
+             ++nRotation)
+        {
+            for (size_t iSize = 0; iSize < ARRAYSIZE(s_asizeMatrix); ++iSize)
+            {
+                ROTATION_CASE rc;
+                rc.nRotation = nRotation;
+                rc.nAngle = 137;
+                rc.nZoom = 90;
+                rc.nKeystone = -15;
+                rc.type = s_anTypes[iType];
+                rc.asize[0] = s_asizeMatrix[iSize];
+                rc.asize[1] = s_asizeMatrix[(iSize + 1) % ARRAYSIZE(s_asizeMatrix)];
+                rc.aullSeeds[0] = 2 * iCase + 1;
+                rc.aullSeeds[1] = 2 * iCase + 2;
+                nFailures += DoTestCase(rc, iCase++, isaBest);
+            }
+        }
+    }
+
+    cv::RNG rng(0x524F54);
+    for (INT iRandom = 0; iRandom < ROTATION_TEST_CASES; ++iRandom)
+    {
+        ROTATION_CASE rc;
+        rc.nRotation = rng.uniform(TEST_ROTATION_90, TEST_ROTATION_CUSTOM + 1);
+        rc.nAngle = rng.uniform(-3600, 3601);
+        rc.nZoom = rng.uniform(10, 401);
+        rc.nKeystone = rng.uniform(-50, 51);
+        rc.type = s_anTypes[rng.uniform(0, int(ARRAYSIZE(s_anTypes)))];
+        for (INT iFrame = 0; iFrame < 2; ++iFrame)
+        {
+            rc.asize[iFrame] = PluginTest_RandomSize(rng);
+            rc.aullSeeds[iFrame] = ULONGLONG(rng.uniform(1, 0x7FFFFFFF));
+        }
+        nFailures += DoTestCase(rc, iCase++, isaBest);
+    }
+    return nFailures;
+}
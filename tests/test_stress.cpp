@@ -0,0 +1,517 @@
+// test_stress.cpp --- PluginFramework stress test of the pipelined host
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "PluginTest.h"
+#include "../plugins/PluginCpu.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Eight streams record at once, each on its own thread with its own
+// PluginHost in PLUGIN_HOST_PIPELINED mode, and each starts and stops
+// several times.  The chain is made of the plugins of this file:
+//     writer 1 -> reader 1 -> writer 2 -> reader 2 -> the sink
+// The frame N is N * 4 everywhere (CV_16UC1), writer 1 adds 1 and
+// writer 2 adds 2.
+//
+// - The writers and the sink get every frame, in order.
+// - The readers get the frames in order, and each frame they miss is one
+//   that PluginHost counted as dropped.  They hold some of the frames for
+//   a while; their frames must not change meanwhile (copy-on-write), even
+//   when the pool gives the buffers to new frames.
+// - Stop delivers all the frames, and then no plugin is called with a
+//   frame.
+//
+// Each frame is a new buffer, which Submit shares with the chain and the
+// readers by its reference count.  The odd streams have the readers
+// disabled.
+//
+// Then eight more streams load Clock.yap and Rotation.yap, each stream
+// with settings of its own (<App>_yap\Instance<stream>), and record at
+// once in the same way.  The sink of each stream must get the frames that
+// the stream gets when it records alone.
+
+#define STRESS_STREAMS 8
+#define STRESS_RECORDINGS 3
+#define STRESS_FRAMES 300
+#define STRESS_FIRST_STREAM (PLUGIN_TEST_STREAM + 1)
+#define STRESS_PLUGIN_FRAMES 40
+#define STRESS_FIRST_PLUGIN_STREAM (STRESS_FIRST_STREAM + STRESS_STREAMS)
+
+enum STRESS_ROLE
+{
+    STRESS_WRITER1,
+    STRESS_READER1,
+    STRESS_WRITER2,
+    STRESS_READER2,
+    STRESS_ROLE_COUNT
+};
+
+static const char *const s_apszRoles[STRESS_ROLE_COUNT] =
+{
+    "writer 1", "reader 1", "writer 2", "reader 2"
+};
+
+// The value that the role gets and the value that it leaves.
+static const int s_anAdded[STRESS_ROLE_COUNT + 1] = { 0, 1, 1, 3, 3 };
+
+struct STRESS_STREAM
+{
+    DWORD dwStreamID;
+    std::atomic<INT> nFailures;
+    ULONGLONG aullSeen[STRESS_ROLE_COUNT];  // in this recording
+    ULONGLONG ullDelivered;                 // by the sink
+    ULONGLONG ullSubmitted;
+    bool bRecording;
+};
+
+struct STRESS_INSTANCE
+{
+    STRESS_ROLE nRole;
+    STRESS_STREAM *pStream;
+    LONGLONG llLast;                // the last frame index, or -1
+};
+
+static STRESS_STREAM s_streams[STRESS_STREAMS];
+
+struct STRESS_PLUGIN_STREAM
+{
+    DWORD dwStreamID;
+    INT nFailures;
+    std::vector<cv::Mat> vecAlone;          // the frames, recorded alone
+    std::vector<cv::Mat> vecFrames;         // by the sink
+};
+
+static STRESS_PLUGIN_STREAM s_pluginStreams[STRESS_STREAMS];
+
+static void DoFail(STRESS_STREAM& stream, const char *pszWhat, LONGLONG llFrame)
+{
+    stream.nFailures += PluginTest_Fail("stress stream %lu frame %lld: %s",
+                                        (unsigned long)stream.dwStreamID,
+                                        llFrame, pszWhat);
+}
+
+// Whether every value of the frame is value.
+static bool DoCheckFrame(const cv::Mat& mat, int value)
+{
+    for (int y = 0; y < mat.rows; ++y)
+    {
+        const ushort *pn = mat.ptr<ushort>(y);
+        for (int x = 0; x < mat.cols; ++x)
+        {
+            if (pn[x] != value)
+                return false;
+        }
+    }
+    return true;
+}
+
+static void DoAddFrame(cv::Mat& mat, int value)
+{
+    for (int y = 0; y < mat.rows; ++y)
+    {
+        ushort *pn = mat.ptr<ushort>(y);
+        for (int x = 0; x < mat.cols; ++x)
+        {
+            pn[x] = ushort(pn[x] + value);
+        }
+    }
+}
+
+static void DoPicture(STRESS_INSTANCE *pInst, cv::Mat& mat,
+                      const PLUGIN_FRAME_INFO& info, bool bWrite)
+{
+    STRESS_STREAM& stream = *pInst->pStream;
+    const LONGLONG llFrame = LONGLONG(info.ullFrameIndex);
+    const int nRole = pInst->nRole;
+    const int value = int(llFrame * 4) + s_anAdded[nRole];
+
+    if (!stream.bRecording)
+        DoFail(stream, "a frame out of recording", llFrame);
+    if (bWrite ? llFrame != pInst->llLast + 1 : llFrame <= pInst->llLast)
+        DoFail(stream, s_apszRoles[nRole], llFrame);
+    pInst->llLast = llFrame;
+    ++stream.aullSeen[nRole];
+
+    if (!DoCheckFrame(mat, value))
+    {
+        DoFail(stream, s_apszRoles[nRole], llFrame);
+        return;
+    }
+
+    if (bWrite)
+    {
+        DoAddFrame(mat, s_anAdded[nRole + 1] - s_anAdded[nRole]);
+        return;
+    }
+
+    // hold some of the frames, so that the writers and the pool go on
+    // while the frame is shared
+    if (llFrame % 5 == 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(300));
+    else
+        std::this_thread::yield();
+
+    if (!DoCheckFrame(mat, value))
+        DoFail(stream, "a shared frame changed", llFrame);
+}
+
+static BOOL DoLoad(PLUGIN *pi, LPARAM lParam, STRESS_ROLE nRole)
+{
+    const DWORD dwStreamID = (DWORD)lParam;
+    if (dwStreamID < STRESS_FIRST_STREAM ||
+        dwStreamID >= STRESS_FIRST_STREAM + STRESS_STREAMS)
+    {
+        return FALSE;
+    }
+    STRESS_STREAM& stream = s_streams[dwStreamID - STRESS_FIRST_STREAM];
+
+    STRESS_INSTANCE *pInst = new STRESS_INSTANCE;
+    pInst->nRole = nRole;
+    pInst->pStream = &stream;
+    pInst->llLast = -1;
+    pi->p_user_data = pInst;
+
+    pi->plugin_version = 1;
+    StringCbCopy(pi->plugin_filename, sizeof(pi->plugin_filename), TEXT("Stress.yap"));
+    if (nRole == STRESS_WRITER1 || nRole == STRESS_WRITER2)
+    {
+        pi->dwFlags = PLUGIN_FLAG_PICWRITER;
+        pi->bEnabled = TRUE;
+    }
+    else
+    {
+        pi->dwFlags = PLUGIN_FLAG_PICREADER;
+        pi->bEnabled = (dwStreamID % 2 == 0);
+    }
+    return TRUE;
+}
+
+static BOOL APIENTRY Writer1_Plugin_Load(PLUGIN *pi, LPARAM lParam)
+{
+    return DoLoad(pi, lParam, STRESS_WRITER1);
+}
+
+static BOOL APIENTRY Reader1_Plugin_Load(PLUGIN *pi, LPARAM lParam)
+{
+    return DoLoad(pi, lParam, STRESS_READER1);
+}
+
+static BOOL APIENTRY Writer2_Plugin_Load(PLUGIN *pi, LPARAM lParam)
+{
+    return DoLoad(pi, lParam, STRESS_WRITER2);
+}
+
+static BOOL APIENTRY Reader2_Plugin_Load(PLUGIN *pi, LPARAM lParam)
+{
+    return DoLoad(pi, lParam, STRESS_READER2);
+}
+
+static BOOL APIENTRY Stress_Plugin_Unload(PLUGIN *pi, LPARAM lParam)
+{
+    delete (STRESS_INSTANCE *)pi->p_user_data;
+    pi->p_user_data = NULL;
+    return TRUE;
+}
+
+static LRESULT APIENTRY Stress_Plugin_Act(PLUGIN *pi, UINT uAction,
+                                          WPARAM wParam, LPARAM lParam)
+{
+    STRESS_INSTANCE *pInst = (STRESS_INSTANCE *)pi->p_user_data;
+    switch (uAction)
+    {
+    case PLUGIN_ACTION_STARTREC:
+        pInst->llLast = -1;
+        break;
+    case PLUGIN_ACTION_PICREAD:
+    case PLUGIN_ACTION_PICWRITE:
+        DoPicture(pInst, *(cv::Mat *)wParam, *(const PLUGIN_FRAME_INFO *)lParam,
+                  uAction == PLUGIN_ACTION_PICWRITE);
+        break;
+    }
+    return 0;
+}
+
+static void DoSink(const cv::Mat& mat, const PLUGIN_FRAME_INFO& info,
+                   void *pContext)
+{
+    STRESS_STREAM& stream = *(STRESS_STREAM *)pContext;
+    const LONGLONG llFrame = LONGLONG(info.ullFrameIndex);
+    if (info.ullFrameIndex != stream.ullDelivered ||
+        !DoCheckFrame(mat, int(llFrame * 4) + s_anAdded[STRESS_ROLE_COUNT]))
+    {
+        DoFail(stream, "the sink", llFrame);
+    }
+    ++stream.ullDelivered;
+}
+
+static void DoRecord(PluginHost& host, STRESS_STREAM& stream,
+                     PLUGIN *apReaders[2])
+{
+    memset(stream.aullSeen, 0, sizeof(stream.aullSeen));
+    stream.ullDelivered = stream.ullSubmitted = 0;
+    stream.bRecording = true;
+    if (!host.Start(PLUGIN_HOST_PIPELINED, DoSink, &stream))
+    {
+        DoFail(stream, "not started", -1);
+        return;
+    }
+
+    // a reader may hold a frame after the sink gets it, so each frame is
+    // a new buffer.  With the readers, some frames are in a buffer without
+    // a reference count, which Submit copies, so that it is overwritten
+    // right after Submit.
+    const bool bReaders = (stream.dwStreamID % 2 == 0);
+    std::vector<ushort> vecExternal(26 * 32);
+    cv::Mat mat;
+    for (INT iFrame = 0; iFrame < STRESS_FRAMES; ++iFrame)
+    {
+        const int nRows = 24 + iFrame % 3;
+        if (bReaders && iFrame % 5 == 0)
+        {
+            mat = cv::Mat(nRows, 32, CV_16UC1, &vecExternal[0]);
+        }
+        else
+        {
+            mat = cv::Mat();
+            mat.allocator = &host.GetAllocator();
+            mat.create(nRows, 32, CV_16UC1);
+        }
+        mat.setTo(cv::Scalar::all(iFrame * 4));
+
+        PLUGIN_FRAME_INFO info;
+        memset(&info, 0, sizeof(info));
+        info.cbSize = sizeof(info);
+        info.dwStreamID = stream.dwStreamID;
+        info.ullFrameIndex = iFrame;
+        if (host.Submit(mat, &info))
+            ++stream.ullSubmitted;
+        if (!mat.u)
+            mat.setTo(cv::Scalar::all(0xFFFF));
+    }
+
+    host.Stop();
+    stream.bRecording = false;
+
+    if (stream.ullSubmitted != STRESS_FRAMES ||
+        stream.ullDelivered != stream.ullSubmitted ||
+        stream.aullSeen[STRESS_WRITER1] != stream.ullSubmitted ||
+        stream.aullSeen[STRESS_WRITER2] != stream.ullSubmitted)
+    {
+        DoFail(stream, "frames lost in the chain", LONGLONG(stream.ullDelivered));
+    }
+
+    const STRESS_ROLE anReaders[2] = { STRESS_READER1, STRESS_READER2 };
+    for (INT i = 0; i < 2; ++i)
+    {
+        ULONGLONG ullSeen = stream.aullSeen[anReaders[i]];
+        ULONGLONG ullDropped = host.GetDropped(apReaders[i]);
+        if (bReaders ? ullSeen + ullDropped != stream.ullSubmitted
+                     : ullSeen + ullDropped != 0)
+        {
+            DoFail(stream, "frames lost by a reader", LONGLONG(ullSeen));
+        }
+    }
+}
+
+static void DoStreamProc(STRESS_STREAM *pStream)
+{
+    STRESS_STREAM& stream = *pStream;
+    PluginHost host(stream.dwStreamID);
+    PLUGIN *apReaders[2];
+    PLUGIN *pi1 = host.LoadEntries(Writer1_Plugin_Load, Stress_Plugin_Unload,
+                                   Stress_Plugin_Act);
+    apReaders[0] = host.LoadEntries(Reader1_Plugin_Load, Stress_Plugin_Unload,
+                                    Stress_Plugin_Act);
+    PLUGIN *pi2 = host.LoadEntries(Writer2_Plugin_Load, Stress_Plugin_Unload,
+                                   Stress_Plugin_Act);
+    apReaders[1] = host.LoadEntries(Reader2_Plugin_Load, Stress_Plugin_Unload,
+                                    Stress_Plugin_Act);
+    if (!pi1 || !pi2 || !apReaders[0] || !apReaders[1])
+    {
+        DoFail(stream, "not loaded", -1);
+        return;
+    }
+
+    for (INT i = 0; i < STRESS_RECORDINGS; ++i)
+    {
+        DoRecord(host, stream, apReaders);
+    }
+    host.UnloadAll();
+}
+
+// Sets the settings of the plugin stream i.  No two streams are alike.
+static void DoSetPluginSettings(DWORD dwStreamID, INT i)
+{
+    static const LPCTSTR s_apszCaptions[] =
+    {
+        TEXT("&y.&M.&d &h:&m:&s.&f"), TEXT("&h:&m:&s"), TEXT("#&f"),
+        TEXT("&d/&M &h:&m")
+    };
+    PluginTest_SetStreamDword(dwStreamID, TEXT("Clock_yap"), TEXT("Scale"),
+                              60 + i * 20);
+    PluginTest_SetStreamDword(dwStreamID, TEXT("Clock_yap"), TEXT("Thickness"),
+                              1 + i % 3);
+    PluginTest_SetStreamDword(dwStreamID, TEXT("Clock_yap"), TEXT("Align"),
+                              i % 3);
+    PluginTest_SetStreamDword(dwStreamID, TEXT("Clock_yap"), TEXT("VAlign"),
+                              (i / 3) % 3);
+    PluginTest_SetStreamDword(dwStreamID, TEXT("Clock_yap"), TEXT("Margin"),
+                              i * 2);
+    PluginTest_SetStreamSz(dwStreamID, TEXT("Clock_yap"), TEXT("Caption"),
+                           s_apszCaptions[i % ARRAYSIZE(s_apszCaptions)]);
+    PluginTest_SetStreamDword(dwStreamID, TEXT("Clock_yap"), TEXT("Isa"),
+                              PLUGIN_ISA_AUTO);
+
+    // ROTATION_NONE (0) to ROTATION_CUSTOM (6), and custom once more
+    PluginTest_SetStreamDword(dwStreamID, TEXT("Rotation_yap"),
+                              TEXT("Rotation"), i < 7 ? i : 6);
+    PluginTest_SetStreamDword(dwStreamID, TEXT("Rotation_yap"), TEXT("Angle"),
+                              DWORD(i * 40 - 100));
+    PluginTest_SetStreamDword(dwStreamID, TEXT("Rotation_yap"), TEXT("Zoom"),
+                              80 + i * 10);
+    PluginTest_SetStreamDword(dwStreamID, TEXT("Rotation_yap"),
+                              TEXT("Keystone"), DWORD(i * 5 - 20));
+    PluginTest_SetStreamDword(dwStreamID, TEXT("Rotation_yap"), TEXT("Threads"),
+                              1 + i % 3);
+    PluginTest_SetStreamDword(dwStreamID, TEXT("Rotation_yap"), TEXT("Isa"),
+                              PLUGIN_ISA_AUTO);
+}
+
+static void DoPluginSink(const cv::Mat& mat, const PLUGIN_FRAME_INFO& info,
+                         void *pContext)
+{
+    STRESS_PLUGIN_STREAM& stream = *(STRESS_PLUGIN_STREAM *)pContext;
+    stream.vecFrames.push_back(mat.clone());
+}
+
+// Records the frames of the plugin stream to its vecFrames.  The frames
+// and their capture times are the same on each call.
+static void DoRecordPlugins(STRESS_PLUGIN_STREAM& stream)
+{
+    stream.vecFrames.clear();
+
+    PluginHost host(stream.dwStreamID);
+    PLUGIN *piClock = host.LoadEntries(Clock_Plugin_Load, Clock_Plugin_Unload,
+                                       Clock_Plugin_Act);
+    PLUGIN *piRotation = host.LoadEntries(Rotation_Plugin_Load,
+                                          Rotation_Plugin_Unload,
+                                          Rotation_Plugin_Act);
+    if (!piClock || !piRotation)
+    {
+        stream.nFailures += PluginTest_Fail("stress stream %lu: not loaded",
+                                            (unsigned long)stream.dwStreamID);
+        host.UnloadAll();
+        return;
+    }
+    piClock->bEnabled = TRUE;
+    piRotation->bEnabled = TRUE;
+
+    if (!host.Start(PLUGIN_HOST_PIPELINED, DoPluginSink, &stream))
+    {
+        stream.nFailures += PluginTest_Fail("stress stream %lu: not started",
+                                            (unsigned long)stream.dwStreamID);
+        host.UnloadAll();
+        return;
+    }
+
+    const int type = (stream.dwStreamID % 2) ? CV_8UC4 : CV_8UC3;
+    cv::RNG rng(stream.dwStreamID);
+    for (INT iFrame = 0; iFrame < STRESS_PLUGIN_FRAMES; ++iFrame)
+    {
+        cv::Mat mat = PluginTest_RandomFrame(rng, cv::Size(160, 120), type);
+
+        PLUGIN_FRAME_INFO info;
+        memset(&info, 0, sizeof(info));
+        info.cbSize = sizeof(info);
+        info.dwStreamID = stream.dwStreamID;
+        info.ullFrameIndex = iFrame;
+        // 2019-01-01 00:00:00 UTC, and then at 30 fps
+        info.llCaptureTime = 131907744000000000LL + iFrame * 333333LL;
+        host.Submit(mat, &info);
+    }
+
+    host.Stop();
+    host.UnloadAll();
+}
+
+static void DoPluginStreamProc(STRESS_PLUGIN_STREAM *pStream)
+{
+    DoRecordPlugins(*pStream);
+}
+
+static INT DoTestPluginStreams(void)
+{
+    for (INT i = 0; i < STRESS_STREAMS; ++i)
+    {
+        STRESS_PLUGIN_STREAM& stream = s_pluginStreams[i];
+        stream.dwStreamID = STRESS_FIRST_PLUGIN_STREAM + i;
+        stream.nFailures = 0;
+        DoSetPluginSettings(stream.dwStreamID, i);
+
+        DoRecordPlugins(stream);
+        stream.vecAlone.swap(stream.vecFrames);
+    }
+
+    std::thread threads[STRESS_STREAMS];
+    for (INT i = 0; i < STRESS_STREAMS; ++i)
+    {
+        threads[i] = std::thread(DoPluginStreamProc, &s_pluginStreams[i]);
+    }
+
+    INT nFailures = 0;
+    for (INT i = 0; i < STRESS_STREAMS; ++i)
+    {
+        threads[i].join();
+
+        STRESS_PLUGIN_STREAM& stream = s_pluginStreams[i];
+        nFailures += stream.nFailures;
+        if (stream.vecAlone.size() != STRESS_PLUGIN_FRAMES ||
+            stream.vecFrames.size() != STRESS_PLUGIN_FRAMES)
+        {
+            nFailures += PluginTest_Fail(
+                "stress stream %lu: %d frames alone and %d at once",
+                (unsigned long)stream.dwStreamID, INT(stream.vecAlone.size()),
+                INT(stream.vecFrames.size()));
+            continue;
+        }
+
+        for (INT iFrame = 0; iFrame < STRESS_PLUGIN_FRAMES; ++iFrame)
+        {
+            double eError = PluginTest_MaxError(stream.vecFrames[iFrame],
+                                                stream.vecAlone[iFrame]);
+            if (eError == 0)
+                continue;
+
+            nFailures += PluginTest_Fail(
+                "stress stream %lu frame %d: max error %g against the stream "
+                "alone", (unsigned long)stream.dwStreamID, iFrame, eError);
+        }
+        stream.vecAlone.clear();
+        stream.vecFrames.clear();
+    }
+    return nFailures;
+}
+
+INT Test_Stress(void)
+{
+    std::thread threads[STRESS_STREAMS];
+    for (INT i = 0; i < STRESS_STREAMS; ++i)
+    {
+        s_streams[i].dwStreamID = STRESS_FIRST_STREAM + i;
+        s_streams[i].nFailures = 0;
+        threads[i] = std::thread(DoStreamProc, &s_streams[i]);
+    }
+
+    INT nFailures = 0;
+    for (INT i = 0; i < STRESS_STREAMS; ++i)
+    {
+        threads[i].join();
+        nFailures += s_streams[i].nFailures;
+    }
+
+    nFailures += DoTestPluginStreams();
+    return nFailures;
+}
@@ -0,0 +1,769 @@
+// yapmicro.cpp --- PluginFramework microbenchmarks of the plugins
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "../host/PluginHost.h"
+#ifdef _WIN32
+    #include "../plugins/mregkey.hpp"
+#else
+    #include <sched.h>
+#endif
+#include "../plugins/Clock/Clock_caption.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// NOTE: yapmicro times the hot functions of the plugins one by one, so that
+//       a regression shows in the function that regressed.  Each benchmark
+//       is run in two variants:
+//       - warm: batches of calls in a row, each batch about
+//         MICRO_BATCH_NANOS long.  The time is per call.
+//       - cold: single calls, each after a walk through a buffer larger
+//         than the caches (-evict), so that the code and the data come
+//         from memory.
+//       The median, the minimum and the 90th percentile of -reps samples
+//       are printed, as text or as JSON (-json) with one result per line,
+//       so that the output of two commits can be diffed.
+//
+//       The protocol of the CPU frequency:
+//       1. The thread is pinned to one CPU (-cpu).
+//       2. The CPU spins for -spinup milliseconds, so that the clock
+//          settles.
+//       3. A chain of dependent multiplications is timed before and after
+//          each benchmark.  Its change is the "drift" of the clock; a
+//          result that drifted by more than MICRO_MAX_DRIFT percent is
+//          marked unstable and should be run again.
+//       For numbers to compare, fix the clock of the CPU outside of this
+//       program as well (the performance governor and no turbo on Linux,
+//       the High performance plan on Windows).
+
+#define YAPMICRO_STREAM 9200
+#define MICRO_BATCH_NANOS 2000000.0
+#define MICRO_CALIBRATE_OPS 20000000
+#define MICRO_MAX_DRIFT 3.0
+
+PLUGIN_DECLARE_STATIC(Clock)
+PLUGIN_DECLARE_STATIC(Rotation)
+
+typedef void (*MICRO_PROC)(void *pContext);
+
+struct MICRO_OPTIONS
+{
+    const char *pszSuite;           // NULL for all
+    int nCpu;                       // -1 not to pin
+    int nMaxThreads;                // of the threads suite
+    int nReps;
+    int nSpinUp;                    // milliseconds
+    size_t cbEvict;
+    bool bJson;
+};
+
+struct MICRO_SAMPLES
+{
+    double eMedian;
+    double eMin;
+    double eP90;
+};
+
+static MICRO_OPTIONS s_options;
+static std::vector<unsigned char> s_vecEvict;
+static bool s_bFirstResult = true;
+static volatile unsigned int s_uSink;
+
+static double DoNow(void)
+{
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Pins the thread and the threads that it starts later, such as the
+// workers of Rotation.yap, to the CPUs nCpu to nCpu + nCpus - 1.
+static bool DoPin(int nCpu, int nCpus)
+{
+#ifdef _WIN32
+    DWORD_PTR dwMask = 0;
+    for (int i = nCpu; i < nCpu + nCpus; ++i)
+        dwMask |= DWORD_PTR(1) << i;
+    return SetProcessAffinityMask(GetCurrentProcess(), dwMask) != 0;
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = nCpu; i < nCpu + nCpus; ++i)
+        CPU_SET(i, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#endif
+}
+
+static void DoSpin(int nMillis)
+{
+    const double eEnd = DoNow() + nMillis * 1e6;
+    unsigned int u = s_uSink;
+    while (DoNow() < eEnd)
+    {
+        for (int i = 0; i < 10000; ++i)
+            u = u * 2654435761U + 1;
+    }
+    s_uSink = u;
+}
+
+// The nanoseconds of a chain of dependent multiplications, which is a
+// number of cycles of the CPU.
+static double DoCalibrate(void)
+{
+    unsigned int u = s_uSink;
+    const double eStart = DoNow();
+    for (int i = 0; i < MICRO_CALIBRATE_OPS; ++i)
+        u = u * 2654435761U + 1;
+    const double eNanos = DoNow() - eStart;
+    s_uSink = u;
+    return eNanos;
+}
+
+// Writes a line of each page and each cache line of the eviction buffer.
+static void DoEvict(void)
+{
+    unsigned char *pb = &s_vecEvict[0];
+    const size_t cb = s_vecEvict.size();
+    for (size_t ib = 0; ib < cb; ib += 64)
+        pb[ib] = (unsigned char)(pb[ib] + 1);
+}
+
+static MICRO_SAMPLES DoGetSamples(std::vector<double>& vec)
+{
+    std::sort(vec.begin(), vec.end());
+    MICRO_SAMPLES samples;
+    samples.eMedian = vec[vec.size() / 2];
+    samples.eMin = vec[0];
+    samples.eP90 = vec[(vec.size() * 9) / 10];
+    return samples;
+}
+
+static MICRO_SAMPLES DoRunWarm(MICRO_PROC fn, void *pContext)
+{
+    // the calls of a batch, doubled up to MICRO_BATCH_NANOS
+    fn(pContext);
+    int nCalls = 1;
+    for (;;)
+    {
+        const double eStart = DoNow();
+        for (int i = 0; i < nCalls; ++i)
+            fn(pContext);
+        if (DoNow() - eStart >= MICRO_BATCH_NANOS || nCalls >= (1 << 24))
+            break;
+        nCalls *= 2;
+    }
+
+    std::vector<double> vec;
+    for (int iRep = 0; iRep < s_options.nReps; ++iRep)
+    {
+        const double eStart = DoNow();
+        for (int i = 0; i < nCalls; ++i)
+            fn(pContext);
+        vec.push_back((DoNow() - eStart) / nCalls);
+    }
+    return DoGetSamples(vec);
+}
+
+static MICRO_SAMPLES DoRunCold(MICRO_PROC fn, void *pContext)
+{
+    std::vector<double> vec;
+    for (int iRep = 0; iRep < s_options.nReps; ++iRep)
+    {
+        DoEvict();
+        const double eStart = DoNow();
+        fn(pContext);
+        vec.push_back(DoNow() - eStart);
+    }
+    return DoGetSamples(vec);
+}
+
+// Prints the string in the quotes of JSON.
+static void DoPrintJsonString(const char *psz)
+{
+    putchar('"');
+    for (; *psz; ++psz)
+    {
+        if (*psz == '"' || *psz == '\\')
+            putchar('\\');
+        putchar(*psz);
+    }
+    putchar('"');
+}
+
+static void DoPrint(const char *pszSuite, const char *pszName,
+                    const char *pszVariant, const MICRO_SAMPLES& samples,
+                    double eDrift)
+{
+    const bool bUnstable = (eDrift > MICRO_MAX_DRIFT || eDrift < -MICRO_MAX_DRIFT);
+    if (s_options.bJson)
+    {
+        printf("%s  {\"suite\": \"%s\", \"name\": ",
+               s_bFirstResult ? "" : ",\n", pszSuite);
+        DoPrintJsonString(pszName);
+        printf(", \"variant\": \"%s\", \"median_ns\": %.1f, \"min_ns\": %.1f, "
+               "\"p90_ns\": %.1f, \"drift_pct\": %.2f, \"unstable\": %s}",
+               pszVariant, samples.eMedian, samples.eMin, samples.eP90, eDrift,
+               bUnstable ? "true" : "false");
+        s_bFirstResult = false;
+        return;
+    }
+
+    printf("%-9s %-40s %-4s median %12.1f ns, min %12.1f ns, p90 %12.1f ns, "
+           "drift %+.2f%%%s\n",
+           pszSuite, pszName, pszVariant, samples.eMedian, samples.eMin,
+           samples.eP90, eDrift, bUnstable ? " (unstable)" : "");
+}
+
+// Runs a benchmark warm and cold, between two calibrations.
+static void DoRun(const char *pszSuite, const char *pszName, MICRO_PROC fn,
+                  void *pContext)
+{
+    const double eBefore = DoCalibrate();
+    MICRO_SAMPLES warm = DoRunWarm(fn, pContext);
+    MICRO_SAMPLES cold = DoRunCold(fn, pContext);
+    const double eDrift = (DoCalibrate() - eBefore) * 100.0 / eBefore;
+
+    DoPrint(pszSuite, pszName, "warm", warm, eDrift);
+    DoPrint(pszSuite, pszName, "cold", cold, eDrift);
+    fflush(stdout);
+}
+
+static void DoSetDword(LPCTSTR pszApp, LPCTSTR pszName, DWORD dwValue)
+{
+    TCHAR szKey[64];
+    StringCchPrintf(szKey, ARRAYSIZE(szKey), TEXT("%s\\Instance%u"), pszApp,
+                    (UINT)YAPMICRO_STREAM);
+
+    MRegKey hkeyCompany(HKEY_CURRENT_USER,
+                        TEXT("Software\\Katayama Hirofumi MZ"), TRUE);
+    MRegKey hkeyApp(hkeyCompany, szKey, TRUE);
+    hkeyApp.SetDword(pszName, dwValue);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// caption: DoGetCaption of each caption of the dialog, and the compiled
+// program of the frame path that replaced it
+
+// The captions of OnInitDialog of Clock_yap.cpp.
+static const char *const s_apszCaptions[] =
+{
+    "&h:&m",
+    "&h:&m:&s",
+    "&h:&m:&s.&f",
+    "&y.&M.&d &h:&m:&s",
+    "&y.&M.&d &h:&m:&s.&f",
+    "&y.&M.&d",
+    "Sample Text",
+};
+
+struct CAPTION_BENCH
+{
+    const char *pszCaption;
+    SYSTEMTIME st;                  // a frame of 30 fps later at each call
+    size_t cchTotal;
+    CAPTION_PROGRAM program;
+    char szText[CAPTION_MAX_TEXT];
+};
+
+static void DoStep(SYSTEMTIME& st)
+{
+    st.wMilliseconds = WORD((st.wMilliseconds + 33) % 1000);
+}
+
+static void DoGetCaptionProc(void *pContext)
+{
+    CAPTION_BENCH *pBench = (CAPTION_BENCH *)pContext;
+    DoStep(pBench->st);
+    pBench->cchTotal += DoGetCaption(pBench->pszCaption, pBench->st).size();
+}
+
+static void DoCompileCaptionProc(void *pContext)
+{
+    CAPTION_BENCH *pBench = (CAPTION_BENCH *)pContext;
+    DoCompileCaption(pBench->program, pBench->pszCaption);
+    pBench->cchTotal += pBench->program.nTokens;
+}
+
+static void DoRenderCaptionProc(void *pContext)
+{
+    CAPTION_BENCH *pBench = (CAPTION_BENCH *)pContext;
+    DoStep(pBench->st);
+    pBench->cchTotal += DoRenderCaption(pBench->program, pBench->st,
+                                        pBench->szText, ARRAYSIZE(pBench->szText));
+}
+
+static void DoBenchCaption(void)
+{
+    for (size_t i = 0; i < ARRAYSIZE(s_apszCaptions); ++i)
+    {
+        CAPTION_BENCH bench;
+        memset(&bench, 0, sizeof(bench));
+        bench.pszCaption = s_apszCaptions[i];
+        bench.st.wYear = 2019;
+        bench.st.wMonth = 10;
+        bench.st.wDay = 17;
+        bench.st.wHour = 12;
+        bench.st.wMinute = 34;
+        bench.st.wSecond = 56;
+
+        char szName[64];
+        StringCbPrintfA(szName, sizeof(szName), "DoGetCaption \"%s\"",
+                        bench.pszCaption);
+        DoRun("caption", szName, DoGetCaptionProc, &bench);
+
+        StringCbPrintfA(szName, sizeof(szName), "DoCompileCaption \"%s\"",
+                        bench.pszCaption);
+        DoRun("caption", szName, DoCompileCaptionProc, &bench);
+
+        StringCbPrintfA(szName, sizeof(szName), "DoRenderCaption \"%s\"",
+                        bench.pszCaption);
+        DoRun("caption", szName, DoRenderCaptionProc, &bench);
+        s_uSink = s_uSink + (unsigned int)bench.cchTotal;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// drawtext: DoDrawText at several scales and thicknesses
+
+struct DRAWTEXT_BENCH
+{
+    CLOCK_SETTINGS settings;
+    cv::Mat mat;
+    int nThickness;
+    cv::Scalar color;
+};
+
+static void DoDrawTextProc(void *pContext)
+{
+    DRAWTEXT_BENCH *pBench = (DRAWTEXT_BENCH *)pContext;
+    DoDrawText(pBench->settings, pBench->mat, "2019.10.17 12:34:56.789",
+               pBench->settings.eScale, pBench->nThickness, pBench->color);
+}
+
+static void DoBenchDrawText(void)
+{
+    static const INT s_anScales[] = { 25, 50, 100, 200 };
+    static const INT s_anThickness[] = { 1, 2, 6 };
+
+    DRAWTEXT_BENCH bench;
+    memset(&bench.settings, 0, sizeof(bench.settings));
+    bench.settings.nAlign = ALIGN_RIGHT;
+    bench.settings.nVAlign = VALIGN_BOTTOM;
+    bench.settings.nMargin = 8;
+    bench.mat.create(720, 1280, CV_8UC3);
+    bench.mat.setTo(cv::Scalar::all(100));
+    bench.color = cv::Scalar(255, 255, 255);
+
+    for (size_t iScale = 0; iScale < ARRAYSIZE(s_anScales); ++iScale)
+    {
+        for (size_t i = 0; i < ARRAYSIZE(s_anThickness); ++i)
+        {
+            bench.settings.eScale = s_anScales[iScale] / 100.0;
+            bench.nThickness = s_anThickness[i];
+
+            char szName[64];
+            StringCbPrintfA(szName, sizeof(szName),
+                            "DoDrawText 1280x720 scale %d thickness %d",
+                            s_anScales[iScale], s_anThickness[i]);
+            DoRun("drawtext", szName, DoDrawTextProc, &bench);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// rotation: each branch of Plugin_PicWrite of Rotation.yap
+
+static const char *const s_apszRotations[] =
+{
+    "none", "90", "180", "270", "flip-h", "flip-v", "custom"
+};
+
+struct ROTATION_BENCH
+{
+    PluginHost *pHost;
+    PLUGIN *pi;
+    cv::Mat mat;
+    PLUGIN_FRAME_INFO info;
+};
+
+static void DoRotationProc(void *pContext)
+{
+    ROTATION_BENCH *pBench = (ROTATION_BENCH *)pContext;
+    pBench->info.nDirtyRects = PLUGIN_DIRTY_ALL;
+    pBench->pHost->Act(pBench->pi, PLUGIN_ACTION_PICWRITE, (WPARAM)&pBench->mat,
+                       (LPARAM)&pBench->info);
+}
+
+// Loads Rotation.yap with the mode and the threads, and times its
+// PLUGIN_ACTION_PICWRITE on a frame of the size and the type.
+static void DoBenchRotate(const char *pszSuite, const char *pszName,
+                          INT nRotation, INT nThreads, cv::Size size, int type)
+{
+    DoSetDword(TEXT("Rotation_yap"), TEXT("Rotation"), nRotation);
+    DoSetDword(TEXT("Rotation_yap"), TEXT("Angle"), 150);
+    DoSetDword(TEXT("Rotation_yap"), TEXT("Zoom"), 120);
+    DoSetDword(TEXT("Rotation_yap"), TEXT("Keystone"), 10);
+    DoSetDword(TEXT("Rotation_yap"), TEXT("Threads"), nThreads);
+    DoSetDword(TEXT("Rotation_yap"), TEXT("Isa"), 0);   // PLUGIN_ISA_AUTO
+
+    PluginHost host(YAPMICRO_STREAM);
+    ROTATION_BENCH bench;
+    bench.pHost = &host;
+    bench.pi = host.LoadEntries(Rotation_Plugin_Load, Rotation_Plugin_Unload,
+                                Rotation_Plugin_Act);
+    if (!bench.pi)
+    {
+        fprintf(stderr, "yapmicro: Rotation.yap not loaded\n");
+        return;
+    }
+
+    bench.mat.allocator = &host.GetAllocator();
+    bench.mat.create(size, type);
+    bench.mat.setTo(cv::Scalar::all(100));
+    memset(&bench.info, 0, sizeof(bench.info));
+    bench.info.cbSize = sizeof(bench.info);
+    bench.info.dwStreamID = YAPMICRO_STREAM;
+    bench.info.nFormat = type;
+
+    DoRun(pszSuite, pszName, DoRotationProc, &bench);
+
+    bench.mat.release();
+    host.UnloadAll();
+}
+
+static void DoBenchRotation(void)
+{
+    for (INT nRotation = 0; nRotation < INT(ARRAYSIZE(s_apszRotations)); ++nRotation)
+    {
+        char szName[64];
+        StringCbPrintfA(szName, sizeof(szName), "PicWrite %s 1280x720 8UC3",
+                        s_apszRotations[nRotation]);
+        DoBenchRotate("rotation", szName, nRotation, 1, cv::Size(1280, 720),
+                      CV_8UC3);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// types: each mode of Rotation.yap on each type of DoGetKernels, the types
+// with generic kernels and those with SIMD ones (32-bit pixels and CV_8UC3)
+
+struct TYPE_ENTRY
+{
+    int type;
+    const char *pszName;
+};
+
+static const TYPE_ENTRY s_types[] =
+{
+    { CV_8UC1, "8UC1" }, { CV_8UC2, "8UC2" }, { CV_8UC3, "8UC3" },
+    { CV_8UC4, "8UC4" }, { CV_16UC1, "16UC1" }, { CV_16UC2, "16UC2" },
+    { CV_16UC3, "16UC3" }, { CV_16UC4, "16UC4" }, { CV_32FC1, "32FC1" },
+    { CV_32FC3, "32FC3" },
+};
+
+static void DoBenchTypes(void)
+{
+    for (size_t iType = 0; iType < ARRAYSIZE(s_types); ++iType)
+    {
+        for (INT nRotation = 1; nRotation < INT(ARRAYSIZE(s_apszRotations));
+             ++nRotation)
+        {
+            char szName[64];
+            StringCbPrintfA(szName, sizeof(szName), "%s 1280x720 %s",
+                            s_apszRotations[nRotation], s_types[iType].pszName);
+            DoBenchRotate("types", szName, nRotation, 1, cv::Size(1280, 720),
+                          s_types[iType].type);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// tiles: the single-pass tiled quarter turns of Rotation.yap against the
+// two passes of cv::transpose and cv::flip that they replaced, at 1080p
+// and 4K
+
+struct TWOPASS_BENCH
+{
+    INT nRotation;
+    cv::Mat mat;
+    cv::Mat matTemp;
+    cv::Mat matOut;
+};
+
+static void DoTwoPassProc(void *pContext)
+{
+    TWOPASS_BENCH *pBench = (TWOPASS_BENCH *)pContext;
+    switch (pBench->nRotation)
+    {
+    case 1:     // ROTATION_90
+        cv::transpose(pBench->mat, pBench->matTemp);
+        cv::flip(pBench->matTemp, pBench->matOut, 1);
+        break;
+    case 2:     // ROTATION_180
+        cv::flip(pBench->mat, pBench->matTemp, 0);
+        cv::flip(pBench->matTemp, pBench->matOut, 1);
+        break;
+    case 3:     // ROTATION_270
+        cv::transpose(pBench->mat, pBench->matTemp);
+        cv::flip(pBench->matTemp, pBench->matOut, 0);
+        break;
+    }
+}
+
+static void DoBenchTiles(void)
+{
+    static const cv::Size s_asizes[] = { cv::Size(1920, 1080), cv::Size(3840, 2160) };
+    static const int s_atypes[] = { CV_8UC3, CV_8UC4 };
+
+    for (size_t iSize = 0; iSize < ARRAYSIZE(s_asizes); ++iSize)
+    {
+        for (size_t iType = 0; iType < ARRAYSIZE(s_atypes); ++iType)
+        {
+            const cv::Size size = s_asizes[iSize];
+            const int type = s_atypes[iType];
+            for (INT nRotation = 1; nRotation <= 3; ++nRotation)
+            {
+                char szName[64];
+                StringCbPrintfA(szName, sizeof(szName), "tiled %s %dx%d %dch",
+                                s_apszRotations[nRotation], size.width,
+                                size.height, CV_MAT_CN(type));
+                DoBenchRotate("tiles", szName, nRotation, 1, size, type);
+
+                TWOPASS_BENCH bench;
+                bench.nRotation = nRotation;
+                bench.mat.create(size, type);
+                bench.mat.setTo(cv::Scalar::all(100));
+                StringCbPrintfA(szName, sizeof(szName), "two-pass %s %dx%d %dch",
+                                s_apszRotations[nRotation], size.width,
+                                size.height, CV_MAT_CN(type));
+                DoRun("tiles", szName, DoTwoPassProc, &bench);
+            }
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// threads: the scaling of the workers of Rotation.yap at 4K, from one
+// thread to -threads.  Each count is pinned to as many CPUs from -cpu on.
+
+static void DoBenchThreads(void)
+{
+    static const INT s_anRotations[] = { 1, 6 };    // ROTATION_90, ROTATION_CUSTOM
+    const cv::Size size(3840, 2160);
+
+    for (size_t i = 0; i < ARRAYSIZE(s_anRotations); ++i)
+    {
+        const INT nRotation = s_anRotations[i];
+        for (INT nThreads = 1; nThreads <= s_options.nMaxThreads; ++nThreads)
+        {
+            if (s_options.nCpu >= 0 && !DoPin(s_options.nCpu, nThreads))
+            {
+                fprintf(stderr, "yapmicro: cannot pin to %d CPUs from %d\n",
+                        nThreads, s_options.nCpu);
+                break;
+            }
+
+            char szName[64];
+            StringCbPrintfA(szName, sizeof(szName), "%s %dx%d 4ch %d threads",
+                            s_apszRotations[nRotation], size.width, size.height,
+                            nThreads);
+            DoBenchRotate("threads", szName, nRotation, nThreads, size, CV_8UC4);
+        }
+    }
+
+    if (s_options.nCpu >= 0)
+        DoPin(s_options.nCpu, 1);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// spans: the cost of a PluginSpan in a plugin.  When the host records no
+// spans, the plugins ask it once per action and then give PluginSpan a
+// NULL; asking the host for each span was the cost before.
+
+struct SPAN_BENCH
+{
+    PLUGIN *pi;
+    PluginSpanRecorder recorder;
+    UINT nSpans;
+};
+
+static void DoSpanOffProc(void *pContext)
+{
+    PluginSpan span((PLUGIN *)NULL, "span", "yapmicro");
+}
+
+static void DoSpanAskProc(void *pContext)
+{
+    SPAN_BENCH *pBench = (SPAN_BENCH *)pContext;
+    PluginSpan span(PluginSpans_GetTarget(pBench->pi), "span", "yapmicro");
+}
+
+static void DoSpanOnProc(void *pContext)
+{
+    // start again before the buffer of the thread is full and drops spans
+    SPAN_BENCH *pBench = (SPAN_BENCH *)pContext;
+    if (++pBench->nSpans == PLUGIN_SPAN_CHUNK * (PLUGIN_SPAN_MAX_CHUNKS / 2))
+    {
+        pBench->recorder.Begin();
+        pBench->nSpans = 0;
+    }
+    PluginSpan span(&pBench->recorder, "span", "yapmicro");
+}
+
+static void DoBenchSpans(void)
+{
+    PluginHost host(YAPMICRO_STREAM);
+    SPAN_BENCH bench;
+    bench.pi = host.LoadEntries(Clock_Plugin_Load, Clock_Plugin_Unload,
+                                Clock_Plugin_Act);
+    bench.nSpans = 0;
+    if (!bench.pi)
+    {
+        fprintf(stderr, "yapmicro: Clock.yap not loaded\n");
+        return;
+    }
+
+    DoRun("spans", "off", DoSpanOffProc, &bench);
+    DoRun("spans", "off, asking the host", DoSpanAskProc, &bench);
+
+    bench.recorder.Begin();
+    DoRun("spans", "on", DoSpanOnProc, &bench);
+    bench.recorder.End();
+
+    host.UnloadAll();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+struct MICRO_SUITE
+{
+    const char *pszName;
+    void (*proc)(void);
+};
+
+static const MICRO_SUITE s_suites[] =
+{
+    { "caption", DoBenchCaption },
+    { "drawtext", DoBenchDrawText },
+    { "rotation", DoBenchRotation },
+    { "types", DoBenchTypes },
+    { "tiles", DoBenchTiles },
+    { "threads", DoBenchThreads },
+    { "spans", DoBenchSpans },
+};
+
+static void DoUsage(void)
+{
+    printf("Usage: yapmicro [OPTIONS]\n"
+           "Times the hot functions of the plugins, warm and cold.\n"
+           "\n"
+           "OPTIONS:\n"
+           "  -suite NAME   only this suite: caption, drawtext, rotation, types,\n"
+           "                tiles, threads or spans\n"
+           "  -cpu N        the CPU to pin the thread to (default: 0; -1 not to pin)\n"
+           "  -threads N    the most workers of the threads suite\n"
+           "                (default: one per CPU)\n"
+           "  -reps N       the samples of each variant (default: 15)\n"
+           "  -spinup MS    the spin before the first benchmark (default: 500)\n"
+           "  -evict MB     the buffer that evicts the caches (default: 64)\n"
+           "  -json         JSON output\n");
+}
+
+static bool DoParseArgs(int argc, char **argv, MICRO_OPTIONS& options)
+{
+    options.pszSuite = NULL;
+    options.nCpu = 0;
+    options.nMaxThreads = int(std::thread::hardware_concurrency());
+    options.nReps = 15;
+    options.nSpinUp = 500;
+    options.cbEvict = 64 << 20;
+    options.bJson = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        if (strcmp(arg, "-json") == 0)
+        {
+            options.bJson = true;
+            continue;
+        }
+
+        const char *value = (i + 1 < argc) ? argv[++i] : NULL;
+        if (!value)
+            return false;
+
+        if (strcmp(arg, "-suite") == 0)
+            options.pszSuite = value;
+        else if (strcmp(arg, "-cpu") == 0)
+            options.nCpu = atoi(value);
+        else if (strcmp(arg, "-threads") == 0)
+            options.nMaxThreads = atoi(value);
+        else if (strcmp(arg, "-reps") == 0)
+            options.nReps = atoi(value);
+        else if (strcmp(arg, "-spinup") == 0)
+            options.nSpinUp = atoi(value);
+        else if (strcmp(arg, "-evict") == 0)
+            options.cbEvict = size_t(atoi(value)) << 20;
+        else
+            return false;
+    }
+    return options.nMaxThreads > 0 && options.nReps > 0 && options.nSpinUp >= 0 && options.cbEvict > 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (!DoParseArgs(argc, argv, s_options))
+    {
+        DoUsage();
+        return 1;
+    }
+
+    bool bFound = !s_options.pszSuite;
+    for (size_t i = 0; i < ARRAYSIZE(s_suites); ++i)
+    {
+        if (s_options.pszSuite && strcmp(s_options.pszSuite, s_suites[i].pszName) == 0)
+            bFound = true;
+    }
+    if (!bFound)
+    {
+        DoUsage();
+        return 1;
+    }
+
+    if (s_options.nCpu >= 0 && !DoPin(s_options.nCpu, 1))
+    {
+        fprintf(stderr, "yapmicro: cannot pin to CPU %d\n", s_options.nCpu);
+        return 2;
+    }
+    s_vecEvict.resize(s_options.cbEvict);
+    DoSpin(s_options.nSpinUp);
+    const double eCalibration = DoCalibrate();
+
+    if (s_options.bJson)
+    {
+        printf("{\"cpu\": %d, \"reps\": %d, \"evict_bytes\": %llu, "
+               "\"calibration_ns\": %.0f, \"results\": [\n",
+               s_options.nCpu, s_options.nReps,
+               (unsigned long long)s_options.cbEvict, eCalibration);
+    }
+    else
+    {
+        printf("cpu %d, %d reps, %.0f ns for %d multiplications\n",
+               s_options.nCpu, s_options.nReps, eCalibration,
+               MICRO_CALIBRATE_OPS);
+    }
+
+    for (size_t i = 0; i < ARRAYSIZE(s_suites); ++i)
+    {
+        if (s_options.pszSuite && strcmp(s_options.pszSuite, s_suites[i].pszName) != 0)
+            continue;
+        s_suites[i].proc();
+    }
+
+    if (s_options.bJson)
+        printf("\n]}\n");
+    return 0;
+}
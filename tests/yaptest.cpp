@@ -0,0 +1,188 @@
+// yaptest.cpp --- PluginFramework headless tests
+// Copyright (C) 2019 Katayama Hirofumi MZ <katayama.hirofumi.mz@gmail.com>
+// This file is public domain software.
+#include "PluginTest.h"
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+
+struct PLUGIN_TEST
+{
+    const char *pszName;
+    PLUGIN_TEST_PROC proc;
+};
+
+static const PLUGIN_TEST s_tests[] =
+{
+    { "rotation", Test_Rotation },
+    { "clock", Test_Clock },
+    { "composite", Test_Composite },
+    { "alloc", Test_Alloc },
+    { "stress", Test_Stress },
+};
+
+INT PluginTest_Fail(const char *pszFormat, ...)
+{
+    va_list va;
+    va_start(va, pszFormat);
+    fprintf(stderr, "FAIL: ");
+    vfprintf(stderr, pszFormat, va);
+    fprintf(stderr, "\n");
+    va_end(va);
+    return 1;
+}
+
+void PluginTest_SetStreamSz(DWORD dwStreamID, LPCTSTR pszApp,
+                            LPCTSTR pszName, LPCTSTR pszValue)
+{
+    TCHAR szKey[64];
+    StringCchPrintf(szKey, ARRAYSIZE(szKey), TEXT("%s\\Instance%u"), pszApp,
+                    (UINT)dwStreamID);
+
+    MRegKey hkeyCompany(HKEY_CURRENT_USER,
+                        TEXT("Software\\Katayama Hirofumi MZ"), TRUE);
+    MRegKey hkeyApp(hkeyCompany, szKey, TRUE);
+    hkeyApp.SetSz(pszName, pszValue);
+}
+
+void PluginTest_SetStreamDword(DWORD dwStreamID, LPCTSTR pszApp,
+                               LPCTSTR pszName, DWORD dwValue)
+{
+    TCHAR szKey[64];
+    StringCchPrintf(szKey, ARRAYSIZE(szKey), TEXT("%s\\Instance%u"), pszApp,
+                    (UINT)dwStreamID);
+
+    MRegKey hkeyCompany(HKEY_CURRENT_USER,
+                        TEXT("Software\\Katayama Hirofumi MZ"), TRUE);
+    MRegKey hkeyApp(hkeyCompany, szKey, TRUE);
+    hkeyApp.SetDword(pszName, dwValue);
+}
+
+void PluginTest_SetSz(LPCTSTR pszApp, LPCTSTR pszName, LPCTSTR pszValue)
+{
+    PluginTest_SetStreamSz(PLUGIN_TEST_STREAM, pszApp, pszName, pszValue);
+}
+
+void PluginTest_SetDword(LPCTSTR pszApp, LPCTSTR pszName, DWORD dwValue)
+{
+    PluginTest_SetStreamDword(PLUGIN_TEST_STREAM, pszApp, pszName, dwValue);
+}
+
+cv::Size PluginTest_RandomSize(cv::RNG& rng)
+{
+    cv::Size size(rng.uniform(1, PLUGIN_TEST_MAX_SIZE + 1),
+                  rng.uniform(1, PLUGIN_TEST_MAX_SIZE + 1));
+    switch (rng.uniform(0, 8))
+    {
+    case 0:
+        size.height = 1;
+        break;
+    case 1:
+        size.width = 1;
+        break;
+    }
+    return size;
+}
+
+cv::Mat PluginTest_RandomFrame(cv::RNG& rng, cv::Size size, int type)
+{
+    cv::Mat mat;
+    if (rng.uniform(0, 2))
+    {
+        const int dx = rng.uniform(1, 8), dy = rng.uniform(0, 4);
+        cv::Mat matBuffer(size.height + dy, size.width + dx, type);
+        mat = matBuffer(cv::Rect(rng.uniform(0, dx + 1), rng.uniform(0, dy + 1),
+                                 size.width, size.height));
+    }
+    else
+    {
+        mat.create(size, type);
+    }
+
+    double eLow, eHigh;
+    switch (CV_MAT_DEPTH(type))
+    {
+    case CV_8U:
+        eLow = 0;
+        eHigh = 256;
+        break;
+    case CV_8S:
+        eLow = -128;
+        eHigh = 128;
+        break;
+    case CV_16U:
+        eLow = 0;
+        eHigh = 65536;
+        break;
+    case CV_16S:
+        eLow = -32768;
+        eHigh = 32768;
+        break;
+    default:
+        eLow = -1000;
+        eHigh = 1000;
+        break;
+    }
+    rng.fill(mat, cv::RNG::UNIFORM, cv::Scalar::all(eLow), cv::Scalar::all(eHigh));
+    return mat;
+}
+
+double PluginTest_MaxError(const cv::Mat& mat1, const cv::Mat& mat2)
+{
+    if (mat1.size() != mat2.size() || mat1.type() != mat2.type())
+        return -1;
+    if (mat1.empty())
+        return 0;
+    return cv::norm(mat1, mat2, cv::NORM_INF);
+}
+
+double PluginTest_GetTolerance(const char *pszName, double eDefault)
+{
+    const char *pszValue = getenv(pszName);
+    if (!pszValue || !*pszValue)
+        return eDefault;
+    return atof(pszValue);
+}
+
+LONGLONG PluginTest_GetCounter(PluginHost& host, PLUGIN *pi,
+                               const char *pszName)
+{
+    PLUGIN_COUNTER counter;
+    counter.cbSize = sizeof(counter);
+    for (UINT i = 0; host.GetStats(pi).GetCounter(i, counter); ++i)
+    {
+        if (strcmp(counter.szName, pszName) == 0)
+            return counter.llValue;
+    }
+    return -1;
+}
+
+// Runs the tests of the names, or all of them.
+int main(int argc, char **argv)
+{
+    INT nFailures = 0, nRun = 0;
+    for (size_t i = 0; i < ARRAYSIZE(s_tests); ++i)
+    {
+        bool bRun = (argc < 2);
+        for (int iArg = 1; iArg < argc; ++iArg)
+        {
+            if (strcmp(argv[iArg], s_tests[i].pszName) == 0)
+                bRun = true;
+        }
+        if (!bRun)
+            continue;
+
+        INT n = s_tests[i].proc();
+        printf("%s: %s (%d failures)\n", s_tests[i].pszName,
+               n ? "FAILED" : "passed", n);
+        nFailures += n;
+        ++nRun;
+    }
+
+    if (nRun == 0)
+    {
+        fprintf(stderr, "usage: yaptest [test ...]\n");
+        return 2;
+    }
+    return nFailures ? 1 : 0;
+}